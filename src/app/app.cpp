@@ -1,5 +1,6 @@
 #include "app.hpp"
 #include <random>
+#include <chrono>
 #include "../vulkan/vkcommon.hpp"
 #include "../vulkan/vkengine.hpp"
 #include "../vulkan/vkutils.hpp"
@@ -11,6 +12,10 @@
 #include "../vulkan/vkbuffer.hpp"
 #include "../vulkan/vkacstructure.hpp"
 #include "modelloader.hpp"
+#include "scenestreamer.hpp"
+#include "virtualtexture.hpp"
+#include "workerpool.hpp"
+#include "cpubvh.hpp"
 #include "camera.hpp"
 
 #include "helper.hpp"
@@ -20,7 +25,14 @@
 enum EShaderFlags
 {
 	esf_HasDiffuseMap = BIT(0),
-	esf_HasNormalMap = BIT(1)
+	esf_HasNormalMap = BIT(1),
+	esf_CompactVertex = BIT(2),
+	esf_VirtualTexture = BIT(3)
+};
+
+enum EShaderZPrepassFlags
+{
+	eszf_CompactVertex = BIT(0)
 };
 
 enum EShaderSSAOFlags
@@ -29,6 +41,39 @@ enum EShaderSSAOFlags
 	essf_Blur = BIT(0)
 };
 
+constexpr uint32_t kClusterDispatchWidth = 4096;
+constexpr uint32_t kCompactedIndexBudget = 16 * 1024 * 1024;		// uints, the drawn instances share them every culling pass
+
+// upload budget per frame while the scene streams in
+constexpr size_t kStreamBytesPerFrame = 16 * 1024 * 1024;
+constexpr uint32_t kStreamTexturesPerFrame = 2;
+constexpr size_t kTextureBudgetBytes = 256 * 1024 * 1024;
+constexpr uint32_t kResidencyUpdateFrames = 16;
+
+// material textures are paged into fixed atlases by gbuffer feedback instead of streaming whole mips
+constexpr bool kVirtualTexturing = true;
+constexpr uint32_t kFeedbackCellSize = 8;
+
+// shadow rays are traced on the cpu without ray tracing support, or always to get a reference
+constexpr bool kCpuShadows = false;
+constexpr float kShadowRayMin = 0.65f;			// as in shadowsraytrace.almfx
+constexpr float kShadowRayMax = 10000.0f;
+constexpr uint32_t kCpuShadowReportFrames = 120;
+// pixels per side traced by one inline ray query and upsampled, 1 traces every pixel with the ray tracing pipeline
+constexpr uint32_t kShadowTraceScale = 2;
+
+enum EShaderCullFlags
+{
+	escf_LateCull = 0,
+	escf_EarlyCull = BIT(0)
+};
+
+enum EShaderShadowFlags
+{
+	eshf_Trace = 0,
+	eshf_Upsample = BIT(0)
+};
+
 struct ConstantBuffer
 {
 	math::mat4 view;
@@ -39,21 +84,96 @@ struct ConstantBuffer
 	math::vec4 screenSize;
 	math::vec4 frustum;
 	math::vec4 hdrTonemap;
+	math::vec4 positionScale;
+	math::vec4 positionOffset;
+	uint32_t feedback[4];			// frame, width of the feedback buffer in cells, cell size
+	uint32_t shadowTrace[4];		// pixels per side of a block traced by one ray query
 };
 
 struct GpuMaterial
 {
-	Texture diffuse;
-	Texture normal;
+	uint32_t diffuse{ UINT32_MAX };		// AppPimpl::textures
+	uint32_t normal{ UINT32_MAX };
+	uint32_t pendingTextures{ 0 };		// drawn untextured until all of its textures arrived
 	uint64_t flags{ 0 };
+	Buffer virtualTextures{ EBufferType::Uniform };		// VirtualTextureCache ids of diffuse and normal
 };
 
 struct GpuMesh
 {
 	Buffer indices{ EBufferType::Index };
-	Buffer vertices{ EBufferType::Vertex };
+	Buffer positions{ EBufferType::Vertex };
+	Buffer attributes{ EBufferType::Vertex };
+	EIndexType indexType{ EIndexType::UInt32 };
 	uint32_t materialId{ 0 };
 	uint32_t indexCount{ 0 };
+	std::vector<MeshLod> lods;
+	std::vector<meshopt::Meshlet> meshlets;
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint32_t> meshletTriangles;
+	math::vec3 aabbMin;
+	math::vec3 aabbMax;
+	MeshStream indexStream;						// kept until the mesh is resident
+	MeshStream positionStream;
+	MeshStream attributeStream;
+	std::shared_ptr<MappedFile> file;			// while the streams point into the model cache
+	bool isResident{ false };
+	bool hasBottomAccStructure{ false };		// its BLAS, or its BVH on the cpu path, is built and can be traced
+};
+
+struct GpuInstance
+{
+	uint32_t meshId{ 0 };
+	InstanceTransform transform;
+	uint32_t rayMask{ 0xFF };		// zero keeps the instance out of every ray
+};
+
+// consecutive instances of one mesh, drawn with a single multi draw indirect
+struct DrawBatch
+{
+	uint32_t meshId;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+struct MeshCullData
+{
+	struct Lod
+	{
+		uint32_t indexOffset;
+		uint32_t indexCount;
+		float error;
+		uint32_t regionSize;		// uints in the compacted index buffer with every cluster drawn
+	};
+
+	uint32_t lodCount;
+	uint32_t padding[3];
+	Lod lods[Mesh::kMaxLods];
+};
+
+struct InstanceCullData
+{
+	math::vec4 transform[3];
+	math::vec3 aabbMin;				// world space
+	uint32_t meshIndex;
+	math::vec3 aabbMax;
+	float scale;					// largest axis scale
+	uint32_t isConeCullable;
+	uint32_t is16BitIndices;		// two indices per uint
+	uint32_t isResident;			// the mesh buffers are uploaded
+	uint32_t padding;
+};
+
+struct ClusterCullData
+{
+	math::vec3 center;
+	float radius;
+	math::vec3 coneAxis;
+	float coneCutoff;
+	uint32_t vertexOffset;
+	uint32_t triangleOffset;
+	uint32_t triangleCount;
+	uint32_t lod;
 };
 
 struct GBuffer
@@ -77,7 +197,101 @@ struct DirectShadow
 	Texture txrShadowMask;
 	ShaderRaytrace shaderShadows;
 	AccelerationStructure topAccStructure;
-	AccelerationStructure bottomAccStructure;
+	std::vector<AccelerationStructure> bottomAccStructures;		// one per mesh
+	std::unique_ptr<WorkerPool> workers;						// set when the BLASes are built or the shadows are traced on the cpu
+	AccStructBatch bottomBatch;									// the meshes streamed in and not built yet
+	std::vector<uint32_t> topInstances;							// App instance of every TLAS instance
+	bool isRefitPending{ false };
+
+	// the pipeline traces only the pixels that face the light, compacted into a list on the gpu
+	ShaderCompute shaderCompact;
+	Buffer rayPixels{ EBufferType::Storage };
+	Buffer traceArgs{ EBufferType::Indirect };					// VkTraceRaysIndirectCommandKHR, the width is the ray count
+
+	// ray queries at a reduced resolution, upsampled into the mask guided by the gbuffer
+	ShaderCompute shaderTraceQuery;
+	ShaderCompute shaderUpsample;
+	Texture txrTraceTarget;										// visibility and the traced pixel of every block
+	uint32_t traceScale{ 1 };
+
+	// the cpu traced path, no acceleration structures are built
+	bool isCpuTraced{ false };
+	std::vector<MeshBvh> meshBvhs;								// one per mesh
+	SceneBvh sceneBvh;
+	Buffer cpuDepth{ EBufferType::Storage, true };				// read back in the middle of the frame
+	Buffer cpuMask{ EBufferType::Storage, true };
+	std::vector<float> depthData;
+	std::vector<float> maskData;
+	uint64_t cpuRays{ 0 };										// since the last report
+	double cpuTraceSeconds{ 0 };
+	uint32_t cpuTraceFrames{ 0 };
+};
+
+struct OcclusionCulling
+{
+	ShaderCompute shaderHiZ;
+	ShaderCompute shaderCull;
+	ShaderCompute shaderClusterCull;
+	Buffer hizPyramid{ EBufferType::Storage };
+	Buffer hizCounter{ EBufferType::Storage };
+	Buffer meshCullData{ EBufferType::Storage };
+	Buffer instanceCullData{ EBufferType::Storage };
+	Buffer drawArgs{ EBufferType::Indirect };
+	Buffer lateDrawArgs{ EBufferType::Indirect };
+	Buffer visibility{ EBufferType::Storage };
+	Buffer clusters{ EBufferType::Storage };
+	Buffer meshletVertices{ EBufferType::Storage };
+	Buffer meshletTriangles{ EBufferType::Storage };
+	Buffer clusterInstances{ EBufferType::Storage };
+	Buffer compactedIndices{ EBufferType::StorageIndex };
+	Buffer indexAllocator{ EBufferType::Storage };				// uints of compactedIndices taken this pass, its size
+	uint32_t clusterInstanceCount{ 0 };
+	Renderpass lateZprepassRenderpass;
+	Framebuffer lateZprepassFramebuffer;
+};
+
+// mip levels of a texture that are in video memory, the coarsest ones never leave
+struct TextureResidency
+{
+	uint32_t width{ 0 };				// of the full image
+	uint32_t height{ 0 };
+	uint32_t mipCount{ 0 };
+	EPixelFormat format{ EPixelFormat::BC7 };
+	uint32_t residentMip{ 0 };
+	uint32_t lowestMip{ 0 };			// first level handed over by the streamer
+	uint32_t desiredMip{ 0 };
+	bool hasArrived{ false };
+	bool isRequested{ false };
+	bool isStreamable{ true };
+
+	size_t Bytes(uint32_t firstMip) const
+	{
+		size_t bytes = 0;
+		for (uint32_t i(firstMip); i < mipCount; ++i)
+		{
+			bytes += CompressedMipSize(format, std::max(width >> i, 1u), std::max(height >> i, 1u));
+		}
+		return bytes;
+	}
+};
+
+struct SceneStreaming
+{
+	SceneStreamer streamer;
+	bool isSceneCreated{ false };
+	size_t nextMesh{ 0 };
+	size_t nextBottomAccStructure{ 0 };				// meshes before it are traced
+	size_t hostBuildEnd{ 0 };						// meshes before it are in a started host build
+	uint32_t frame{ 0 };
+	VkDeviceSize blasBytes{ 0 };						// after compaction
+	VkDeviceSize blasSavedBytes{ 0 };
+	std::vector<InstanceCullData> instanceCullData;
+	std::vector<std::vector<uint32_t>> textureMaterials;	// texture -> materials sampling it
+	std::vector<TextureResidency> textureResidency;
+	VirtualTextureCache virtualTextures;
+	std::vector<uint32_t> virtualTextureIds;				// texture -> VirtualTextureCache id
+	Buffer feedback{ EBufferType::Storage, true };		// pages the gbuffer asked for last frame
+	std::vector<uint32_t> feedbackData;
 };
 
 struct Skybox
@@ -90,6 +304,138 @@ struct Skybox
 	Framebuffer framebuffer;
 };
 
+// largest axis scale, normal cones only stay valid under rotation and uniform scale
+static float InstanceScale(const InstanceTransform& transform, bool& isConeCullable)
+{
+	constexpr float kUniformTolerance = 1e-3f;
+
+	math::vec3 axes[3];
+	for (uint32_t column(0); column < 3; ++column)
+	{
+		axes[column] = math::vec3(transform.rows[0][column], transform.rows[1][column], transform.rows[2][column]);
+	}
+
+	const float scaleX = axes[0].magnitude();
+	const float scaleY = axes[1].magnitude();
+	const float scaleZ = axes[2].magnitude();
+	const float scale = std::max(scaleX, std::max(scaleY, scaleZ));
+	const float minScale = std::min(scaleX, std::min(scaleY, scaleZ));
+
+	const float skew = std::abs(axes[0].dot(axes[1])) + std::abs(axes[1].dot(axes[2])) + std::abs(axes[0].dot(axes[2]));
+	const float determinant = axes[0].cross(axes[1]).dot(axes[2]);
+	isConeCullable = minScale > 0.0f
+		&& (scale - minScale) <= scale * kUniformTolerance
+		&& skew <= scale * scale * kUniformTolerance
+		&& determinant > 0.0f;
+
+	return scale;
+}
+
+static void TransformAabb(const InstanceTransform& transform, const math::vec3& aabbMin, const math::vec3& aabbMax, math::vec3& worldMin, math::vec3& worldMax)
+{
+	const float center[3] = { (aabbMin.x + aabbMax.x) * 0.5f, (aabbMin.y + aabbMax.y) * 0.5f, (aabbMin.z + aabbMax.z) * 0.5f };
+	const float extent[3] = { (aabbMax.x - aabbMin.x) * 0.5f, (aabbMax.y - aabbMin.y) * 0.5f, (aabbMax.z - aabbMin.z) * 0.5f };
+
+	float worldCenter[3];
+	float worldExtent[3];
+	for (uint32_t row(0); row < 3; ++row)
+	{
+		const float* m = transform.rows[row];
+		worldCenter[row] = m[0] * center[0] + m[1] * center[1] + m[2] * center[2] + m[3];
+		worldExtent[row] = std::abs(m[0]) * extent[0] + std::abs(m[1]) * extent[1] + std::abs(m[2]) * extent[2];
+	}
+
+	worldMin = math::vec3(worldCenter[0] - worldExtent[0], worldCenter[1] - worldExtent[1], worldCenter[2] - worldExtent[2]);
+	worldMax = math::vec3(worldCenter[0] + worldExtent[0], worldCenter[1] + worldExtent[1], worldCenter[2] + worldExtent[2]);
+}
+
+// same frustum test as the culling shaders, a box crossing the camera plane counts as on screen
+static bool IsOnScreen(const math::mat4& viewProj, const math::vec3& aabbMin, const math::vec3& aabbMax)
+{
+	uint32_t outside[5] = { 0, 0, 0, 0, 0 };
+	for (uint32_t i(0); i < 8; ++i)
+	{
+		const math::vec4 corner(
+			(i & 1) ? aabbMax.x : aabbMin.x,
+			(i & 2) ? aabbMax.y : aabbMin.y,
+			(i & 4) ? aabbMax.z : aabbMin.z,
+			1.0f
+		);
+		const math::vec4 clip = viewProj * corner;
+		if (clip.w <= 0.0f)
+		{
+			return true;
+		}
+
+		outside[0] += clip.x < -clip.w ? 1 : 0;
+		outside[1] += clip.x > clip.w ? 1 : 0;
+		outside[2] += clip.y < -clip.w ? 1 : 0;
+		outside[3] += clip.y > clip.w ? 1 : 0;
+		outside[4] += clip.z > clip.w ? 1 : 0;
+	}
+
+	for (uint32_t plane(0); plane < 5; ++plane)
+	{
+		if (outside[plane] == 8)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// size of the flat depth pyramid, every level halves the previous one rounding up
+static uint32_t HiZPyramidSize(uint32_t width, uint32_t height)
+{
+	uint32_t size = 0;
+	for (uint32_t level(0); ; ++level)
+	{
+		const uint32_t texel = 2u << level;
+		const uint32_t levelWidth = std::max((width + texel - 1) / texel, 1u);
+		const uint32_t levelHeight = std::max((height + texel - 1) / texel, 1u);
+		size += levelWidth * levelHeight;
+
+		if (levelWidth == 1 && levelHeight == 1)
+		{
+			return size;
+		}
+	}
+}
+
+// object space xyz and 32 bit indices of a mesh from the streams its buffers are loaded from
+static void DecodeMeshStreams(const GpuMesh& gpuMesh, EVertexFormat vertexFormat, std::vector<float>& positions, std::vector<uint32_t>& indices)
+{
+	if (vertexFormat == EVertexFormat::Compact)
+	{
+		const size_t vertexCount = gpuMesh.positionStream.Size() / sizeof(CompactPosition);
+		const CompactPosition* pPositions = reinterpret_cast<const CompactPosition*>(gpuMesh.positionStream.Data());
+		positions.resize(vertexCount * 3);
+		for (size_t i(0); i < vertexCount; ++i)
+		{
+			// snorm, the instance transform dequantizes it like for the BLAS
+			positions[i * 3 + 0] = std::max(pPositions[i].px / 32767.0f, -1.0f);
+			positions[i * 3 + 1] = std::max(pPositions[i].py / 32767.0f, -1.0f);
+			positions[i * 3 + 2] = std::max(pPositions[i].pz / 32767.0f, -1.0f);
+		}
+	}
+	else
+	{
+		positions.resize(gpuMesh.positionStream.Size() / sizeof(float));
+		memcpy(positions.data(), gpuMesh.positionStream.Data(), positions.size() * sizeof(float));
+	}
+
+	indices.resize(gpuMesh.indexCount);
+	if (gpuMesh.indexType == EIndexType::UInt16)
+	{
+		const uint16_t* pIndices = reinterpret_cast<const uint16_t*>(gpuMesh.indexStream.Data());
+		std::copy(pIndices, pIndices + gpuMesh.indexCount, indices.begin());
+	}
+	else
+	{
+		memcpy(indices.data(), gpuMesh.indexStream.Data(), indices.size() * sizeof(uint32_t));
+	}
+}
+
 struct AppPimpl
 {
 	uint32_t swapchainImage{ 0 };
@@ -116,6 +462,9 @@ struct AppPimpl
 	Buffer constantBuffer{ EBufferType::Uniform, true };
 	Buffer fullScreenIndecies{ EBufferType::Index };
 	RenderState fullscreenState;
+	RenderState geometryState;
+	RenderState zprepassState;
+	uint64_t zprepassFlags{ 0 };
 
 	Texture txrDepth;
 	Texture txrHdrTarget;
@@ -134,9 +483,16 @@ struct AppPimpl
 	Camera mainCamera;
 
 	Skybox skybox;
-
-	std::vector<GpuMesh> meshesToDraw;
+	OcclusionCulling occlusion;
+	SceneStreaming streaming;
+
+	std::vector<GpuMesh> meshes;
+	std::vector<GpuInstance> instances;
+	bool hasMovedInstances{ false };
+	std::vector<DrawBatch> drawBatches;
+	Buffer instanceTransforms{ EBufferType::Vertex };
 	std::unordered_map<uint32_t, GpuMaterial> materials;
+	std::vector<Texture> textures;
 };
 
 
@@ -148,13 +504,19 @@ void App::Init()
 
 	m_pApp->fullscreenState.cullMode = ECull::None;
 	m_pApp->fullscreenState.hasInputAttachment = false;
+	m_pApp->geometryState.vertexFormat = EVertexFormat::Compact;
+	m_pApp->geometryState.hasInstanceStream = true;
+	m_pApp->zprepassFlags = eszf_CompactVertex;
+	m_pApp->zprepassState = m_pApp->geometryState;
+	m_pApp->zprepassState.hasAttributeStream = false;
+	m_pApp->directionalShadow.isCpuTraced = kCpuShadows || !VulkanEngine::IsRaytracingSupported();
 
 	m_pApp->acquireImageSem = VulkanEngine::CreateVkSemaphore();
 	m_pApp->presentImageSem = VulkanEngine::CreateVkSemaphore();
 	m_pApp->commandBufer = VulkanEngine::CreateCommandBuffer();
 
 
-	m_pApp->linearSampler.Create(ESampleFilter::Linear, ESampleMode::Repeat, 16, 4);
+	m_pApp->linearSampler.Create(ESampleFilter::Linear, ESampleMode::Repeat, 16, VK_LOD_CLAMP_NONE);
 	m_pApp->pointSampler.Create(ESampleFilter::Point, ESampleMode::Repeat, 0, 1);
 
 
@@ -187,12 +549,27 @@ void App::Init()
 		m_pApp->shaderSSAO.MarkProgram(EShaderType::Vertex, "MainVS");
 		m_pApp->shaderSSAO.MarkProgram(EShaderType::Fragment, "MainPS");
 	}
+	if (!m_pApp->directionalShadow.isCpuTraced)
 	{
 		auto data = helpers::sb_read_file("shaders\\shadowsraytrace.almfx");
 		m_pApp->directionalShadow.shaderShadows.SetSource(reinterpret_cast<char*>(data.data()));
 		m_pApp->directionalShadow.shaderShadows.MarkProgram(EShaderType::RayGeneration, "RayGenerationRS");
 		m_pApp->directionalShadow.shaderShadows.MarkProgram(EShaderType::RayClosestHit, "CloseHitRS");
 		m_pApp->directionalShadow.shaderShadows.MarkProgram(EShaderType::RayMiss, "MissRS");
+
+		data = helpers::sb_read_file("shaders\\shadowcompact.almfx");
+		m_pApp->directionalShadow.shaderCompact.SetSource(reinterpret_cast<char*>(data.data()));
+		m_pApp->directionalShadow.shaderCompact.MarkProgram(EShaderType::Compute, "MainCS");
+		m_pApp->directionalShadow.traceArgs.Load(std::vector<uint32_t>{ 0, 1, 1 });
+	}
+	if (!m_pApp->directionalShadow.isCpuTraced && VulkanEngine::IsRayQuerySupported())
+	{
+		auto data = helpers::sb_read_file("shaders\\shadowsrayquery.almfx");
+		m_pApp->directionalShadow.shaderTraceQuery.SetSource(reinterpret_cast<char*>(data.data()));
+		m_pApp->directionalShadow.shaderTraceQuery.MarkProgram(EShaderType::Compute, "MainCS");
+		m_pApp->directionalShadow.shaderUpsample.SetSource(reinterpret_cast<char*>(data.data()));
+		m_pApp->directionalShadow.shaderUpsample.MarkProgram(EShaderType::Compute, "MainCS");
+		m_pApp->directionalShadow.traceScale = kShadowTraceScale;
 	}
 	{
 		auto data = helpers::sb_read_file("shaders\\equirecttocube.almfx");
@@ -205,6 +582,21 @@ void App::Init()
 		m_pApp->skybox.shaderSkybox.MarkProgram(EShaderType::Vertex, "MainVS");
 		m_pApp->skybox.shaderSkybox.MarkProgram(EShaderType::Fragment, "MainPS");
 	}
+	{
+		auto data = helpers::sb_read_file("shaders\\hizdownsample.almfx");
+		m_pApp->occlusion.shaderHiZ.SetSource(reinterpret_cast<char*>(data.data()));
+		m_pApp->occlusion.shaderHiZ.MarkProgram(EShaderType::Compute, "MainCS");
+	}
+	{
+		auto data = helpers::sb_read_file("shaders\\occlusioncull.almfx");
+		m_pApp->occlusion.shaderCull.SetSource(reinterpret_cast<char*>(data.data()));
+		m_pApp->occlusion.shaderCull.MarkProgram(EShaderType::Compute, "MainCS");
+	}
+	{
+		auto data = helpers::sb_read_file("shaders\\clustercull.almfx");
+		m_pApp->occlusion.shaderClusterCull.SetSource(reinterpret_cast<char*>(data.data()));
+		m_pApp->occlusion.shaderClusterCull.MarkProgram(EShaderType::Compute, "MainCS");
+	}
 
 	m_pApp->fullScreenIndecies.Load(std::vector<uint32_t>{0, 1, 2, 1, 3, 2});
 	m_pApp->skybox.cubeIndecies.Load(std::vector<uint32_t>{0, 1, 2, 2, 3, 1, 4, 5, 6, 6, 7, 5, 8, 9, 10, 10, 11, 9, 12, 13, 14, 14, 15, 13, 16, 17, 18, 18, 19, 17, 20, 21, 22, 22, 23, 21});
@@ -217,83 +609,852 @@ void App::Init()
 	m_pApp->constantBuffer.Load(&m_pApp->constants, sizeof(ConstantBuffer));
 
 
-	Model diorama = ModelLoader().Load("models\\diorama\\diorama_ww2\\diorama.fbx");
-	//Model diorama = ModelLoader().Load("models\\backpack\\backpack.fbx");
-	for (auto& material : diorama.materials)
+	// the first frames render while the model streams in
+	const uint32_t initialTextureSize = kVirtualTexturing ? UINT32_MAX : SceneStreamer::kInitialTextureSize;
+	m_pApp->streaming.streamer.Start("models\\diorama\\diorama_ww2\\diorama.fbx", m_pApp->geometryState.vertexFormat, initialTextureSize);
+	//m_pApp->streaming.streamer.Start("models\\backpack\\backpack.fbx", m_pApp->geometryState.vertexFormat);
+	m_pApp->occlusion.hizCounter.Load(std::vector<uint32_t>{ 0 });
+	if (kVirtualTexturing)
+	{
+		m_pApp->streaming.virtualTextures.Create();
+	}
+
+	std::default_random_engine generator;
+	std::uniform_real_distribution<float> rnd_floats(0, 1);
+
+	std::vector<math::vec4> ssaoKernel(SSAO_KERNEL);
+	for (math::vec4& dir : ssaoKernel)
+	{
+		math::vec3 point;
+		point.x = rnd_floats(generator) * 2.0f - 1.0f;
+		point.y = rnd_floats(generator);
+		point.z = rnd_floats(generator) * 2.0f - 1.0f;
+
+		point = point.normalized() * (rnd_floats(generator) + 0.1f);
+
+		dir.x = point.x;
+		dir.y = point.y;
+		dir.z = point.z;
+	}
+
+	m_pApp->ssao.kernel.Load(ssaoKernel);
+
+	m_pApp->mainCamera.Position().y = 300;
+}
+
+// everything culling and drawing need for the whole scene, meshes and textures become resident later
+void App::CreateScene(Model& diorama)
+{
+	m_pApp->constants.positionScale = math::vec4(diorama.positionScale.x, diorama.positionScale.y, diorama.positionScale.z, 0);
+	m_pApp->constants.positionOffset = math::vec4(diorama.positionOffset.x, diorama.positionOffset.y, diorama.positionOffset.z, 0);
+
+	m_pApp->textures.resize(diorama.texturePaths.size());
+	m_pApp->streaming.textureMaterials.resize(diorama.texturePaths.size());
+	m_pApp->streaming.textureResidency.resize(diorama.texturePaths.size());
+	m_pApp->streaming.virtualTextureIds.assign(diorama.texturePaths.size(), UINT32_MAX);
+	for (auto& material : diorama.materials)
+	{
+		GpuMaterial& gpuMaterial = m_pApp->materials[material.first];
+		if (diorama.vertexFormat == EVertexFormat::Compact)
+		{
+			gpuMaterial.flags |= esf_CompactVertex;
+		}
+
+		gpuMaterial.diffuse = material.second.diffuseTexture;
+		gpuMaterial.normal = material.second.normalTexture;
+		for (uint32_t textureId : { gpuMaterial.diffuse, gpuMaterial.normal })
+		{
+			if (textureId != UINT32_MAX)
+			{
+				++gpuMaterial.pendingTextures;
+				m_pApp->streaming.textureMaterials[textureId].push_back(material.first);
+			}
+		}
+	}
+
+	m_pApp->meshes.resize(diorama.meshes.size());
+	for (size_t i(0); i < diorama.meshes.size(); ++i)
+	{
+		Mesh& mesh = diorama.meshes[i];
+		GpuMesh& gpuMesh = m_pApp->meshes[i];
+
+		gpuMesh.indexType = mesh.indexType;
+		gpuMesh.materialId = mesh.materialId;
+		gpuMesh.indexCount = mesh.lods[0].indexCount;
+		gpuMesh.lods = mesh.lods;
+		gpuMesh.aabbMin = mesh.aabbMin;
+		gpuMesh.aabbMax = mesh.aabbMax;
+		gpuMesh.meshlets = std::move(mesh.meshlets);
+		gpuMesh.meshletVertices = std::move(mesh.meshletVertices);
+		gpuMesh.meshletTriangles = std::move(mesh.meshletTriangles);
+		gpuMesh.indexStream = std::move(mesh.indexStream);
+		gpuMesh.positionStream = std::move(mesh.positionStream);
+		gpuMesh.attributeStream = std::move(mesh.attributeStream);
+		gpuMesh.file = mesh.file;
+	}
+
+	m_pApp->instances.resize(diorama.instances.size());
+	for (size_t i(0); i < diorama.instances.size(); ++i)
+	{
+		m_pApp->instances[i].meshId = diorama.instances[i].meshId;
+		m_pApp->instances[i].transform = diorama.instances[i].transform;
+	}
+
+	// grouped by material and then by mesh, so every mesh is one multi draw
+	std::sort(m_pApp->instances.begin(), m_pApp->instances.end(), [this](const GpuInstance& instanceA, const GpuInstance& instanceB) {
+		const uint32_t materialA = m_pApp->meshes[instanceA.meshId].materialId;
+		const uint32_t materialB = m_pApp->meshes[instanceB.meshId].materialId;
+		return materialA != materialB ? materialA > materialB : instanceA.meshId < instanceB.meshId;
+	});
+
+	{
+		std::vector<InstanceTransform> transforms(m_pApp->instances.size());
+		for (size_t i(0); i < m_pApp->instances.size(); ++i)
+		{
+			const GpuInstance& instance = m_pApp->instances[i];
+			transforms[i] = instance.transform;
+
+			if (m_pApp->drawBatches.empty() || m_pApp->drawBatches.back().meshId != instance.meshId)
+			{
+				m_pApp->drawBatches.push_back({ instance.meshId, uint32_t(i), 0 });
+			}
+			++m_pApp->drawBatches.back().instanceCount;
+		}
+		m_pApp->instanceTransforms.Load(transforms);
+	}
+
+	{
+		// everything is visible on the first frame, culling will sort it out
+		std::vector<MeshCullData> meshCullData(m_pApp->meshes.size());
+		std::vector<ClusterCullData> clusters;
+		std::vector<uint32_t> meshletVertices;
+		std::vector<uint32_t> meshletTriangles;
+		std::vector<uint32_t> meshClusterOffsets(m_pApp->meshes.size() + 1, 0);
+		for (size_t i(0); i < m_pApp->meshes.size(); ++i)
+		{
+			GpuMesh& gpuMesh = m_pApp->meshes[i];
+			MeshCullData& cullData = meshCullData[i];
+			cullData = {};
+			cullData.lodCount = uint32_t(gpuMesh.lods.size());
+			for (size_t lod(0); lod < gpuMesh.lods.size(); ++lod)
+			{
+				const MeshLod& meshLod = gpuMesh.lods[lod];
+
+				// 16 bit clusters are padded to an even triangle count, two indices go into a uint
+				uint32_t lodRegionSize = meshLod.indexCount;
+				if (gpuMesh.indexType == EIndexType::UInt16)
+				{
+					lodRegionSize = 0;
+					for (uint32_t m(meshLod.meshletOffset); m < meshLod.meshletOffset + meshLod.meshletCount; ++m)
+					{
+						lodRegionSize += ((gpuMesh.meshlets[m].triangleCount + 1) & ~1u) * 3 / 2;
+					}
+				}
+				cullData.lods[lod] = { meshLod.indexOffset, meshLod.indexCount, meshLod.error, lodRegionSize };
+
+				for (uint32_t m(meshLod.meshletOffset); m < meshLod.meshletOffset + meshLod.meshletCount; ++m)
+				{
+					const meshopt::Meshlet& meshlet = gpuMesh.meshlets[m];
+
+					ClusterCullData cluster;
+					cluster.center = math::vec3(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+					cluster.radius = meshlet.radius;
+					cluster.coneAxis = math::vec3(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]);
+					cluster.coneCutoff = meshlet.coneCutoff;
+					cluster.vertexOffset = uint32_t(meshletVertices.size()) + meshlet.vertexOffset;
+					cluster.triangleOffset = uint32_t(meshletTriangles.size()) + meshlet.triangleOffset;
+					cluster.triangleCount = meshlet.triangleCount;
+					cluster.lod = uint32_t(lod);
+					clusters.push_back(cluster);
+				}
+			}
+			meshClusterOffsets[i + 1] = uint32_t(clusters.size());
+
+			meshletVertices.insert(meshletVertices.end(), gpuMesh.meshletVertices.begin(), gpuMesh.meshletVertices.end());
+			meshletTriangles.insert(meshletTriangles.end(), gpuMesh.meshletTriangles.begin(), gpuMesh.meshletTriangles.end());
+			std::vector<meshopt::Meshlet>().swap(gpuMesh.meshlets);
+			std::vector<uint32_t>().swap(gpuMesh.meshletVertices);
+			std::vector<uint32_t>().swap(gpuMesh.meshletTriangles);
+		}
+
+		// clusters are shared by the instances of a mesh, only the work list is per instance
+		std::vector<InstanceCullData> instanceCullData(m_pApp->instances.size());
+		std::vector<VkDrawIndexedIndirectCommand> drawArgs(m_pApp->instances.size());
+		std::vector<uint32_t> clusterInstances;
+		size_t worstCaseIndices = 0;
+		for (size_t i(0); i < m_pApp->instances.size(); ++i)
+		{
+			const GpuInstance& instance = m_pApp->instances[i];
+			const GpuMesh& gpuMesh = m_pApp->meshes[instance.meshId];
+
+			InstanceCullData& cullData = instanceCullData[i];
+			cullData = {};
+			for (uint32_t row(0); row < 3; ++row)
+			{
+				const float* m = instance.transform.rows[row];
+				cullData.transform[row] = math::vec4(m[0], m[1], m[2], m[3]);
+			}
+			TransformAabb(instance.transform, gpuMesh.aabbMin, gpuMesh.aabbMax, cullData.aabbMin, cullData.aabbMax);
+
+			bool isConeCullable = false;
+			cullData.scale = InstanceScale(instance.transform, isConeCullable);
+			cullData.isConeCullable = isConeCullable ? 1 : 0;
+			cullData.meshIndex = instance.meshId;
+			cullData.is16BitIndices = gpuMesh.indexType == EIndexType::UInt16 ? 1 : 0;
+
+			for (uint32_t c(meshClusterOffsets[instance.meshId]); c < meshClusterOffsets[instance.meshId + 1]; ++c)
+			{
+				clusterInstances.push_back(c);
+				clusterInstances.push_back(uint32_t(i));
+			}
+
+			// lod 0 has the most triangles
+			drawArgs[i] = { 0, 0, 0, 0, uint32_t(i) };
+			worstCaseIndices += meshCullData[instance.meshId].lods[0].regionSize;
+		}
+
+		// regions are taken by the instances that survive culling, the buffer only needs every instance
+		// at its largest lod when that stays within the budget
+		const uint32_t compactedIndexCount = uint32_t(std::min(worstCaseIndices, size_t(kCompactedIndexBudget)));
+
+		m_pApp->occlusion.clusterInstanceCount = uint32_t(clusterInstances.size() / 2);
+		m_pApp->occlusion.clusters.Load(clusters);
+		m_pApp->occlusion.meshletVertices.Load(meshletVertices);
+		m_pApp->occlusion.meshletTriangles.Load(meshletTriangles);
+		m_pApp->occlusion.clusterInstances.Load(clusterInstances);
+		m_pApp->occlusion.compactedIndices.Load(std::vector<uint32_t>(compactedIndexCount, 0));
+		m_pApp->occlusion.indexAllocator.Load(std::vector<uint32_t>{ 0, compactedIndexCount });
+		m_pApp->occlusion.meshCullData.Load(meshCullData);
+		m_pApp->occlusion.instanceCullData.Load(instanceCullData);
+		m_pApp->streaming.instanceCullData = std::move(instanceCullData);
+		m_pApp->occlusion.drawArgs.Load(drawArgs);
+		m_pApp->occlusion.lateDrawArgs.Load(drawArgs);
+		m_pApp->occlusion.visibility.Load(std::vector<uint32_t>(m_pApp->instances.size(), 1));
+	}
+
+	// acceleration structures or cpu BVHs are built as the meshes become resident
+	DirectShadow& shadow = m_pApp->directionalShadow;
+	if (shadow.isCpuTraced)
+	{
+		shadow.meshBvhs.resize(m_pApp->meshes.size());
+	}
+	else
+	{
+		shadow.bottomAccStructures.resize(m_pApp->meshes.size());
+	}
+	if (shadow.isCpuTraced || VulkanEngine::IsHostAccStructBuildSupported())
+	{
+		shadow.workers = std::make_unique<WorkerPool>();
+	}
+
+	BindSceneDescriptors();
+	for (auto& material : m_pApp->materials)
+	{
+		BindMaterial(material.first);
+	}
+	m_pApp->streaming.isSceneCreated = true;
+}
+
+// uploads what the streamer has finished within the frame budget, frames render whatever is resident
+void App::StreamScene()
+{
+	SceneStreaming& streaming = m_pApp->streaming;
+	if (!streaming.isSceneCreated)
+	{
+		Model diorama;
+		if (!streaming.streamer.TakeModel(diorama))
+		{
+			return;
+		}
+		CreateScene(diorama);
+	}
+
+	// compact positions go into the BLAS as is, the instance transforms dequantize them
+	DirectShadow& shadow = m_pApp->directionalShadow;
+	const EVertexFormat vertexFormat = m_pApp->geometryState.vertexFormat;
+	const uint32_t positionStride = PositionStride(vertexFormat);
+	size_t uploadedBytes = 0;
+	std::vector<GpuMesh*> newMeshes;
+	WorkerPool* pHostBuildWorkers = !shadow.isCpuTraced && VulkanEngine::IsHostAccStructBuildSupported() ? shadow.workers.get() : nullptr;
+	while (streaming.nextMesh < m_pApp->meshes.size() && uploadedBytes < kStreamBytesPerFrame)
+	{
+		GpuMesh& gpuMesh = m_pApp->meshes[streaming.nextMesh];
+		uploadedBytes += gpuMesh.indexStream.Size() + gpuMesh.positionStream.Size() + gpuMesh.attributeStream.Size();
+
+		gpuMesh.indices.Load(gpuMesh.indexStream.Data(), uint32_t(gpuMesh.indexStream.Size()));
+		gpuMesh.positions.Load(gpuMesh.positionStream.Data(), uint32_t(gpuMesh.positionStream.Size()));
+		gpuMesh.attributes.Load(gpuMesh.attributeStream.Data(), uint32_t(gpuMesh.attributeStream.Size()));
+
+		// host builds read the streams the buffers were just loaded from, they are kept until the build is complete
+		if (!shadow.isCpuTraced)
+		{
+			AccStructBuilder& builder = shadow.bottomBatch.Add(&shadow.bottomAccStructures[streaming.nextMesh], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+			if (pHostBuildWorkers)
+			{
+				builder.AddTriangles(gpuMesh.positionStream.Data(), gpuMesh.indexStream.Data());
+			}
+			else
+			{
+				builder.AddTriangles(gpuMesh.positions, gpuMesh.indices);
+			}
+			builder.VertexFormat(PositionFormat(vertexFormat))
+				.MaxVertices(gpuMesh.positions.size() / positionStride)
+				.Primitives(gpuMesh.indexCount / 3)
+				.Stride(positionStride)
+				.IndexType(to_vk_enum(gpuMesh.indexType))
+				.Flags(VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+		}
+		newMeshes.push_back(&gpuMesh);
+
+		gpuMesh.isResident = true;
+		++streaming.nextMesh;
+	}
+
+	if (!newMeshes.empty())
+	{
+		if (shadow.isCpuTraced)
+		{
+			shadow.workers->ParallelFor(newMeshes.size(), [&](size_t i) {
+				std::vector<float> positions;
+				std::vector<uint32_t> indices;
+				DecodeMeshStreams(*newMeshes[i], vertexFormat, positions, indices);
+				shadow.meshBvhs[newMeshes[i] - m_pApp->meshes.data()].Build(positions, indices);
+			});
+		}
+
+		// drawn right away, traced once their BLAS is built. Same size, the bound descriptors stay valid.
+		for (size_t i(0); i < m_pApp->instances.size(); ++i)
+		{
+			streaming.instanceCullData[i].isResident = m_pApp->meshes[m_pApp->instances[i].meshId].isResident ? 1 : 0;
+		}
+		m_pApp->occlusion.instanceCullData.Load(streaming.instanceCullData);
+	}
+
+	// host builds run on the workers in the background while frames render, the GPU builds within the frame
+	// and the cpu BVHs are built above
+	size_t builtMeshEnd = streaming.nextBottomAccStructure;
+	if (!pHostBuildWorkers)
+	{
+		if (!shadow.bottomBatch.IsEmpty())
+		{
+			shadow.bottomBatch.Build();
+		}
+		builtMeshEnd = streaming.nextMesh;
+	}
+	else if (shadow.bottomBatch.FinishHostBuild())
+	{
+		builtMeshEnd = streaming.hostBuildEnd;
+	}
+
+	if (builtMeshEnd > streaming.nextBottomAccStructure)
+	{
+		std::vector<AccelerationStructure*> newBottomAccStructures;
+		for (size_t i(streaming.nextBottomAccStructure); i < builtMeshEnd; ++i)
+		{
+			GpuMesh& gpuMesh = m_pApp->meshes[i];
+			if (!shadow.isCpuTraced)
+			{
+				newBottomAccStructures.push_back(&shadow.bottomAccStructures[i]);
+			}
+			gpuMesh.hasBottomAccStructure = true;
+
+			// the mapping closes with the last mesh that used it
+			gpuMesh.indexStream.Release();
+			gpuMesh.positionStream.Release();
+			gpuMesh.attributeStream.Release();
+			gpuMesh.file.reset();
+		}
+		streaming.nextBottomAccStructure = builtMeshEnd;
+
+		// static meshes are traced every frame and never rebuilt, compacted before the TLAS takes their addresses.
+		// Compaction also copies host built structures into video memory.
+		if (!newBottomAccStructures.empty())
+		{
+			streaming.blasSavedBytes += AccelerationStructure::Compact(newBottomAccStructures);
+			for (const AccelerationStructure* pBottomAccStructure : newBottomAccStructures)
+			{
+				streaming.blasBytes += pBottomAccStructure->GetSize();
+			}
+			if (streaming.nextBottomAccStructure == m_pApp->meshes.size())
+			{
+				std::cout << "BLAS memory: " << (streaming.blasBytes >> 10) << " KB, compaction saved " << (streaming.blasSavedBytes >> 10) << " KB" << std::endl;
+			}
+		}
+
+		BuildTopLevelAccStructure();
+		BindSceneDescriptors();
+	}
+
+	// one host build at a time, the meshes streamed in meanwhile wait in the batch for the next one
+	if (pHostBuildWorkers && !shadow.bottomBatch.IsHostBuildPending() && !shadow.bottomBatch.IsEmpty())
+	{
+		shadow.bottomBatch.BuildOnHost(pHostBuildWorkers->ThreadCount(), [pHostBuildWorkers](size_t count, const std::function<void(size_t)>& job) {
+			pHostBuildWorkers->ParallelFor(count, job);
+		});
+		streaming.hostBuildEnd = streaming.nextMesh;
+	}
+
+	// a material switches to its textured permutation once, when the last of its textures arrived
+	uint32_t textureId = 0;
+	CookedTexture texture;
+	for (uint32_t i(0); i < kStreamTexturesPerFrame && streaming.streamer.TakeTexture(textureId, texture); ++i)
+	{
+		TextureResidency& residency = streaming.textureResidency[textureId];
+		residency.isRequested = false;
+		if (kVirtualTexturing)
+		{
+			// every mip arrives at once and is paged in on demand
+			residency.isStreamable = false;
+			if (texture.IsValid())
+			{
+				streaming.virtualTextureIds[textureId] = streaming.virtualTextures.AddTexture(std::move(texture));
+			}
+		}
+		else if (texture.IsValid())
+		{
+			const uint32_t firstMip = texture.firstMip;
+			std::vector<const uint8_t*> mips;
+			for (uint32_t mip(firstMip); mip < texture.mipCount; ++mip)
+			{
+				mips.push_back(texture.MipData(mip));
+			}
+			m_pApp->textures[textureId].Load(mips, std::max(texture.width >> firstMip, 1u), std::max(texture.height >> firstMip, 1u), texture.format);
+
+			residency.residentMip = firstMip;
+			if (!residency.hasArrived)
+			{
+				residency.width = texture.width;
+				residency.height = texture.height;
+				residency.mipCount = texture.mipCount;
+				residency.format = texture.format;
+				residency.lowestMip = firstMip;
+				residency.desiredMip = firstMip;
+			}
+		}
+		else
+		{
+			residency.isStreamable = false;
+		}
+
+		// a new mip range recreated the image, materials already sampling it need the new view
+		if (residency.hasArrived)
+		{
+			for (uint32_t materialId : streaming.textureMaterials[textureId])
+			{
+				if (m_pApp->materials[materialId].pendingTextures == 0)
+				{
+					BindMaterial(materialId);
+				}
+			}
+			continue;
+		}
+		residency.hasArrived = true;
+
+		for (uint32_t materialId : streaming.textureMaterials[textureId])
+		{
+			GpuMaterial& gpuMaterial = m_pApp->materials[materialId];
+			if (--gpuMaterial.pendingTextures > 0)
+			{
+				continue;
+			}
+
+			if (IsTextureResident(gpuMaterial.diffuse))
+			{
+				gpuMaterial.flags |= esf_HasDiffuseMap;
+			}
+			if (IsTextureResident(gpuMaterial.normal))
+			{
+				gpuMaterial.flags |= esf_HasNormalMap;
+			}
+			if (kVirtualTexturing && (gpuMaterial.flags & (esf_HasDiffuseMap | esf_HasNormalMap)))
+			{
+				gpuMaterial.flags |= esf_VirtualTexture;
+				gpuMaterial.virtualTextures.Load(std::vector<uint32_t>{
+					gpuMaterial.flags & esf_HasDiffuseMap ? streaming.virtualTextureIds[gpuMaterial.diffuse] : 0,
+					gpuMaterial.flags & esf_HasNormalMap ? streaming.virtualTextureIds[gpuMaterial.normal] : 0,
+					0, 0 });
+			}
+			BindMaterial(materialId);
+		}
+	}
+
+	++streaming.frame;
+	if (kVirtualTexturing)
+	{
+		// the previous frame is done with the device idle, its feedback is complete
+		streaming.feedback.Read(streaming.feedbackData);
+		streaming.virtualTextures.Update(streaming.feedbackData, streaming.frame);
+		std::fill(streaming.feedbackData.begin(), streaming.feedbackData.end(), 0);
+		streaming.feedback.Load(streaming.feedbackData);
+	}
+	else if (streaming.frame % kResidencyUpdateFrames == 0)
+	{
+		UpdateTextureResidency();
+	}
+}
+
+bool App::IsTextureResident(uint32_t textureId) const
+{
+	if (textureId == UINT32_MAX)
+	{
+		return false;
+	}
+	return kVirtualTexturing ? m_pApp->streaming.virtualTextureIds[textureId] != UINT32_MAX : m_pApp->textures[textureId].Get() != VK_NULL_HANDLE;
+}
+
+// Every texture gets the level matching the largest on-screen size of the meshes sampling it,
+// assuming their uv range covers the mesh once. Over the budget the largest textures give up
+// levels first. Levels are streamed in and out by the streamer thread.
+void App::UpdateTextureResidency()
+{
+	SceneStreaming& streaming = m_pApp->streaming;
+
+	std::unordered_map<uint32_t, float> materialSizes;
+	const math::vec3 camera = m_pApp->mainCamera.Position();
+	const float pixelsPerUnit = m_pApp->constants.proj.m11 * float(VkGlobals::swapchain.height) * 0.5f;
+	const math::mat4 viewProj = m_pApp->constants.proj * m_pApp->constants.view;
+	for (size_t i(0); i < m_pApp->instances.size(); ++i)
+	{
+		// materials of instances off screen ask for no more than their lowest mips
+		const InstanceCullData& cullData = streaming.instanceCullData[i];
+		if (!IsOnScreen(viewProj, cullData.aabbMin, cullData.aabbMax))
+		{
+			continue;
+		}
+
+		const math::vec3 center = (cullData.aabbMin + cullData.aabbMax) * 0.5f;
+		const float radius = (cullData.aabbMax - cullData.aabbMin).magnitude() * 0.5f;
+		const float distance = std::max((center - camera).magnitude() - radius, m_pApp->constants.frustum.x);
+
+		float& size = materialSizes[m_pApp->meshes[m_pApp->instances[i].meshId].materialId];
+		size = std::max(size, 2.0f * radius * pixelsPerUnit / distance);
+	}
+
+	size_t desiredBytes = 0;
+	size_t residentBytes = 0;
+	for (size_t i(0); i < streaming.textureResidency.size(); ++i)
+	{
+		TextureResidency& residency = streaming.textureResidency[i];
+		if (!residency.hasArrived || !residency.isStreamable)
+		{
+			continue;
+		}
+
+		float requiredSize = 0;
+		for (uint32_t materialId : streaming.textureMaterials[i])
+		{
+			requiredSize = std::max(requiredSize, materialSizes[materialId]);
+		}
+
+		const uint32_t largestSide = std::max(residency.width, residency.height);
+		residency.desiredMip = residency.lowestMip;
+		while (residency.desiredMip > 0 && float(largestSide >> residency.desiredMip) < requiredSize)
+		{
+			--residency.desiredMip;
+		}
+
+		desiredBytes += residency.Bytes(residency.desiredMip);
+		residentBytes += residency.Bytes(residency.residentMip);
+	}
+
+	while (desiredBytes > kTextureBudgetBytes)
+	{
+		TextureResidency* pLargest = nullptr;
+		for (TextureResidency& residency : streaming.textureResidency)
+		{
+			if (residency.hasArrived && residency.isStreamable && residency.desiredMip < residency.lowestMip
+				&& (!pLargest || residency.Bytes(residency.desiredMip) > pLargest->Bytes(pLargest->desiredMip)))
+			{
+				pLargest = &residency;
+			}
+		}
+		if (!pLargest)
+		{
+			break;
+		}
+
+		desiredBytes -= pLargest->Bytes(pLargest->desiredMip) - pLargest->Bytes(pLargest->desiredMip + 1);
+		++pLargest->desiredMip;
+	}
+
+	// levels that are no longer needed stay for a while unless the budget is exceeded
+	const bool isOverBudget = residentBytes > kTextureBudgetBytes;
+	for (size_t i(0); i < streaming.textureResidency.size(); ++i)
+	{
+		TextureResidency& residency = streaming.textureResidency[i];
+		if (!residency.hasArrived || !residency.isStreamable || residency.isRequested)
+		{
+			continue;
+		}
+
+		const bool isUpgrade = residency.desiredMip < residency.residentMip;
+		const bool isEviction = residency.desiredMip > residency.residentMip + 1 || (isOverBudget && residency.desiredMip > residency.residentMip);
+		if (isUpgrade || isEviction)
+		{
+			streaming.streamer.RequestMips(uint32_t(i), residency.desiredMip);
+			residency.isRequested = true;
+		}
+	}
+}
+
+// the mesh positions are quantized, the TLAS instance takes the dequantization with the transform
+// object to world rows of an instance for rays, the meshes are traced with their positions still quantized
+static void RayTransform(const AppPimpl* pApp, uint32_t instanceId, float rows[3][4])
+{
+	const float dequantize[3][4] = {
+		{ pApp->constants.positionScale.x, 0, 0, pApp->constants.positionOffset.x },
+		{ 0, pApp->constants.positionScale.y, 0, pApp->constants.positionOffset.y },
+		{ 0, 0, pApp->constants.positionScale.z, pApp->constants.positionOffset.z },
+	};
+
+	const GpuInstance& instance = pApp->instances[instanceId];
+	for (uint32_t row(0); row < 3; ++row)
+	{
+		const float* m = instance.transform.rows[row];
+		for (uint32_t column(0); column < 4; ++column)
+		{
+			rows[row][column] = m[0] * dequantize[0][column] + m[1] * dequantize[1][column] + m[2] * dequantize[2][column];
+		}
+		rows[row][3] += m[3];
+	}
+}
+
+static VkAccelerationStructureInstanceKHR TopLevelInstance(const AppPimpl* pApp, uint32_t instanceId)
+{
+	const GpuInstance& instance = pApp->instances[instanceId];
+	VkAccelerationStructureInstanceKHR topInstance = {};
+	RayTransform(pApp, instanceId, topInstance.transform.matrix);
+	topInstance.mask = instance.rayMask;
+	topInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+	topInstance.accelerationStructureReference = pApp->directionalShadow.bottomAccStructures[instance.meshId].GetAddress();
+	return topInstance;
+}
+
+// rebuilt from the resident instances whenever new meshes arrive, moved instances only refit it
+void App::BuildTopLevelAccStructure()
+{
+	DirectShadow& shadow = m_pApp->directionalShadow;
+	shadow.topInstances.clear();
+	shadow.isRefitPending = false;
+
+	if (shadow.isCpuTraced)
+	{
+		for (uint32_t i(0); i < m_pApp->instances.size(); ++i)
+		{
+			if (m_pApp->meshes[m_pApp->instances[i].meshId].isResident)
+			{
+				shadow.topInstances.push_back(i);
+			}
+		}
+		RefitTopLevelAccStructure();
+		return;
+	}
+
+	AccStructBuilder tlasBuilder = shadow.topAccStructure.Builder(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR);
+	tlasBuilder.Flags(VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+	for (uint32_t i(0); i < m_pApp->instances.size(); ++i)
+	{
+		const GpuInstance& instance = m_pApp->instances[i];
+		if (!m_pApp->meshes[instance.meshId].hasBottomAccStructure)
+		{
+			continue;
+		}
+
+		const VkAccelerationStructureInstanceKHR topInstance = TopLevelInstance(m_pApp, i);
+		tlasBuilder.AddAccelerationStructure(&shadow.bottomAccStructures[instance.meshId], topInstance.transform, topInstance.mask);
+		shadow.topInstances.push_back(i);
+	}
+
+	if (!shadow.topInstances.empty())
+	{
+		tlasBuilder.Build();
+	}
+	else
+	{
+		shadow.topAccStructure = AccelerationStructure();
+	}
+}
+
+void App::RefitTopLevelAccStructure()
+{
+	DirectShadow& shadow = m_pApp->directionalShadow;
+	if (shadow.isCpuTraced)
 	{
-		GpuMaterial& gpuMaterial = m_pApp->materials[material.first];
-		if (material.second.diffuseTexture.IsValid())
-		{
-			RawTexture& diffuse = material.second.diffuseTexture;
-			gpuMaterial.diffuse.Load(diffuse.data, diffuse.width, diffuse.height, EPixelFormat::RGBA, 4);
-			gpuMaterial.flags |= esf_HasDiffuseMap;
-		}
-		if (material.second.normalTexture.IsValid())
+		// the scene BVH only holds the instances, rebuilding it is as cheap as a refit
+		shadow.sceneBvh.Clear();
+		for (uint32_t instanceId : shadow.topInstances)
 		{
-			RawTexture& normal = material.second.normalTexture;
-			gpuMaterial.normal.Load(normal.data, normal.width, normal.height, EPixelFormat::RGBA, 4);
-			gpuMaterial.flags |= esf_HasNormalMap;
+			const GpuInstance& instance = m_pApp->instances[instanceId];
+			if (instance.rayMask != 0)
+			{
+				float rows[3][4];
+				RayTransform(m_pApp, instanceId, rows);
+				shadow.sceneBvh.AddInstance(&shadow.meshBvhs[instance.meshId], rows);
+			}
 		}
+		shadow.sceneBvh.Build();
+		shadow.isRefitPending = false;
+		return;
 	}
 
-	m_pApp->meshesToDraw.resize(diorama.meshes.size());
-	for (size_t i(0); i < diorama.meshes.size(); ++i)
+	std::vector<VkAccelerationStructureInstanceKHR> topInstances(shadow.topInstances.size());
+	for (size_t i(0); i < shadow.topInstances.size(); ++i)
 	{
-		Mesh& mesh = diorama.meshes[i];
-		GpuMesh& gpuMesh = m_pApp->meshesToDraw[i];
-
-		gpuMesh.materialId = mesh.materialId;
-		gpuMesh.indexCount = uint32_t(mesh.indices.size());
-		gpuMesh.indices.Load(mesh.indices);
-		gpuMesh.vertices.Load(mesh.vertices);
+		topInstances[i] = TopLevelInstance(m_pApp, shadow.topInstances[i]);
+		topInstances[i].instanceCustomIndex = uint32_t(i);
 	}
 
-	std::sort(m_pApp->meshesToDraw.begin(), m_pApp->meshesToDraw.end(), [](const GpuMesh& meshA, const GpuMesh& meshB) {
-		return meshA.materialId > meshB.materialId;
-	});
+	shadow.topAccStructure.Refit(m_pApp->commandBufer, topInstances);
+	shadow.isRefitPending = false;
+}
 
+// the instance keeps its mesh, the draw, the culling and the TLAS pick up the transform next frame
+void App::SetInstanceTransform(uint32_t instanceId, const InstanceTransform& transform)
+{
+	assert(instanceId < m_pApp->instances.size());
+	GpuInstance& instance = m_pApp->instances[instanceId];
+	instance.transform = transform;
 
-	AccStructBuilder builder = m_pApp->directionalShadow.bottomAccStructure.Builder(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
-	for (auto& mesh : m_pApp->meshesToDraw)
+	InstanceCullData& cullData = m_pApp->streaming.instanceCullData[instanceId];
+	for (uint32_t row(0); row < 3; ++row)
 	{
-		builder.AddTriangles(mesh.vertices, mesh.indices)
-			.MaxVertices(mesh.vertices.size() / sizeof(Vertex))
-			.Primitives(mesh.indexCount / 3)
-			.Stride(sizeof(Vertex));
+		const float* m = transform.rows[row];
+		cullData.transform[row] = math::vec4(m[0], m[1], m[2], m[3]);
 	}
-	builder.Build();
-
+	const GpuMesh& gpuMesh = m_pApp->meshes[instance.meshId];
+	TransformAabb(transform, gpuMesh.aabbMin, gpuMesh.aabbMax, cullData.aabbMin, cullData.aabbMax);
 
-	m_pApp->directionalShadow.topAccStructure.Builder(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR)
-		.AddAccelerationStructure(&m_pApp->directionalShadow.bottomAccStructure)
-		.Build();
+	bool isConeCullable = false;
+	cullData.scale = InstanceScale(transform, isConeCullable);
+	cullData.isConeCullable = isConeCullable ? 1 : 0;
 
+	m_pApp->hasMovedInstances = true;
+}
 
-	std::default_random_engine generator;
-	std::uniform_real_distribution<float> rnd_floats(0, 1);
+void App::SetInstanceCastsShadow(uint32_t instanceId, bool castsShadow)
+{
+	assert(instanceId < m_pApp->instances.size());
+	m_pApp->instances[instanceId].rayMask = castsShadow ? 0xFF : 0;
+	m_pApp->directionalShadow.isRefitPending = true;
+}
 
-	std::vector<math::vec4> ssaoKernel(SSAO_KERNEL);
-	for (math::vec4& dir : ssaoKernel)
+// scene buffers are bound once they exist, the TLAS is rebound whenever it is rebuilt
+void App::BindSceneDescriptors()
+{
+	if (m_pApp->directionalShadow.topAccStructure.Get() != VK_NULL_HANDLE)
 	{
-		math::vec3 point;
-		point.x = rnd_floats(generator) * 2.0f - 1.0f;
-		point.y = rnd_floats(generator);
-		point.z = rnd_floats(generator) * 2.0f - 1.0f;
+		m_pApp->directionalShadow.shaderShadows.Binder()
+				.StorageImage(m_pApp->directionalShadow.txrShadowMask, 0)
+				.Image(m_pApp->txrDepth, 1, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+				.StorageBufferReadonly(m_pApp->directionalShadow.rayPixels, 2)
+				.AccelerationStructure(m_pApp->directionalShadow.topAccStructure.Get(), 0)
+			.Bind();
+	}
+	if (m_pApp->directionalShadow.topAccStructure.Get() != VK_NULL_HANDLE && m_pApp->directionalShadow.traceScale > 1)
+	{
+		m_pApp->directionalShadow.shaderTraceQuery.SetState(eshf_Trace, 0);
+		m_pApp->directionalShadow.shaderTraceQuery.Binder()
+				.StorageImage(m_pApp->directionalShadow.txrTraceTarget, 0)
+				.Image(m_pApp->txrDepth, 1, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+				.Image(m_pApp->gbuffer.normal, 2)
+				.AccelerationStructure(m_pApp->directionalShadow.topAccStructure.Get(), 0)
+			.Bind();
+	}
 
-		point = point.normalized() * (rnd_floats(generator) + 0.1f);
+	m_pApp->occlusion.shaderCull.SetState(escf_EarlyCull, 0);
+	m_pApp->occlusion.shaderCull.Binder()
+			.StorageBufferReadonly(m_pApp->occlusion.instanceCullData, 0)
+			.StorageBufferReadonly(m_pApp->occlusion.meshCullData, 2)
+			.StorageBuffer(m_pApp->occlusion.drawArgs, 0)
+			.StorageBuffer(m_pApp->occlusion.visibility, 2)
+			.StorageBuffer(m_pApp->occlusion.indexAllocator, 3)
+		.Bind();
 
-		dir.x = point.x;
-		dir.y = point.y;
-		dir.z = point.z;
-	}
+	m_pApp->occlusion.shaderClusterCull.SetState(escf_EarlyCull, 0);
+	m_pApp->occlusion.shaderClusterCull.Binder()
+			.StorageBufferReadonly(m_pApp->occlusion.instanceCullData, 0)
+			.StorageBufferReadonly(m_pApp->occlusion.clusters, 1)
+			.StorageBufferReadonly(m_pApp->occlusion.meshletVertices, 2)
+			.StorageBufferReadonly(m_pApp->occlusion.meshletTriangles, 3)
+			.StorageBufferReadonly(m_pApp->occlusion.meshCullData, 5)
+			.StorageBufferReadonly(m_pApp->occlusion.clusterInstances, 6)
+			.StorageBuffer(m_pApp->occlusion.drawArgs, 0)
+			.StorageBuffer(m_pApp->occlusion.compactedIndices, 2)
+		.Bind();
 
-	m_pApp->ssao.kernel.Load(ssaoKernel);
+	m_pApp->occlusion.shaderCull.SetState(escf_LateCull, 0);
+	m_pApp->occlusion.shaderCull.Binder()
+			.StorageBufferReadonly(m_pApp->occlusion.instanceCullData, 0)
+			.StorageBufferReadonly(m_pApp->occlusion.hizPyramid, 1)
+			.StorageBufferReadonly(m_pApp->occlusion.meshCullData, 2)
+			.StorageBuffer(m_pApp->occlusion.drawArgs, 0)
+			.StorageBuffer(m_pApp->occlusion.lateDrawArgs, 1)
+			.StorageBuffer(m_pApp->occlusion.visibility, 2)
+			.StorageBuffer(m_pApp->occlusion.indexAllocator, 3)
+		.Bind();
 
-	m_pApp->mainCamera.Position().y = 300;
+	m_pApp->occlusion.shaderClusterCull.SetState(escf_LateCull, 0);
+	m_pApp->occlusion.shaderClusterCull.Binder()
+			.StorageBufferReadonly(m_pApp->occlusion.instanceCullData, 0)
+			.StorageBufferReadonly(m_pApp->occlusion.clusters, 1)
+			.StorageBufferReadonly(m_pApp->occlusion.meshletVertices, 2)
+			.StorageBufferReadonly(m_pApp->occlusion.meshletTriangles, 3)
+			.StorageBufferReadonly(m_pApp->occlusion.hizPyramid, 4)
+			.StorageBufferReadonly(m_pApp->occlusion.meshCullData, 5)
+			.StorageBufferReadonly(m_pApp->occlusion.clusterInstances, 6)
+			.StorageBuffer(m_pApp->occlusion.drawArgs, 0)
+			.StorageBuffer(m_pApp->occlusion.lateDrawArgs, 1)
+			.StorageBuffer(m_pApp->occlusion.compactedIndices, 2)
+		.Bind();
+}
+
+void App::BindMaterial(uint32_t materialId)
+{
+	const GpuMaterial& gpuMaterial = m_pApp->materials[materialId];
+	m_pApp->shaderGBuffer.SetState(m_pApp->gbuffer.renderpass, gpuMaterial.flags, materialId, m_pApp->geometryState);
+	if (m_pApp->shaderGBuffer.HasBindables())
+	{
+		ShaderBinder binder = m_pApp->shaderGBuffer.Binder();
+		if (gpuMaterial.flags & esf_VirtualTexture)
+		{
+			const VirtualTextureCache& virtualTextures = m_pApp->streaming.virtualTextures;
+			if (gpuMaterial.flags & esf_HasDiffuseMap)
+			{
+				binder.Image(virtualTextures.Atlas(EPixelFormat::BC7), 0);
+			}
+			if (gpuMaterial.flags & esf_HasNormalMap)
+			{
+				binder.Image(virtualTextures.Atlas(EPixelFormat::BC5), 1);
+			}
+			binder.StorageBufferReadonly(virtualTextures.PageTable(), 2)
+				.StorageBufferReadonly(virtualTextures.Textures(), 3)
+				.UniformBuffer(gpuMaterial.virtualTextures, 0)
+				.StorageBuffer(m_pApp->streaming.feedback, 0);
+		}
+		else
+		{
+			if (gpuMaterial.flags & esf_HasDiffuseMap)
+			{
+				binder.Image(m_pApp->textures[gpuMaterial.diffuse], 0);
+			}
+			if (gpuMaterial.flags & esf_HasNormalMap)
+			{
+				binder.Image(m_pApp->textures[gpuMaterial.normal], 1);
+			}
+		}
+
+		if (gpuMaterial.flags & (esf_HasDiffuseMap | esf_HasNormalMap))
+		{
+			binder.ImageSampler(m_pApp->linearSampler, 0);
+		}
+		binder.Bind();
+	}
 }
 
 void App::Shutdown()
 {
+	// the host build reads the mesh streams
+	m_pApp->directionalShadow.bottomBatch.WaitHostBuild();
 	VulkanEngine::DestroyCommandBuffer(m_pApp->commandBufer);
 	VulkanEngine::DestroyVkSemaphore(m_pApp->presentImageSem);
 	VulkanEngine::DestroyVkSemaphore(m_pApp->acquireImageSem);
@@ -301,6 +1462,29 @@ void App::Shutdown()
 	delete m_pApp;
 }
 
+// the traced blocks follow the swapchain and the trace scale, every pixel of the mask is filled by the upsample
+void App::CreateShadowTraceTarget()
+{
+	DirectShadow& shadow = m_pApp->directionalShadow;
+	m_pApp->constants.shadowTrace[0] = shadow.traceScale;
+	if (shadow.traceScale == 1)
+	{
+		return;
+	}
+
+	const uint32_t width = (VkGlobals::swapchain.width + shadow.traceScale - 1) / shadow.traceScale;
+	const uint32_t height = (VkGlobals::swapchain.height + shadow.traceScale - 1) / shadow.traceScale;
+	shadow.txrTraceTarget.Create(width, height, EPixelFormat::RGBA16);
+
+	shadow.shaderUpsample.SetState(eshf_Upsample, 0);
+	shadow.shaderUpsample.Binder()
+			.StorageImage(shadow.txrShadowMask, 0)
+			.Image(shadow.txrTraceTarget, 0)
+			.Image(m_pApp->gbuffer.normal, 1)
+			.Image(m_pApp->txrDepth, 2, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+		.Bind();
+}
+
 void App::OnWidowResize(uint32_t width, uint32_t height)
 {
 	m_pApp->rndArea.offset = { 0, 0 };
@@ -318,12 +1502,20 @@ void App::OnWidowResize(uint32_t width, uint32_t height)
 	m_pApp->scissor.extent = { VkGlobals::swapchain.width , VkGlobals::swapchain.height };
 
 
-	m_pApp->txrDepth.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, EPixelFormat::D32);
+	// read back when the shadows are traced on the cpu
+	m_pApp->txrDepth.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, to_vk_enum(EPixelFormat::D32), 1, VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 	m_pApp->txrHdrTarget.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, EPixelFormat::RGBA16);
 	m_pApp->ssao.txrSSAO.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, EPixelFormat::Mono);
 	m_pApp->gbuffer.normal.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, EPixelFormat::RGBA);
 	m_pApp->gbuffer.diffuse.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, EPixelFormat::RGBA);
 	m_pApp->directionalShadow.txrShadowMask.Create(VkGlobals::swapchain.width, VkGlobals::swapchain.height, EPixelFormat::Mono);
+	if (m_pApp->directionalShadow.isCpuTraced)
+	{
+		m_pApp->directionalShadow.depthData.assign(size_t(VkGlobals::swapchain.width) * VkGlobals::swapchain.height, 1.0f);
+		m_pApp->directionalShadow.maskData.assign(m_pApp->directionalShadow.depthData.size(), 1.0f);
+		m_pApp->directionalShadow.cpuDepth.Load(m_pApp->directionalShadow.depthData);
+		m_pApp->directionalShadow.cpuMask.Load(m_pApp->directionalShadow.maskData);
+	}
 
 	if (!m_isRenderInit)
 	{
@@ -335,6 +1527,12 @@ void App::OnWidowResize(uint32_t width, uint32_t height)
 				.IsDepth()
 			.Create();
 
+		m_pApp->occlusion.lateZprepassRenderpass = RenderpassBuilder()
+			.AddAttachment(EPixelFormat::D32, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+				.LoadOnBegin()
+				.IsDepth()
+			.Create();
+
 		m_pApp->gbuffer.renderpass = RenderpassBuilder()
 			.AddAttachment(EPixelFormat::RGBA, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 				.ClearOnBegin()
@@ -362,34 +1560,17 @@ void App::OnWidowResize(uint32_t width, uint32_t height)
 			.AddAttachment(EPixelFormat::D32, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
 				.IsDepth()
 			.Create();
+	}
 
-		for (auto& gpuMaterial : m_pApp->materials)
+	m_pApp->zprepassFramebuffer = m_pApp->zprepassRenderpass.CreateFramebuffer(
+		VkGlobals::swapchain.width,
+		VkGlobals::swapchain.height,
 		{
-			m_pApp->shaderGBuffer.SetState(m_pApp->gbuffer.renderpass, gpuMaterial.second.flags, gpuMaterial.first, RenderState());
-			if (m_pApp->shaderGBuffer.HasBindables())
-			{
-				bool hasTexture = false;
-				ShaderBinder binder = m_pApp->shaderGBuffer.Binder();
-				if (gpuMaterial.second.flags & esf_HasDiffuseMap)
-				{
-					hasTexture = true;
-					binder.Image(gpuMaterial.second.diffuse, 0);
-				}
-				if (gpuMaterial.second.flags & esf_HasNormalMap)
-				{
-					hasTexture = true;
-					binder.Image(gpuMaterial.second.normal, 1);
-				}
-				if (hasTexture)
-				{
-					binder.ImageSampler(m_pApp->linearSampler, 0);
-				}
-				binder.Bind();
-			}
+			m_pApp->txrDepth.GetView()
 		}
-	}
+	);
 
-	m_pApp->zprepassFramebuffer = m_pApp->zprepassRenderpass.CreateFramebuffer(
+	m_pApp->occlusion.lateZprepassFramebuffer = m_pApp->occlusion.lateZprepassRenderpass.CreateFramebuffer(
 		VkGlobals::swapchain.width,
 		VkGlobals::swapchain.height,
 		{
@@ -450,7 +1631,7 @@ void App::OnWidowResize(uint32_t width, uint32_t height)
 
 	Shader::PerFrameDescriptors::Binder().UniformBuffer(m_pApp->constantBuffer, 0).Bind();
 
-	m_pApp->shaderZPrepass.SetState(m_pApp->zprepassRenderpass, 0, 0, RenderState());
+	m_pApp->shaderZPrepass.SetState(m_pApp->zprepassRenderpass, m_pApp->zprepassFlags, 0, m_pApp->zprepassState);
 
 	m_pApp->shaderLighting.SetState(m_pApp->lightingRenderpass, 0, 0, m_pApp->fullscreenState);
 	m_pApp->shaderLighting.Binder()
@@ -480,12 +1661,48 @@ void App::OnWidowResize(uint32_t width, uint32_t height)
 		.Bind();
 
 
-	m_pApp->directionalShadow.shaderShadows.SetState(0, 0);
-	m_pApp->directionalShadow.shaderShadows.Binder()
-			.StorageImage(m_pApp->directionalShadow.txrShadowMask, 0)
-			.Image(m_pApp->txrDepth, 1, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
-			.AccelerationStructure(m_pApp->directionalShadow.topAccStructure.Get(), 0)
+	if (!m_pApp->directionalShadow.isCpuTraced)
+	{
+		m_pApp->directionalShadow.shaderShadows.SetState(0, 0);
+
+		m_pApp->directionalShadow.rayPixels.Load(std::vector<uint32_t>(size_t(VkGlobals::swapchain.width) * VkGlobals::swapchain.height, 0));
+		m_pApp->directionalShadow.shaderCompact.SetState(0, 0);
+		m_pApp->directionalShadow.shaderCompact.Binder()
+				.StorageImage(m_pApp->directionalShadow.txrShadowMask, 0)
+				.StorageBuffer(m_pApp->directionalShadow.rayPixels, 1)
+				.StorageBuffer(m_pApp->directionalShadow.traceArgs, 2)
+				.Image(m_pApp->gbuffer.normal, 0)
+				.Image(m_pApp->txrDepth, 1, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+			.Bind();
+	}
+	CreateShadowTraceTarget();
+	m_pApp->occlusion.hizPyramid.Load(std::vector<float>(HiZPyramidSize(VkGlobals::swapchain.width, VkGlobals::swapchain.height), 1.0f));
+
+	if (kVirtualTexturing)
+	{
+		const uint32_t cellsX = (VkGlobals::swapchain.width + kFeedbackCellSize - 1) / kFeedbackCellSize;
+		const uint32_t cellsY = (VkGlobals::swapchain.height + kFeedbackCellSize - 1) / kFeedbackCellSize;
+		m_pApp->streaming.feedbackData.assign(cellsX * cellsY, 0);
+		m_pApp->streaming.feedback.Load(m_pApp->streaming.feedbackData);
+		m_pApp->constants.feedback[1] = cellsX;
+		m_pApp->constants.feedback[2] = kFeedbackCellSize;
+	}
+
+	m_pApp->occlusion.shaderHiZ.SetState(0, 0);
+	m_pApp->occlusion.shaderHiZ.Binder()
+			.Image(m_pApp->txrDepth, 0, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+			.StorageBuffer(m_pApp->occlusion.hizPyramid, 0)
+			.StorageBuffer(m_pApp->occlusion.hizCounter, 1)
 		.Bind();
+
+	if (m_pApp->streaming.isSceneCreated)
+	{
+		BindSceneDescriptors();
+		for (auto& material : m_pApp->materials)
+		{
+			BindMaterial(material.first);
+		}
+	}
 }
 
 void App::Render()
@@ -496,6 +1713,22 @@ void App::Render()
 		return;
 	}
 
+	StreamScene();
+
+	if (m_pApp->hasMovedInstances)
+	{
+		// same sizes, the bound buffers stay valid
+		std::vector<InstanceTransform> transforms(m_pApp->instances.size());
+		for (size_t i(0); i < m_pApp->instances.size(); ++i)
+		{
+			transforms[i] = m_pApp->instances[i].transform;
+		}
+		m_pApp->instanceTransforms.Load(transforms);
+		m_pApp->occlusion.instanceCullData.Load(m_pApp->streaming.instanceCullData);
+		m_pApp->directionalShadow.isRefitPending = true;
+		m_pApp->hasMovedInstances = false;
+	}
+
 	VkResult result = vkAcquireNextImageKHR(VkGlobals::vkDevice, VkGlobals::swapchain.vkSwapchain, UINT64_MAX, m_pApp->acquireImageSem, VK_NULL_HANDLE, &m_pApp->swapchainImage);
 	if (result == VK_ERROR_OUT_OF_DATE_KHR)
 	{
@@ -505,6 +1738,7 @@ void App::Render()
 
 	m_pApp->constants.view = m_pApp->mainCamera.View();
 	m_pApp->constants.view_invert = m_pApp->constants.view.inverted();
+	m_pApp->constants.feedback[0] = m_pApp->streaming.frame;
 	m_pApp->constantBuffer.Load(&m_pApp->constants, sizeof(ConstantBuffer));
 
 	VK_ASSERT(vkResetCommandBuffer(m_pApp->commandBufer, 0));
@@ -518,38 +1752,26 @@ void App::Render()
 
 
 
+	// two-phase occlusion culling: draw what was visible last frame, build HiZ from it,
+	// cull everything against it and draw the meshes that became visible.
+	// Both phases pick the same lod for a mesh.
+	// nothing to cull until the scene is created, the prepasses still clear depth
+	const bool isSceneCreated = m_pApp->streaming.isSceneCreated;
+	if (isSceneCreated)
 	{
-		std::vector<VkClearValue> clearValues(1);
-		clearValues[0].depthStencil = { 1, 0 };
-
-		VkRenderPassBeginInfo renderPassBegin = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-		renderPassBegin.renderPass = m_pApp->zprepassRenderpass;
-		renderPassBegin.framebuffer = m_pApp->zprepassFramebuffer;
-		renderPassBegin.renderArea = m_pApp->rndArea;
-		renderPassBegin.clearValueCount = uint32_t(clearValues.size());
-		renderPassBegin.pClearValues = clearValues.data();
-		vkCmdBeginRenderPass(m_pApp->commandBufer, &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdSetViewport(m_pApp->commandBufer, 0, 1, &m_pApp->viewport);
-		vkCmdSetScissor(m_pApp->commandBufer, 0, 1, &m_pApp->scissor);
-
-		m_pApp->shaderZPrepass.SetState(m_pApp->zprepassRenderpass, 0, 0, RenderState());
-		m_pApp->shaderZPrepass.Bind(m_pApp->commandBufer);
+		CullMeshes(false);
+	}
 
-		const VkDeviceSize offsets[] = { 0 };
-		uint32_t currentMaterialID = UINT32_MAX;
-		for (auto& gpuMesh : m_pApp->meshesToDraw)
-		{
-			VkBuffer b[] = { gpuMesh.vertices };
-			vkCmdBindVertexBuffers(m_pApp->commandBufer, 0, 1, b, offsets);
-			vkCmdBindIndexBuffer(m_pApp->commandBufer, gpuMesh.indices, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(m_pApp->commandBufer, gpuMesh.indexCount, 1, 0, 0, 0);
-		}
+	ZPrepass(false);
 
+	if (isSceneCreated)
+	{
+		BuildHiZ();
 
-		vkCmdEndRenderPass(m_pApp->commandBufer);
+		CullMeshes(true);
 	}
 
-
+	ZPrepass(true);
 
 	GBufferPass();
 
@@ -563,6 +1785,15 @@ void App::Render()
 
 	FinalHDRPass();
 
+	// the gbuffer feedback is read by the host before the next frame
+	if (kVirtualTexturing)
+	{
+		VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT
+		);
+	}
+
 	vkCmdWriteTimestamp(m_pApp->commandBufer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VkGlobals::vkQueryPool, 1);
 
 	VK_ASSERT(vkEndCommandBuffer(m_pApp->commandBufer));
@@ -604,6 +1835,110 @@ void App::Render()
 	m_gpuTime = (double(results[1]) - double(results[0])) * VulkanEngine::GetGpuTimestampPeriod() * 1e-6;
 }
 
+void App::ZPrepass(bool isLatePass)
+{
+	const Renderpass& renderpass = isLatePass ? m_pApp->occlusion.lateZprepassRenderpass : m_pApp->zprepassRenderpass;
+	Framebuffer& framebuffer = isLatePass ? m_pApp->occlusion.lateZprepassFramebuffer : m_pApp->zprepassFramebuffer;
+	Buffer& drawArgs = isLatePass ? m_pApp->occlusion.lateDrawArgs : m_pApp->occlusion.drawArgs;
+
+	std::vector<VkClearValue> clearValues(1);
+	clearValues[0].depthStencil = { 1, 0 };
+
+	VkRenderPassBeginInfo renderPassBegin = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+	renderPassBegin.renderPass = renderpass.Get();
+	renderPassBegin.framebuffer = framebuffer;
+	renderPassBegin.renderArea = m_pApp->rndArea;
+	renderPassBegin.clearValueCount = uint32_t(clearValues.size());
+	renderPassBegin.pClearValues = clearValues.data();
+	vkCmdBeginRenderPass(m_pApp->commandBufer, &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdSetViewport(m_pApp->commandBufer, 0, 1, &m_pApp->viewport);
+	vkCmdSetScissor(m_pApp->commandBufer, 0, 1, &m_pApp->scissor);
+
+	m_pApp->shaderZPrepass.SetState(renderpass, m_pApp->zprepassFlags, 0, m_pApp->zprepassState);
+	m_pApp->shaderZPrepass.Bind(m_pApp->commandBufer);
+
+	const VkDeviceSize offsets[] = { 0, 0 };
+	EIndexType currentIndexType = EIndexType::COUNT;
+	for (const DrawBatch& batch : m_pApp->drawBatches)
+	{
+		GpuMesh& gpuMesh = m_pApp->meshes[batch.meshId];
+		if (!gpuMesh.isResident)
+		{
+			continue;
+		}
+		if (currentIndexType != gpuMesh.indexType)
+		{
+			currentIndexType = gpuMesh.indexType;
+			vkCmdBindIndexBuffer(m_pApp->commandBufer, m_pApp->occlusion.compactedIndices, 0, to_vk_enum(currentIndexType));
+		}
+
+		VkBuffer b[] = { gpuMesh.positions, m_pApp->instanceTransforms };
+		vkCmdBindVertexBuffers(m_pApp->commandBufer, 0, 2, b, offsets);
+		vkCmdDrawIndexedIndirect(m_pApp->commandBufer, drawArgs, batch.firstInstance * sizeof(VkDrawIndexedIndirectCommand), batch.instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	vkCmdEndRenderPass(m_pApp->commandBufer);
+}
+
+void App::BuildHiZ()
+{
+	// early depth is written and the early draw arguments and indices are consumed
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+	);
+
+	m_pApp->occlusion.shaderHiZ.SetState(0, 0);
+	m_pApp->occlusion.shaderHiZ.Bind(m_pApp->commandBufer);
+
+	const uint32_t groupsX = (VkGlobals::swapchain.width + 63) / 64;
+	const uint32_t groupsY = (VkGlobals::swapchain.height + 63) / 64;
+	vkCmdDispatch(m_pApp->commandBufer, groupsX, groupsY, 1);
+
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT
+	);
+}
+
+void App::CullMeshes(bool isLatePass)
+{
+	// draw arguments and compacted indices are still read by the draws of the previous pass,
+	// every pass allocates the regions from the start of the buffer again
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT
+	);
+	vkCmdFillBuffer(m_pApp->commandBufer, m_pApp->occlusion.indexAllocator, 0, sizeof(uint32_t), 0);
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT
+	);
+
+	m_pApp->occlusion.shaderCull.SetState(isLatePass ? escf_LateCull : escf_EarlyCull, 0);
+	m_pApp->occlusion.shaderCull.Bind(m_pApp->commandBufer);
+
+	const uint32_t instanceCount = uint32_t(m_pApp->instances.size());
+	vkCmdDispatch(m_pApp->commandBufer, (instanceCount + 63) / 64, 1, 1);
+
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT
+	);
+
+	// one group per cluster of every instance, surviving triangles are appended to the region of the instance
+	const uint32_t clusterCount = m_pApp->occlusion.clusterInstanceCount;
+	m_pApp->occlusion.shaderClusterCull.SetState(isLatePass ? escf_LateCull : escf_EarlyCull, 0);
+	m_pApp->occlusion.shaderClusterCull.Bind(m_pApp->commandBufer);
+	vkCmdDispatch(m_pApp->commandBufer, std::min(clusterCount, kClusterDispatchWidth), (clusterCount + kClusterDispatchWidth - 1) / kClusterDispatchWidth, 1);
+
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT
+	);
+}
+
 void App::GBufferPass()
 {
 	std::vector<VkClearValue> clearValues(2);
@@ -620,13 +1955,24 @@ void App::GBufferPass()
 	vkCmdSetViewport(m_pApp->commandBufer, 0, 1, &m_pApp->viewport);
 	vkCmdSetScissor(m_pApp->commandBufer, 0, 1, &m_pApp->scissor);
 
-	const VkDeviceSize offsets[] = { 0 };
+	const VkDeviceSize offsets[] = { 0, 0, 0 };
 	uint32_t currentMaterialID = UINT32_MAX;
-	RenderState renderState;
+	RenderState renderState = m_pApp->geometryState;
 	renderState.depthFunc = EDepthFunc::Equal;
 	renderState.depthWrite = false;
-	for (auto& gpuMesh : m_pApp->meshesToDraw)
+	EIndexType currentIndexType = EIndexType::COUNT;
+	for (const DrawBatch& batch : m_pApp->drawBatches)
 	{
+		GpuMesh& gpuMesh = m_pApp->meshes[batch.meshId];
+		if (!gpuMesh.isResident)
+		{
+			continue;
+		}
+		if (currentIndexType != gpuMesh.indexType)
+		{
+			currentIndexType = gpuMesh.indexType;
+			vkCmdBindIndexBuffer(m_pApp->commandBufer, m_pApp->occlusion.compactedIndices, 0, to_vk_enum(currentIndexType));
+		}
 		if (currentMaterialID != gpuMesh.materialId)
 		{
 			currentMaterialID = gpuMesh.materialId;
@@ -634,10 +1980,9 @@ void App::GBufferPass()
 			m_pApp->shaderGBuffer.Bind(m_pApp->commandBufer);
 		}
 
-		VkBuffer b[] = { gpuMesh.vertices };
-		vkCmdBindVertexBuffers(m_pApp->commandBufer, 0, 1, b, offsets);
-		vkCmdBindIndexBuffer(m_pApp->commandBufer, gpuMesh.indices, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(m_pApp->commandBufer, gpuMesh.indexCount, 1, 0, 0, 0);
+		VkBuffer b[] = { gpuMesh.positions, gpuMesh.attributes, m_pApp->instanceTransforms };
+		vkCmdBindVertexBuffers(m_pApp->commandBufer, 0, 3, b, offsets);
+		vkCmdDrawIndexedIndirect(m_pApp->commandBufer, m_pApp->occlusion.drawArgs, batch.firstInstance * sizeof(VkDrawIndexedIndirectCommand), batch.instanceCount, sizeof(VkDrawIndexedIndirectCommand));
 	}
 
 
@@ -646,8 +1991,17 @@ void App::GBufferPass()
 
 void App::LightingPass()
 {
+	VkPipelineStageFlags2 shadowStage = VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	if (m_pApp->directionalShadow.isCpuTraced)
+	{
+		shadowStage = VK_PIPELINE_STAGE_2_COPY_BIT;
+	}
+	else if (m_pApp->directionalShadow.traceScale > 1)
+	{
+		shadowStage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	}
 	m_pApp->directionalShadow.txrShadowMask.SetBarier(m_pApp->commandBufer,
-		VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT,
+		shadowStage | VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
 		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
 	);
@@ -717,16 +2071,205 @@ void App::FinalHDRPass()
 
 void App::RaytraceShadows()
 {
-	m_pApp->directionalShadow.txrShadowMask.SetBarier(m_pApp->commandBufer,
+	// the scene BVH may empty out when it is refit, nothing can cast a shadow before the first meshes are resident
+	const bool isCpuTraced = m_pApp->directionalShadow.isCpuTraced;
+	if (isCpuTraced && m_pApp->directionalShadow.isRefitPending)
+	{
+		RefitTopLevelAccStructure();
+	}
+
+	if (isCpuTraced ? m_pApp->directionalShadow.sceneBvh.IsEmpty() : m_pApp->directionalShadow.topAccStructure.Get() == VK_NULL_HANDLE)
+	{
+		m_pApp->directionalShadow.txrShadowMask.SetBarier(m_pApp->commandBufer,
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_GENERAL
+		);
+
+		const VkClearColorValue lit = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+		VkImageSubresourceRange range = {};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.levelCount = 1;
+		range.layerCount = 1;
+		vkCmdClearColorImage(m_pApp->commandBufer, m_pApp->directionalShadow.txrShadowMask.Get(), VK_IMAGE_LAYOUT_GENERAL, &lit, 1, &range);
+		return;
+	}
+
+	if (m_pApp->directionalShadow.isRefitPending)
+	{
+		RefitTopLevelAccStructure();
+	}
+
+	if (isCpuTraced)
+	{
+		TraceShadowsOnCpu();
+		return;
+	}
+
+	if (m_pApp->directionalShadow.traceScale > 1)
+	{
+		TraceShadowQueries();
+		return;
+	}
+
+	DirectShadow& shadow = m_pApp->directionalShadow;
+
+	// the ray count starts over, the last launch has read it
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT
+	);
+	vkCmdFillBuffer(m_pApp->commandBufer, shadow.traceArgs, 0, sizeof(uint32_t), 0);
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT
+	);
+
+	shadow.txrShadowMask.SetBarier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_IMAGE_LAYOUT_GENERAL
+	);
+
+	shadow.shaderCompact.SetState(0, 0);
+	shadow.shaderCompact.Bind(m_pApp->commandBufer);
+	vkCmdDispatch(m_pApp->commandBufer, (VkGlobals::swapchain.width + 7) / 8, (VkGlobals::swapchain.height + 7) / 8, 1);
+
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT
+	);
+
+	shadow.shaderShadows.SetState(0, 0);
+
+	shadow.shaderShadows.Bind(m_pApp->commandBufer);
+	shadow.shaderShadows.DrawIndirect(m_pApp->commandBufer, shadow.traceArgs.GetDeviceAddress());
+}
+
+// one ray per block of traceScale pixels, then every pixel of the mask is interpolated from the blocks around it
+void App::TraceShadowQueries()
+{
+	DirectShadow& shadow = m_pApp->directionalShadow;
+
+	shadow.txrTraceTarget.SetBarier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_IMAGE_LAYOUT_GENERAL
+	);
+
+	// not compacted like the pipeline path: the dispatch already covers a quarter or a sixteenth of the
+	// pixels, and blocks without a lit facing pixel skip their ray query in the shader
+	shadow.shaderTraceQuery.SetState(eshf_Trace, 0);
+	shadow.shaderTraceQuery.Bind(m_pApp->commandBufer);
+
+	const uint32_t traceWidth = (VkGlobals::swapchain.width + shadow.traceScale - 1) / shadow.traceScale;
+	const uint32_t traceHeight = (VkGlobals::swapchain.height + shadow.traceScale - 1) / shadow.traceScale;
+	vkCmdDispatch(m_pApp->commandBufer, (traceWidth + 7) / 8, (traceHeight + 7) / 8, 1);
+
+	shadow.txrTraceTarget.SetBarier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	);
+	shadow.txrShadowMask.SetBarier(m_pApp->commandBufer,
 		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
-		VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
 		VK_IMAGE_LAYOUT_GENERAL
 	);
 
-	m_pApp->directionalShadow.shaderShadows.SetState(0, 0);
+	shadow.shaderUpsample.SetState(eshf_Upsample, 0);
+	shadow.shaderUpsample.Bind(m_pApp->commandBufer);
+	vkCmdDispatch(m_pApp->commandBufer, (VkGlobals::swapchain.width + 7) / 8, (VkGlobals::swapchain.height + 7) / 8, 1);
+}
+
+// the frame is submitted up to here and waited for, the workers trace this frame's depth and the mask is uploaded
+// at the start of the rest of the frame
+void App::TraceShadowsOnCpu()
+{
+	DirectShadow& shadow = m_pApp->directionalShadow;
+	const uint32_t width = VkGlobals::swapchain.width;
+	const uint32_t height = VkGlobals::swapchain.height;
+
+	// the prepasses and the gbuffer leave depth read only, the render passes expect it back that way
+	VkImageMemoryBarrier2 depthBarrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	depthBarrier.srcStageMask = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+	depthBarrier.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	depthBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	depthBarrier.image = m_pApp->txrDepth.Get();
+	depthBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	depthBarrier.subresourceRange.levelCount = 1;
+	depthBarrier.subresourceRange.layerCount = 1;
+
+	VkDependencyInfo dependency = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dependency.imageMemoryBarrierCount = 1;
+	dependency.pImageMemoryBarriers = &depthBarrier;
+	vkCmdPipelineBarrier2(m_pApp->commandBufer, &dependency);
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyImageToBuffer(m_pApp->commandBufer, m_pApp->txrDepth.Get(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadow.cpuDepth, 1, &region);
+
+	depthBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	depthBarrier.srcAccessMask = VK_ACCESS_2_NONE;
+	depthBarrier.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+	depthBarrier.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier2(m_pApp->commandBufer, &dependency);
+
+	VulkanEngine::PipelineBarrier(m_pApp->commandBufer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+
+	VK_ASSERT(vkEndCommandBuffer(m_pApp->commandBufer));
+	VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &m_pApp->commandBufer;
+	VK_ASSERT(vkQueueSubmit(VkGlobals::queue.vkQueue, 1, &submit, VK_NULL_HANDLE));
+	VK_ASSERT(vkQueueWaitIdle(VkGlobals::queue.vkQueue));
+
+	shadow.cpuDepth.Read(shadow.depthData);
+
+	ShadowRays rays;
+	rays.pDepth = shadow.depthData.data();
+	rays.width = width;
+	rays.height = height;
+	rays.projInvert = m_pApp->constants.proj_invert;
+	rays.viewInvert = m_pApp->constants.view_invert;
+	const math::vec4& light = m_pApp->constants.directionLight;
+	rays.toLight = math::vec3(-light.x, -light.y, -light.z).normalized();
+	rays.tMin = kShadowRayMin;
+	rays.tMax = kShadowRayMax;
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	shadow.cpuRays += shadow.sceneBvh.TraceShadows(rays, shadow.maskData.data(), *shadow.workers);
+	shadow.cpuTraceSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	if (++shadow.cpuTraceFrames == kCpuShadowReportFrames)
+	{
+		std::cout << "CPU shadows: " << shadow.cpuRays / shadow.cpuTraceSeconds * 1e-6 << " Mrays/s, "
+			<< shadow.cpuTraceSeconds * 1000.0 / shadow.cpuTraceFrames << " ms per frame on " << shadow.workers->ThreadCount() << " threads" << std::endl;
+		shadow.cpuRays = 0;
+		shadow.cpuTraceSeconds = 0;
+		shadow.cpuTraceFrames = 0;
+	}
+
+	shadow.cpuMask.Load(shadow.maskData);
+
+	// the command buffer is reset as it begins again, the timestamp queries keep their values
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	VK_ASSERT(vkBeginCommandBuffer(m_pApp->commandBufer, &beginInfo));
+
+	shadow.txrShadowMask.SetBarier(m_pApp->commandBufer,
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+	);
 
-	m_pApp->directionalShadow.shaderShadows.Bind(m_pApp->commandBufer);
-	m_pApp->directionalShadow.shaderShadows.Draw(m_pApp->commandBufer, VkGlobals::swapchain.width, VkGlobals::swapchain.height);
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	vkCmdCopyBufferToImage(m_pApp->commandBufer, shadow.cpuMask, shadow.txrShadowMask.Get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
 
 void App::DrawSkybox()
@@ -744,7 +2287,7 @@ void App::DrawSkybox()
 		Texture hdisource;
 		RawTexture rwtex;
 		ModelLoader::LoadTexture(rwtex, "skyhdr\\sunset.png");
-		hdisource.Load(rwtex.data, rwtex.width, rwtex.height, EPixelFormat::RGBA);
+		hdisource.Load(rwtex.pixels.get(), rwtex.size(), rwtex.width, rwtex.height, EPixelFormat::RGBA);
 
 		m_pApp->skybox.txrSkybox.CreateCube(1024, 1024, EPixelFormat::RGBA);
 		m_pApp->skybox.txrSkybox.SetViewType(VK_IMAGE_VIEW_TYPE_2D_ARRAY);
@@ -869,7 +2412,43 @@ void App::Update(float dt)
 	}
 	m_pApp->mainCamera.SetRotation({ -dy, -dx, 0 });
 
+	// shadows traced for every pixel, every 2x2 or every 4x4 block
+	const uint32_t traceScales[] = { 1, 2, 4 };
+	const EKeys traceKeys[] = { EKeys::K1, EKeys::K2, EKeys::K3 };
+	for (uint32_t i(0); i < 3; ++i)
+	{
+		DirectShadow& shadow = m_pApp->directionalShadow;
+		const bool isAvailable = !shadow.isCpuTraced && (traceScales[i] == 1 || VulkanEngine::IsRayQuerySupported());
+		if (Input.KeyPressed(traceKeys[i]) && isAvailable && shadow.traceScale != traceScales[i])
+		{
+			shadow.traceScale = traceScales[i];
+			CreateShadowTraceTarget();
+			if (m_pApp->streaming.isSceneCreated)
+			{
+				BindSceneDescriptors();
+			}
+		}
+	}
+
+	// debug: slide the first instance along x and toggle its shadow, the TLAS is refit the next frame
+	if (m_pApp->streaming.isSceneCreated && !m_pApp->instances.empty())
+	{
+		const float slide = (Input.KeyPressed(EKeys::RARR) ? speed : 0) - (Input.KeyPressed(EKeys::LARR) ? speed : 0);
+		if (slide != 0)
+		{
+			InstanceTransform transform = m_pApp->instances[0].transform;
+			transform.rows[0][3] += slide;
+			SetInstanceTransform(0, transform);
+		}
 
+		static bool wasShadowKeyPressed = false;
+		const bool isShadowKeyPressed = Input.KeyPressed(EKeys::N);
+		if (isShadowKeyPressed && !wasShadowKeyPressed)
+		{
+			SetInstanceCastsShadow(0, m_pApp->instances[0].rayMask == 0);
+		}
+		wasShadowKeyPressed = isShadowKeyPressed;
+	}
 
 	if (Input.KeyPressed(EKeys::F1))
 	{
@@ -4,6 +4,8 @@
 #include "input.hpp"
 
 struct AppPimpl;
+struct InstanceTransform;
+class Model;
 
 class App
 {
@@ -24,9 +26,28 @@ public:
 
 	double GetGputTime() const { return m_gpuTime; }
 
+	// instances are numbered in draw order, moved and hidden instances refit the TLAS instead of rebuilding it
+	void SetInstanceTransform(uint32_t instanceId, const InstanceTransform& transform);
+	void SetInstanceCastsShadow(uint32_t instanceId, bool castsShadow);
+
 private:
+	void StreamScene();
+	void CreateScene(Model& diorama);
+	void UpdateTextureResidency();
+	bool IsTextureResident(uint32_t textureId) const;
+	void BuildTopLevelAccStructure();
+	void RefitTopLevelAccStructure();
+	void BindSceneDescriptors();
+	void BindMaterial(uint32_t materialId);
+
+	void ZPrepass(bool isLatePass);
+	void BuildHiZ();
+	void CullMeshes(bool isLatePass);
 	void GBufferPass();
 	void RaytraceShadows();
+	void TraceShadowsOnCpu();
+	void TraceShadowQueries();
+	void CreateShadowTraceTarget();
 	void LightingPass();
 	void SSAOPass();
 	void DrawSkybox();
@@ -0,0 +1,343 @@
+#include "bcencoder.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+
+namespace
+{
+	constexpr uint32_t kBlockTexels = 16;
+	constexpr size_t kBlockBytes = 16;
+
+	// 4 bit BC7 index weights, out of 64
+	constexpr int kWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(uint8_t* pOut) : m_pOut(pOut)
+		{
+			memset(m_pOut, 0, kBlockBytes);
+		}
+
+		void Write(uint32_t value, uint32_t bits)
+		{
+			for (uint32_t i(0); i < bits; ++i, ++m_bit)
+			{
+				m_pOut[m_bit >> 3] |= uint8_t(((value >> i) & 1) << (m_bit & 7));
+			}
+		}
+
+	private:
+		uint8_t* m_pOut;
+		uint32_t m_bit{ 0 };
+	};
+
+	// 7 bit endpoints with a shared lsb per endpoint
+	struct Mode6Endpoints
+	{
+		int color[2][4];
+		uint32_t pbit[2];
+	};
+
+	inline int Interpolate(int e0, int e1, int weight)
+	{
+		return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+	}
+
+	inline void QuantizeEndpoint(const float* endpoint, uint32_t pbit, int* color)
+	{
+		for (uint32_t c(0); c < 4; ++c)
+		{
+			const int value = int(std::lround((std::clamp(endpoint[c], 0.0f, 255.0f) - float(pbit)) * 0.5f));
+			color[c] = (std::clamp(value, 0, 127) << 1) | int(pbit);
+		}
+	}
+
+	// picks the closest palette entry for every texel, returns the squared error of the block
+	uint32_t FitIndices(const uint8_t* pBlock, const Mode6Endpoints& endpoints, uint8_t* indices)
+	{
+		int palette[16][4];
+		for (uint32_t i(0); i < 16; ++i)
+		{
+			for (uint32_t c(0); c < 4; ++c)
+			{
+				palette[i][c] = Interpolate(endpoints.color[0][c], endpoints.color[1][c], kWeights4[i]);
+			}
+		}
+
+		uint32_t totalError = 0;
+		for (uint32_t t(0); t < kBlockTexels; ++t)
+		{
+			const uint8_t* texel = pBlock + t * 4;
+			uint32_t bestError = UINT32_MAX;
+			for (uint32_t i(0); i < 16; ++i)
+			{
+				uint32_t error = 0;
+				for (uint32_t c(0); c < 4; ++c)
+				{
+					const int delta = palette[i][c] - int(texel[c]);
+					error += uint32_t(delta * delta);
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[t] = uint8_t(i);
+				}
+			}
+			totalError += bestError;
+		}
+		return totalError;
+	}
+
+	// tries every pbit combination for the unquantized line, keeps the best one
+	uint32_t FitEndpoints(const uint8_t* pBlock, const float* e0, const float* e1, Mode6Endpoints& best, uint8_t* bestIndices)
+	{
+		uint32_t bestError = UINT32_MAX;
+		for (uint32_t p(0); p < 4; ++p)
+		{
+			Mode6Endpoints endpoints;
+			endpoints.pbit[0] = p & 1;
+			endpoints.pbit[1] = p >> 1;
+			QuantizeEndpoint(e0, endpoints.pbit[0], endpoints.color[0]);
+			QuantizeEndpoint(e1, endpoints.pbit[1], endpoints.color[1]);
+
+			uint8_t indices[kBlockTexels];
+			const uint32_t error = FitIndices(pBlock, endpoints, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				best = endpoints;
+				memcpy(bestIndices, indices, kBlockTexels);
+			}
+		}
+		return bestError;
+	}
+
+	// least squares endpoints for the weights the indices select, false when the weights are degenerate
+	bool RefineEndpoints(const uint8_t* pBlock, const uint8_t* indices, float* e0, float* e1)
+	{
+		float a = 0, b = 0, c = 0;
+		float rhs0[4] = {}, rhs1[4] = {};
+		for (uint32_t t(0); t < kBlockTexels; ++t)
+		{
+			const float w = float(kWeights4[indices[t]]) / 64.0f;
+			a += (1 - w) * (1 - w);
+			b += (1 - w) * w;
+			c += w * w;
+			for (uint32_t ch(0); ch < 4; ++ch)
+			{
+				rhs0[ch] += (1 - w) * pBlock[t * 4 + ch];
+				rhs1[ch] += w * pBlock[t * 4 + ch];
+			}
+		}
+
+		const float det = a * c - b * b;
+		if (std::abs(det) < 1e-6f)
+		{
+			return false;
+		}
+
+		for (uint32_t ch(0); ch < 4; ++ch)
+		{
+			e0[ch] = (c * rhs0[ch] - b * rhs1[ch]) / det;
+			e1[ch] = (a * rhs1[ch] - b * rhs0[ch]) / det;
+		}
+		return true;
+	}
+
+	void EncodeBlockBC4(const uint8_t* pBlock, uint32_t channel, uint8_t* pOut)
+	{
+		uint8_t minValue = 255, maxValue = 0;
+		for (uint32_t t(0); t < kBlockTexels; ++t)
+		{
+			minValue = std::min(minValue, pBlock[t * 4 + channel]);
+			maxValue = std::max(maxValue, pBlock[t * 4 + channel]);
+		}
+
+		// max first selects the 8 value palette, a solid block only uses index 0
+		int palette[8] = { maxValue, minValue };
+		for (int i(2); i < 8; ++i)
+		{
+			palette[i] = ((8 - i) * maxValue + (i - 1) * minValue) / 7;
+		}
+
+		pOut[0] = maxValue;
+		pOut[1] = minValue;
+		uint64_t bits = 0;
+		for (uint32_t t(0); t < kBlockTexels; ++t)
+		{
+			const int value = pBlock[t * 4 + channel];
+			uint64_t bestIndex = 0;
+			int bestError = INT32_MAX;
+			for (uint32_t i(0); i < 8; ++i)
+			{
+				const int error = std::abs(palette[i] - value);
+				if (error < bestError)
+				{
+					bestError = error;
+					bestIndex = i;
+				}
+			}
+			bits |= bestIndex << (t * 3);
+		}
+
+		for (uint32_t i(0); i < 6; ++i)
+		{
+			pOut[2 + i] = uint8_t(bits >> (i * 8));
+		}
+	}
+}
+
+void bcenc::EncodeBlockBC5(const uint8_t* pBlock, uint8_t* pOut)
+{
+	EncodeBlockBC4(pBlock, 0, pOut);
+	EncodeBlockBC4(pBlock, 1, pOut + 8);
+}
+
+void bcenc::EncodeBlockBC7(const uint8_t* pBlock, uint8_t* pOut)
+{
+	float mean[4] = {};
+	for (uint32_t t(0); t < kBlockTexels; ++t)
+	{
+		for (uint32_t c(0); c < 4; ++c)
+		{
+			mean[c] += pBlock[t * 4 + c] / float(kBlockTexels);
+		}
+	}
+
+	float covariance[4][4] = {};
+	for (uint32_t t(0); t < kBlockTexels; ++t)
+	{
+		float d[4];
+		for (uint32_t c(0); c < 4; ++c)
+		{
+			d[c] = pBlock[t * 4 + c] - mean[c];
+		}
+		for (uint32_t i(0); i < 4; ++i)
+		{
+			for (uint32_t j(0); j < 4; ++j)
+			{
+				covariance[i][j] += d[i] * d[j];
+			}
+		}
+	}
+
+	// principal axis by power iteration, the diagonal is a good enough start
+	float axis[4] = { covariance[0][0], covariance[1][1], covariance[2][2], covariance[3][3] };
+	for (uint32_t iteration(0); iteration < 8; ++iteration)
+	{
+		float next[4] = {};
+		for (uint32_t i(0); i < 4; ++i)
+		{
+			for (uint32_t j(0); j < 4; ++j)
+			{
+				next[i] += covariance[i][j] * axis[j];
+			}
+		}
+
+		const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		if (length < 1e-6f)
+		{
+			break;
+		}
+		for (uint32_t c(0); c < 4; ++c)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+
+	float minT = 0, maxT = 0;
+	for (uint32_t t(0); t < kBlockTexels; ++t)
+	{
+		float projection = 0;
+		for (uint32_t c(0); c < 4; ++c)
+		{
+			projection += (pBlock[t * 4 + c] - mean[c]) * axis[c];
+		}
+		minT = std::min(minT, projection);
+		maxT = std::max(maxT, projection);
+	}
+
+	float e0[4], e1[4];
+	for (uint32_t c(0); c < 4; ++c)
+	{
+		e0[c] = mean[c] + minT * axis[c];
+		e1[c] = mean[c] + maxT * axis[c];
+	}
+
+	Mode6Endpoints endpoints;
+	uint8_t indices[kBlockTexels];
+	uint32_t error = FitEndpoints(pBlock, e0, e1, endpoints, indices);
+	if (error > 0 && RefineEndpoints(pBlock, indices, e0, e1))
+	{
+		Mode6Endpoints refined;
+		uint8_t refinedIndices[kBlockTexels];
+		if (FitEndpoints(pBlock, e0, e1, refined, refinedIndices) < error)
+		{
+			endpoints = refined;
+			memcpy(indices, refinedIndices, kBlockTexels);
+		}
+	}
+
+	// the msb of the first index is implicit zero
+	if (indices[0] & 8)
+	{
+		std::swap(endpoints.color[0], endpoints.color[1]);
+		std::swap(endpoints.pbit[0], endpoints.pbit[1]);
+		for (uint8_t& index : indices)
+		{
+			index = 15 - index;
+		}
+	}
+
+	BitWriter writer(pOut);
+	writer.Write(1 << 6, 7);
+	for (uint32_t c(0); c < 4; ++c)
+	{
+		writer.Write(uint32_t(endpoints.color[0][c]) >> 1, 7);
+		writer.Write(uint32_t(endpoints.color[1][c]) >> 1, 7);
+	}
+	writer.Write(endpoints.pbit[0], 1);
+	writer.Write(endpoints.pbit[1], 1);
+	writer.Write(indices[0], 3);
+	for (uint32_t t(1); t < kBlockTexels; ++t)
+	{
+		writer.Write(indices[t], 4);
+	}
+}
+
+void bcenc::Encode(const uint8_t* pPixels, uint32_t width, uint32_t height, EPixelFormat format, uint8_t* pOut)
+{
+	assert(format == EPixelFormat::BC5 || format == EPixelFormat::BC7);
+
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	for (uint32_t by(0); by < blocksY; ++by)
+	{
+		for (uint32_t bx(0); bx < blocksX; ++bx)
+		{
+			uint8_t block[kBlockTexels * 4];
+			for (uint32_t y(0); y < 4; ++y)
+			{
+				const uint32_t row = std::min(by * 4 + y, height - 1);
+				for (uint32_t x(0); x < 4; ++x)
+				{
+					const uint32_t column = std::min(bx * 4 + x, width - 1);
+					memcpy(block + (y * 4 + x) * 4, pPixels + (size_t(row) * width + column) * 4, 4);
+				}
+			}
+
+			uint8_t* pBlockOut = pOut + (size_t(by) * blocksX + bx) * kBlockBytes;
+			if (format == EPixelFormat::BC5)
+			{
+				EncodeBlockBC5(block, pBlockOut);
+			}
+			else
+			{
+				EncodeBlockBC7(block, pBlockOut);
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "../vulkan/vkcommon.hpp"
+
+
+// Cook time block compression of RGBA8 images. Blocks are 4x4 texels, blocks on the right and
+// bottom edge of images that are not a multiple of 4 repeat the last column and row.
+namespace bcenc
+{
+	// a block is 16 RGBA8 texels row by row, the output is 16 bytes for both formats
+	void EncodeBlockBC5(const uint8_t* pBlock, uint8_t* pOut);		// red and green, for normal maps
+	void EncodeBlockBC7(const uint8_t* pBlock, uint8_t* pOut);		// mode 6 only, a single RGBA line per block
+
+	// format is BC5 or BC7, pOut has room for the size of one mip of the image
+	void Encode(const uint8_t* pPixels, uint32_t width, uint32_t height, EPixelFormat format, uint8_t* pOut);
+}
\ No newline at end of file
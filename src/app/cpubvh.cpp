@@ -0,0 +1,564 @@
+#include "cpubvh.hpp"
+#include "workerpool.hpp"
+#include <immintrin.h>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+	constexpr uint32_t kBinCount = 16;
+	constexpr uint32_t kMaxLeafSize = 8;
+	constexpr float kTraversalCost = 1.0f;			// relative to testing one primitive
+	constexpr uint32_t kMaxDepth = 60;				// deeper nodes become leaves, the traversal stack stays bounded
+	constexpr uint32_t kStackSize = kMaxDepth + 4;
+	constexpr float kMinDirection = 1e-12f;
+
+	struct Aabb
+	{
+		float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const float* point)
+		{
+			for (uint32_t axis(0); axis < 3; ++axis)
+			{
+				min[axis] = std::min(min[axis], point[axis]);
+				max[axis] = std::max(max[axis], point[axis]);
+			}
+		}
+
+		void Grow(const Aabb& aabb)
+		{
+			Grow(aabb.min);
+			Grow(aabb.max);
+		}
+
+		float HalfArea() const
+		{
+			if (min[0] > max[0])
+			{
+				return 0.0f;
+			}
+			const float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+			return dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	// binned SAH over the bounds of the primitives, order gets the primitive of every leaf slot
+	class SahBuilder
+	{
+	public:
+		SahBuilder(const std::vector<Aabb>& bounds, std::vector<BvhNode>& nodes, std::vector<uint32_t>& order)
+			: m_bounds(bounds)
+			, m_nodes(nodes)
+			, m_order(order)
+		{
+			m_centroids.resize(bounds.size() * 3);
+			for (size_t i(0); i < bounds.size(); ++i)
+			{
+				for (uint32_t axis(0); axis < 3; ++axis)
+				{
+					m_centroids[i * 3 + axis] = (bounds[i].min[axis] + bounds[i].max[axis]) * 0.5f;
+				}
+			}
+		}
+
+		void Build()
+		{
+			m_order.resize(m_bounds.size());
+			std::iota(m_order.begin(), m_order.end(), 0);
+
+			m_nodes.clear();
+			m_nodes.reserve(m_bounds.size() * 2);
+			m_nodes.push_back({});
+			Subdivide(0, 0, uint32_t(m_bounds.size()), 0);
+		}
+
+	private:
+		void Subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+		{
+			Aabb aabb, centroidAabb;
+			for (uint32_t i(first); i < first + count; ++i)
+			{
+				aabb.Grow(m_bounds[m_order[i]]);
+				centroidAabb.Grow(&m_centroids[m_order[i] * 3]);
+			}
+
+			BvhNode& node = m_nodes[nodeIndex];
+			std::copy(aabb.min, aabb.min + 3, node.aabbMin);
+			std::copy(aabb.max, aabb.max + 3, node.aabbMax);
+			node.first = first;
+			node.count = count;
+			if (count == 1 || depth >= kMaxDepth)
+			{
+				return;
+			}
+
+			float bestCost = FLT_MAX;
+			uint32_t bestAxis = 0;
+			uint32_t bestSplit = 0;
+			for (uint32_t axis(0); axis < 3; ++axis)
+			{
+				const float extent = centroidAabb.max[axis] - centroidAabb.min[axis];
+				if (extent <= 0.0f)
+				{
+					continue;
+				}
+
+				Aabb bins[kBinCount];
+				uint32_t binCounts[kBinCount] = {};
+				const float scale = float(kBinCount) / extent;
+				for (uint32_t i(first); i < first + count; ++i)
+				{
+					const uint32_t bin = Bin(m_order[i], axis, centroidAabb.min[axis], scale);
+					bins[bin].Grow(m_bounds[m_order[i]]);
+					++binCounts[bin];
+				}
+
+				// costs of splitting after every bin, swept from both sides
+				float leftCosts[kBinCount - 1];
+				Aabb left;
+				uint32_t leftCount = 0;
+				for (uint32_t bin(0); bin < kBinCount - 1; ++bin)
+				{
+					left.Grow(bins[bin]);
+					leftCount += binCounts[bin];
+					leftCosts[bin] = left.HalfArea() * float(leftCount);
+				}
+
+				Aabb right;
+				uint32_t rightCount = 0;
+				for (uint32_t bin(kBinCount - 1); bin > 0; --bin)
+				{
+					right.Grow(bins[bin]);
+					rightCount += binCounts[bin];
+					const float cost = leftCosts[bin - 1] + right.HalfArea() * float(rightCount);
+					if (cost < bestCost && rightCount > 0 && rightCount < count)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = bin;
+					}
+				}
+			}
+
+			uint32_t leftCount = count / 2;
+			if (bestCost < FLT_MAX)
+			{
+				const float leafCost = aabb.HalfArea() * float(count);
+				if (count <= kMaxLeafSize && kTraversalCost * aabb.HalfArea() + bestCost >= leafCost)
+				{
+					return;
+				}
+
+				const float scale = float(kBinCount) / (centroidAabb.max[bestAxis] - centroidAabb.min[bestAxis]);
+				const auto middle = std::partition(m_order.begin() + first, m_order.begin() + first + count, [&](uint32_t primitive) {
+					return Bin(primitive, bestAxis, centroidAabb.min[bestAxis], scale) < bestSplit;
+				});
+				leftCount = uint32_t(middle - (m_order.begin() + first));
+			}
+			else if (count <= kMaxLeafSize)
+			{
+				// every centroid is in the same place
+				return;
+			}
+
+			const uint32_t childIndex = uint32_t(m_nodes.size());
+			m_nodes[nodeIndex].first = childIndex;
+			m_nodes[nodeIndex].count = 0;
+			m_nodes.push_back({});
+			m_nodes.push_back({});
+			Subdivide(childIndex, first, leftCount, depth + 1);
+			Subdivide(childIndex + 1, first + leftCount, count - leftCount, depth + 1);
+		}
+
+		inline uint32_t Bin(uint32_t primitive, uint32_t axis, float centroidMin, float scale) const
+		{
+			const float bin = (m_centroids[primitive * 3 + axis] - centroidMin) * scale;
+			return std::min(uint32_t(std::max(bin, 0.0f)), kBinCount - 1);
+		}
+
+	private:
+		const std::vector<Aabb>& m_bounds;
+		std::vector<BvhNode>& m_nodes;
+		std::vector<uint32_t>& m_order;
+		std::vector<float> m_centroids;
+	};
+
+	// the light direction of a packet in the space it is traced in
+	struct PacketRay
+	{
+		float direction[3];
+		float invDirection[3];
+		__m256 tMin;
+		__m256 tMax;
+	};
+
+	struct Packet
+	{
+		__m256 origin[3];
+		__m256 scaledOrigin[3];			// origin times the inverse direction, for the slab test
+	};
+
+	PacketRay MakeRay(const float* direction, __m256 tMin, __m256 tMax)
+	{
+		PacketRay ray;
+		for (uint32_t axis(0); axis < 3; ++axis)
+		{
+			// no zero components, a ray in a slab plane would turn the slab test into nan
+			ray.direction[axis] = std::abs(direction[axis]) < kMinDirection ? std::copysign(kMinDirection, direction[axis]) : direction[axis];
+			ray.invDirection[axis] = 1.0f / ray.direction[axis];
+		}
+		ray.tMin = tMin;
+		ray.tMax = tMax;
+		return ray;
+	}
+
+	inline void ScaleOrigin(Packet& packet, const PacketRay& ray)
+	{
+		for (uint32_t axis(0); axis < 3; ++axis)
+		{
+			packet.scaledOrigin[axis] = _mm256_mul_ps(packet.origin[axis], _mm256_set1_ps(ray.invDirection[axis]));
+		}
+	}
+
+	// lanes whose segment overlaps the box, the shared direction picks the near and far planes up front
+	inline int IntersectBox(const BvhNode& node, const Packet& packet, const PacketRay& ray)
+	{
+		__m256 tNear = ray.tMin;
+		__m256 tFar = ray.tMax;
+		for (uint32_t axis(0); axis < 3; ++axis)
+		{
+			const bool isPositive = ray.invDirection[axis] >= 0.0f;
+			const __m256 invDirection = _mm256_set1_ps(ray.invDirection[axis]);
+			const __m256 nearPlane = _mm256_set1_ps(isPositive ? node.aabbMin[axis] : node.aabbMax[axis]);
+			const __m256 farPlane = _mm256_set1_ps(isPositive ? node.aabbMax[axis] : node.aabbMin[axis]);
+			tNear = _mm256_max_ps(tNear, _mm256_fmsub_ps(nearPlane, invDirection, packet.scaledOrigin[axis]));
+			tFar = _mm256_min_ps(tFar, _mm256_fmsub_ps(farPlane, invDirection, packet.scaledOrigin[axis]));
+		}
+		return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+	}
+
+	// Moller-Trumbore, everything that only depends on the shared direction is scalar
+	inline int IntersectTriangle(const float* v0, const float* edge1, const float* edge2, const Packet& packet, const PacketRay& ray)
+	{
+		const float* d = ray.direction;
+		const float p[3] = { d[1] * edge2[2] - d[2] * edge2[1], d[2] * edge2[0] - d[0] * edge2[2], d[0] * edge2[1] - d[1] * edge2[0] };
+		const float det = edge1[0] * p[0] + edge1[1] * p[1] + edge1[2] * p[2];
+		if (det == 0.0f)
+		{
+			// parallel to the plane for every lane
+			return 0;
+		}
+
+		const float invDet = 1.0f / det;
+		const __m256 tx = _mm256_sub_ps(packet.origin[0], _mm256_set1_ps(v0[0]));
+		const __m256 ty = _mm256_sub_ps(packet.origin[1], _mm256_set1_ps(v0[1]));
+		const __m256 tz = _mm256_sub_ps(packet.origin[2], _mm256_set1_ps(v0[2]));
+
+		const __m256 u = _mm256_fmadd_ps(tx, _mm256_set1_ps(p[0] * invDet),
+			_mm256_fmadd_ps(ty, _mm256_set1_ps(p[1] * invDet), _mm256_mul_ps(tz, _mm256_set1_ps(p[2] * invDet))));
+
+		const __m256 qx = _mm256_fmsub_ps(ty, _mm256_set1_ps(edge1[2]), _mm256_mul_ps(tz, _mm256_set1_ps(edge1[1])));
+		const __m256 qy = _mm256_fmsub_ps(tz, _mm256_set1_ps(edge1[0]), _mm256_mul_ps(tx, _mm256_set1_ps(edge1[2])));
+		const __m256 qz = _mm256_fmsub_ps(tx, _mm256_set1_ps(edge1[1]), _mm256_mul_ps(ty, _mm256_set1_ps(edge1[0])));
+
+		const __m256 v = _mm256_fmadd_ps(qx, _mm256_set1_ps(d[0] * invDet),
+			_mm256_fmadd_ps(qy, _mm256_set1_ps(d[1] * invDet), _mm256_mul_ps(qz, _mm256_set1_ps(d[2] * invDet))));
+		const __m256 t = _mm256_fmadd_ps(qx, _mm256_set1_ps(edge2[0] * invDet),
+			_mm256_fmadd_ps(qy, _mm256_set1_ps(edge2[1] * invDet), _mm256_mul_ps(qz, _mm256_set1_ps(edge2[2] * invDet))));
+
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 hit = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, ray.tMin, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, ray.tMax, _CMP_LE_OQ));
+		return _mm256_movemask_ps(hit);
+	}
+
+	// calls leaf(node, lanes) for every leaf some of the active lanes reach, leaf returns the lanes it occluded
+	template<class LeafFunc>
+	inline int Traverse(const std::vector<BvhNode>& nodes, const Packet& packet, const PacketRay& ray, int active, LeafFunc leaf)
+	{
+		uint32_t stack[kStackSize];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		int occluded = 0;
+		while (stackSize > 0)
+		{
+			const BvhNode& node = nodes[stack[--stackSize]];
+			const int lanes = active & ~occluded & IntersectBox(node, packet, ray);
+			if (lanes == 0)
+			{
+				continue;
+			}
+
+			if (node.count == 0)
+			{
+				stack[stackSize++] = node.first + 1;
+				stack[stackSize++] = node.first;
+				continue;
+			}
+
+			occluded |= leaf(node, lanes);
+			if ((active & ~occluded) == 0)
+			{
+				break;
+			}
+		}
+		return occluded;
+	}
+
+	// inverse of an affine 3x4, false when it is singular
+	bool InvertAffine(const float m[3][4], float out[3][4])
+	{
+		const float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+		const float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+		const float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+		const float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+		if (std::abs(det) < FLT_MIN)
+		{
+			return false;
+		}
+
+		const float invDet = 1.0f / det;
+		out[0][0] = c00 * invDet;
+		out[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+		out[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+		out[1][0] = c01 * invDet;
+		out[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+		out[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+		out[2][0] = c02 * invDet;
+		out[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+		out[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+		for (uint32_t row(0); row < 3; ++row)
+		{
+			out[row][3] = -(out[row][0] * m[0][3] + out[row][1] * m[1][3] + out[row][2] * m[2][3]);
+		}
+		return true;
+	}
+}
+
+void MeshBvh::Build(const std::vector<float>& positions, const std::vector<uint32_t>& indices)
+{
+	m_nodes.clear();
+	m_triangles.clear();
+
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	std::vector<Aabb> bounds(triangleCount);
+	for (size_t i(0); i < triangleCount; ++i)
+	{
+		for (uint32_t corner(0); corner < 3; ++corner)
+		{
+			bounds[i].Grow(&positions[size_t(indices[i * 3 + corner]) * 3]);
+		}
+	}
+
+	std::vector<uint32_t> order;
+	SahBuilder(bounds, m_nodes, order).Build();
+
+	m_triangles.resize(triangleCount);
+	for (size_t i(0); i < triangleCount; ++i)
+	{
+		const uint32_t* triangle = &indices[size_t(order[i]) * 3];
+		const float* p0 = &positions[size_t(triangle[0]) * 3];
+		const float* p1 = &positions[size_t(triangle[1]) * 3];
+		const float* p2 = &positions[size_t(triangle[2]) * 3];
+		for (uint32_t axis(0); axis < 3; ++axis)
+		{
+			m_triangles[i].v0[axis] = p0[axis];
+			m_triangles[i].edge1[axis] = p1[axis] - p0[axis];
+			m_triangles[i].edge2[axis] = p2[axis] - p0[axis];
+		}
+	}
+}
+
+void SceneBvh::Clear()
+{
+	m_instances.clear();
+	m_nodes.clear();
+}
+
+void SceneBvh::AddInstance(const MeshBvh* pMesh, const float rows[3][4])
+{
+	assert(pMesh);
+	Instance instance;
+	instance.pMesh = pMesh;
+	if (pMesh->IsEmpty() || !InvertAffine(rows, instance.toObject))
+	{
+		// nothing to hit, or flattened to nothing
+		return;
+	}
+
+	const BvhNode& root = pMesh->Root();
+	for (uint32_t row(0); row < 3; ++row)
+	{
+		float center = rows[row][3];
+		float extent = 0.0f;
+		for (uint32_t axis(0); axis < 3; ++axis)
+		{
+			center += rows[row][axis] * (root.aabbMin[axis] + root.aabbMax[axis]) * 0.5f;
+			extent += std::abs(rows[row][axis]) * (root.aabbMax[axis] - root.aabbMin[axis]) * 0.5f;
+		}
+		instance.aabbMin[row] = center - extent;
+		instance.aabbMax[row] = center + extent;
+	}
+	m_instances.push_back(instance);
+}
+
+void SceneBvh::Build()
+{
+	m_nodes.clear();
+	if (m_instances.empty())
+	{
+		return;
+	}
+
+	std::vector<Aabb> bounds(m_instances.size());
+	for (size_t i(0); i < m_instances.size(); ++i)
+	{
+		bounds[i].Grow(m_instances[i].aabbMin);
+		bounds[i].Grow(m_instances[i].aabbMax);
+	}
+
+	std::vector<uint32_t> order;
+	SahBuilder(bounds, m_nodes, order).Build();
+
+	std::vector<Instance> instances(m_instances.size());
+	for (size_t i(0); i < order.size(); ++i)
+	{
+		instances[i] = m_instances[order[i]];
+	}
+	m_instances = std::move(instances);
+}
+
+uint64_t SceneBvh::TraceShadows(const ShadowRays& rays, float* pMask, WorkerPool& workers) const
+{
+	assert(!IsEmpty());
+
+	const float toLight[3] = { rays.toLight.x, rays.toLight.y, rays.toLight.z };
+	const PacketRay worldRay = MakeRay(toLight, _mm256_set1_ps(rays.tMin), _mm256_set1_ps(rays.tMax));
+
+	// packets are 4x2 pixels
+	const uint32_t tilesX = (rays.width + kTileSize - 1) / kTileSize;
+	const uint32_t tilesY = (rays.height + kTileSize - 1) / kTileSize;
+	std::atomic<uint64_t> rayCount{ 0 };
+	workers.ParallelFor(size_t(tilesX) * tilesY, [&](size_t tile) {
+		const uint32_t tileX = uint32_t(tile % tilesX) * kTileSize;
+		const uint32_t tileY = uint32_t(tile / tilesX) * kTileSize;
+		const uint32_t endX = std::min(tileX + kTileSize, rays.width);
+		const uint32_t endY = std::min(tileY + kTileSize, rays.height);
+
+		uint64_t tileRays = 0;
+		for (uint32_t y(tileY); y < endY; y += 2)
+		{
+			for (uint32_t x(tileX); x < endX; x += 4)
+			{
+				alignas(32) float origin[3][8] = {};
+				int active = 0;
+				for (uint32_t lane(0); lane < 8; ++lane)
+				{
+					const uint32_t px = x + (lane & 3);
+					const uint32_t py = y + (lane >> 2);
+					if (px >= endX || py >= endY)
+					{
+						continue;
+					}
+
+					// background stays lit
+					const size_t pixel = size_t(py) * rays.width + px;
+					pMask[pixel] = 1.0f;
+					const float depth = rays.pDepth[pixel];
+					if (depth >= 1.0f)
+					{
+						continue;
+					}
+
+					// WorldPosFromDepth in common.almfx
+					const math::vec4 clip((px + 0.5f) / rays.width * 2.0f - 1.0f, (py + 0.5f) / rays.height * 2.0f - 1.0f, depth, 1.0f);
+					math::vec4 view = rays.projInvert * clip;
+					view.y = -view.y;
+					view = view * (1.0f / view.w);
+					const math::vec4 world = rays.viewInvert * view;
+					origin[0][lane] = world.x;
+					origin[1][lane] = world.y;
+					origin[2][lane] = world.z;
+					active |= 1 << lane;
+				}
+
+				if (active == 0)
+				{
+					continue;
+				}
+				tileRays += _mm_popcnt_u32(uint32_t(active));
+
+				Packet packet;
+				for (uint32_t axis(0); axis < 3; ++axis)
+				{
+					packet.origin[axis] = _mm256_load_ps(origin[axis]);
+				}
+				ScaleOrigin(packet, worldRay);
+
+				const int occluded = Traverse(m_nodes, packet, worldRay, active, [&](const BvhNode& leaf, int lanes) {
+					int leafOccluded = 0;
+					for (uint32_t i(leaf.first); i < leaf.first + leaf.count && (lanes & ~leafOccluded) != 0; ++i)
+					{
+						const Instance& instance = m_instances[i];
+						const float (*m)[4] = instance.toObject;
+
+						// object space packet, the direction is not renormalized so t stays the same
+						Packet objectPacket;
+						float direction[3];
+						for (uint32_t row(0); row < 3; ++row)
+						{
+							objectPacket.origin[row] = _mm256_fmadd_ps(packet.origin[0], _mm256_set1_ps(m[row][0]),
+								_mm256_fmadd_ps(packet.origin[1], _mm256_set1_ps(m[row][1]),
+								_mm256_fmadd_ps(packet.origin[2], _mm256_set1_ps(m[row][2]), _mm256_set1_ps(m[row][3]))));
+							direction[row] = m[row][0] * worldRay.direction[0] + m[row][1] * worldRay.direction[1] + m[row][2] * worldRay.direction[2];
+						}
+						const PacketRay objectRay = MakeRay(direction, worldRay.tMin, worldRay.tMax);
+						ScaleOrigin(objectPacket, objectRay);
+
+						const MeshBvh& mesh = *instance.pMesh;
+						leafOccluded |= Traverse(mesh.m_nodes, objectPacket, objectRay, lanes & ~leafOccluded, [&](const BvhNode& meshLeaf, int meshLanes) {
+							int hits = 0;
+							for (uint32_t t(meshLeaf.first); t < meshLeaf.first + meshLeaf.count; ++t)
+							{
+								const MeshBvh::Triangle& triangle = mesh.m_triangles[t];
+								hits |= IntersectTriangle(triangle.v0, triangle.edge1, triangle.edge2, objectPacket, objectRay) & meshLanes;
+								if ((meshLanes & ~hits) == 0)
+								{
+									break;
+								}
+							}
+							return hits;
+						});
+					}
+					return leafOccluded;
+				});
+
+				for (uint32_t lane(0); lane < 8; ++lane)
+				{
+					if (occluded & (1 << lane))
+					{
+						pMask[size_t(y + (lane >> 2)) * rays.width + x + (lane & 3)] = 0.0f;
+					}
+				}
+			}
+		}
+		rayCount += tileRays;
+	});
+
+	return rayCount;
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "../math/mat4.hpp"
+#include "../math/vec3.hpp"
+
+class WorkerPool;
+
+
+// Shadow rays traced on the cpu, the fallback without hardware ray tracing and a reference for the TLAS.
+// A mesh BVH is built with the binned surface area heuristic from the positions and indices its BLAS
+// is built from, the scene BVH over the world bounds of the instances refers to them like the TLAS refers
+// to the BLASes. Rays share the light direction and are traced eight at a time with AVX2, the first hit
+// ends a ray and triangles are hit from both sides.
+struct BvhNode
+{
+	float aabbMin[3];
+	uint32_t first;				// first child of an inner node, first primitive of a leaf
+	float aabbMax[3];
+	uint32_t count;				// primitives of a leaf, zero for inner nodes
+};
+
+class MeshBvh
+{
+public:
+	// xyz per vertex, three indices per triangle
+	void Build(const std::vector<float>& positions, const std::vector<uint32_t>& indices);
+
+	inline bool IsEmpty() const { return m_nodes.empty(); }
+	inline const BvhNode& Root() const { return m_nodes.front(); }
+
+private:
+	friend class SceneBvh;
+
+	// the first vertex and both edges, in leaf order
+	struct Triangle
+	{
+		float v0[3];
+		float edge1[3];
+		float edge2[3];
+	};
+
+	std::vector<BvhNode> m_nodes;
+	std::vector<Triangle> m_triangles;
+};
+
+// every pixel of the depth buffer that is not background starts a ray toward the light
+struct ShadowRays
+{
+	const float* pDepth{ nullptr };		// D32 row by row
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	math::mat4 projInvert;
+	math::mat4 viewInvert;
+	math::vec3 toLight;
+	float tMin{ 0 };
+	float tMax{ 0 };
+};
+
+class SceneBvh
+{
+public:
+	static constexpr uint32_t kTileSize = 16;			// pixels per side a worker takes at once
+
+	void Clear();
+	// rows map the mesh into world space like VkTransformMatrixKHR, the mesh must outlive the next Build
+	void AddInstance(const MeshBvh* pMesh, const float rows[3][4]);
+	void Build();
+
+	inline bool IsEmpty() const { return m_nodes.empty(); }
+
+	// writes 1 for lit and 0 for shadowed pixels to pMask, returns the number of traced rays
+	uint64_t TraceShadows(const ShadowRays& rays, float* pMask, WorkerPool& workers) const;
+
+private:
+	struct Instance
+	{
+		const MeshBvh* pMesh;
+		float toObject[3][4];
+		float aabbMin[3];							// world space
+		float aabbMax[3];
+	};
+
+	std::vector<Instance> m_instances;				// in leaf order after Build
+	std::vector<BvhNode> m_nodes;
+};
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "ktx2.hpp"
+#include "../vulkan/vkutils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+namespace
+{
+	constexpr uint8_t kIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	constexpr uint32_t kNoSupercompression = 0;
+
+	struct Header
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+
+	struct LevelIndex
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	bool IsFormat(uint32_t vkFormat, EPixelFormat format)
+	{
+		switch (format)
+		{
+		case EPixelFormat::BC1: return vkFormat >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && vkFormat <= VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+		case EPixelFormat::BC5: return vkFormat == VK_FORMAT_BC5_UNORM_BLOCK;
+		case EPixelFormat::BC7: return vkFormat == VK_FORMAT_BC7_UNORM_BLOCK || vkFormat == VK_FORMAT_BC7_SRGB_BLOCK;
+		default: return false;
+		}
+	}
+}
+
+bool ktx2::Read(const std::filesystem::path& path, EPixelFormat format, uint32_t firstMip, CookedTexture& texture)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->Open(path))
+	{
+		return false;
+	}
+
+	Header header;
+	if (file->size() < sizeof(Header) || memcmp(file->data(), kIdentifier, sizeof(kIdentifier)) != 0)
+	{
+		std::cout << "\tNot a KTX2 file: " << path << std::endl;
+		return false;
+	}
+	memcpy(&header, file->data(), sizeof(Header));
+
+	// a level count of zero asks the loader to generate mips, there is nothing to generate them from
+	const uint32_t levelCount = std::max(header.levelCount, 1u);
+	if (!IsFormat(header.vkFormat, format)
+		|| header.supercompressionScheme != kNoSupercompression
+		|| header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1
+		|| header.layerCount > 1 || header.faceCount != 1
+		|| levelCount > MipCount(header.pixelWidth, header.pixelHeight)
+		|| file->size() - sizeof(Header) < levelCount * sizeof(LevelIndex))
+	{
+		std::cout << "\tUnsupported KTX2 texture: " << path << std::endl;
+		return false;
+	}
+
+	CookedTexture cached;
+	cached.width = header.pixelWidth;
+	cached.height = header.pixelHeight;
+	cached.mipCount = levelCount;
+	cached.format = format;
+	for (uint32_t i(0); i < levelCount; ++i)
+	{
+		LevelIndex level;
+		memcpy(&level, file->data() + sizeof(Header) + i * sizeof(LevelIndex), sizeof(LevelIndex));
+
+		const size_t mipSize = CompressedMipSize(format, std::max(cached.width >> i, 1u), std::max(cached.height >> i, 1u));
+		if (level.byteLength != mipSize || level.byteOffset > file->size() || file->size() - level.byteOffset < level.byteLength)
+		{
+			std::cout << "\tBroken KTX2 level index: " << path << std::endl;
+			return false;
+		}
+		cached.mappedMips.push_back(file->data() + level.byteOffset);
+	}
+
+	cached.file = std::move(file);
+	cached.firstMip = std::min(firstMip, levelCount - 1);
+	texture = std::move(cached);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include "modelloader.hpp"
+
+
+// KTX2 containers with pre-built mips, the levels are used in place from the mapped file.
+// Only 2D block compressed images without supercompression are read, the format has to be
+// the one the cooker would produce for the usage.
+namespace ktx2
+{
+	bool Read(const std::filesystem::path& path, EPixelFormat format, uint32_t firstMip, CookedTexture& texture);
+}
\ No newline at end of file
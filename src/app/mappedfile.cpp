@@ -0,0 +1,65 @@
+#include "mappedfile.hpp"
+#include <Windows.h>
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+
+	HANDLE hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	m_hFile = hFile;
+
+	LARGE_INTEGER fileSize{};
+	if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_pData == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	m_size = size_t(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_pData)
+	{
+		UnmapViewOfFile(m_pData);
+	}
+	if (m_hMapping)
+	{
+		CloseHandle(m_hMapping);
+	}
+	if (m_hFile)
+	{
+		CloseHandle(m_hFile);
+	}
+
+	m_hFile = nullptr;
+	m_hMapping = nullptr;
+	m_pData = nullptr;
+	m_size = 0;
+}
\ No newline at end of file
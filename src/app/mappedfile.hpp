@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+
+
+// Read only view of a whole file, pages are loaded by the OS on first access.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	bool Open(const std::filesystem::path& path);
+	void Close();
+
+	inline const uint8_t* data() const { return m_pData; }
+	inline size_t size() const { return m_size; }
+	inline bool IsOpen() const { return m_pData != nullptr; }
+
+public:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+	void* m_hFile{ nullptr };
+	void* m_hMapping{ nullptr };
+	const uint8_t* m_pData{ nullptr };
+	size_t m_size{ 0 };
+};
\ No newline at end of file
@@ -0,0 +1,553 @@
+#include "meshoptimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+
+namespace
+{
+	constexpr size_t kScoreCacheSize = 32;
+	constexpr size_t kFifoCacheSize = 16;
+	constexpr size_t kCacheLineSize = 64;
+	constexpr size_t kFetchCacheLines = 64;
+
+	inline float VertexScore(int32_t cachePosition, uint32_t remaining)
+	{
+		if (remaining == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// the last triangle is going to be used anyway, do not prefer it over the rest of the cache
+			if (cachePosition < 3)
+			{
+				score = 0.75f;
+			}
+			else
+			{
+				const float scale = 1.0f / float(kScoreCacheSize - 3);
+				score = std::pow(1.0f - float(cachePosition - 3) * scale, 1.5f);
+			}
+		}
+
+		// vertices with few triangles left are finished first
+		return score + 2.0f / std::sqrt(float(remaining));
+	}
+
+	struct FifoCache
+	{
+		std::vector<uint32_t> timestamps;
+		uint32_t time{ 0 };
+		size_t size{ 0 };
+
+		FifoCache(size_t entryCount, size_t cacheSize)
+			: timestamps(entryCount, 0)
+			, time(uint32_t(cacheSize) + 1)
+			, size(cacheSize)
+		{
+		}
+
+		// returns true on a miss
+		bool Access(uint32_t entry)
+		{
+			if (time - timestamps[entry] > size)
+			{
+				timestamps[entry] = time++;
+				return true;
+			}
+			return false;
+		}
+	};
+}
+
+
+namespace meshopt
+{
+	VertexCacheStats& VertexCacheStats::operator+=(const VertexCacheStats& stats)
+	{
+		triangles += stats.triangles;
+		vertices += stats.vertices;
+		misses += stats.misses;
+		return *this;
+	}
+
+	VertexFetchStats& VertexFetchStats::operator+=(const VertexFetchStats& stats)
+	{
+		bytesFetched += stats.bytesFetched;
+		bytesUsed += stats.bytesUsed;
+		return *this;
+	}
+
+	void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		// vertex -> triangles, the live part of every list shrinks as triangles are emitted
+		std::vector<uint32_t> remaining(vertexCount, 0);
+		for (size_t i(0); i < indexCount; ++i)
+		{
+			++remaining[indices[i]];
+		}
+
+		std::vector<uint32_t> offsets(vertexCount + 1, 0);
+		for (size_t v(0); v < vertexCount; ++v)
+		{
+			offsets[v + 1] = offsets[v] + remaining[v];
+		}
+
+		std::vector<uint32_t> adjacency(indexCount);
+		{
+			std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t i(0); i < indexCount; ++i)
+			{
+				adjacency[cursor[indices[i]]++] = uint32_t(i / 3);
+			}
+		}
+
+		std::vector<int32_t> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v(0); v < vertexCount; ++v)
+		{
+			vertexScore[v] = VertexScore(-1, remaining[v]);
+		}
+
+		std::vector<float> triangleScore(triangleCount);
+		std::vector<bool> isEmitted(triangleCount, false);
+		for (size_t t(0); t < triangleCount; ++t)
+		{
+			triangleScore[t] = vertexScore[indices[t * 3 + 0]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+		}
+
+		std::vector<uint32_t> result;
+		result.reserve(indexCount);
+
+		std::vector<uint32_t> cache;
+		std::vector<uint32_t> newCache;
+		cache.reserve(kScoreCacheSize + 3);
+		newCache.reserve(kScoreCacheSize + 3);
+
+		uint32_t bestTriangle = uint32_t(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+		size_t scanCursor = 0;
+
+		while (result.size() < indexCount)
+		{
+			if (bestTriangle == UINT32_MAX)
+			{
+				// nothing in the cache has triangles left, continue with the next unused one
+				while (isEmitted[scanCursor])
+				{
+					++scanCursor;
+				}
+				bestTriangle = uint32_t(scanCursor);
+			}
+
+			const uint32_t* triangle = &indices[bestTriangle * 3];
+			isEmitted[bestTriangle] = true;
+
+			newCache.clear();
+			for (uint32_t k(0); k < 3; ++k)
+			{
+				const uint32_t v = triangle[k];
+				result.push_back(v);
+				newCache.push_back(v);
+
+				// remove the triangle from the live part of the list
+				uint32_t* first = &adjacency[offsets[v]];
+				uint32_t* last = first + remaining[v];
+				std::iter_swap(std::find(first, last, bestTriangle), last - 1);
+				--remaining[v];
+			}
+
+			for (uint32_t v : cache)
+			{
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				{
+					newCache.push_back(v);
+				}
+			}
+
+			for (size_t i(0); i < newCache.size(); ++i)
+			{
+				const uint32_t v = newCache[i];
+				cachePosition[v] = i < kScoreCacheSize ? int32_t(i) : -1;
+				vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+			}
+
+			bestTriangle = UINT32_MAX;
+			float bestScore = -1.0f;
+			for (uint32_t v : newCache)
+			{
+				for (uint32_t a(offsets[v]); a < offsets[v] + remaining[v]; ++a)
+				{
+					const uint32_t t = adjacency[a];
+					triangleScore[t] = vertexScore[indices[t * 3 + 0]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+					if (triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						bestTriangle = t;
+					}
+				}
+			}
+
+			if (newCache.size() > kScoreCacheSize)
+			{
+				newCache.resize(kScoreCacheSize);
+			}
+			std::swap(cache, newCache);
+		}
+
+		std::copy(result.begin(), result.end(), indices);
+	}
+
+	void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices, float threshold)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		// a triangle that misses all three vertices starts a new cluster
+		std::vector<size_t> clusters;
+		{
+			FifoCache cache(vertices.size(), kFifoCacheSize);
+			for (size_t t(0); t < triangleCount; ++t)
+			{
+				uint32_t misses = 0;
+				for (uint32_t k(0); k < 3; ++k)
+				{
+					misses += cache.Access(indices[t * 3 + k]) ? 1 : 0;
+				}
+
+				if (misses == 3 || t == 0)
+				{
+					clusters.push_back(t);
+				}
+			}
+		}
+
+		if (clusters.size() < 2)
+		{
+			return;
+		}
+		clusters.push_back(triangleCount);
+
+		double meshCentroid[3] = { 0, 0, 0 };
+		double meshArea = 0;
+
+		std::vector<double> clusterCentroids(clusters.size() * 3, 0.0);
+		std::vector<double> clusterNormals(clusters.size() * 3, 0.0);
+		std::vector<double> clusterAreas(clusters.size(), 0.0);
+		for (size_t c(0); c + 1 < clusters.size(); ++c)
+		{
+			for (size_t t(clusters[c]); t < clusters[c + 1]; ++t)
+			{
+				const Vertex& a = vertices[indices[t * 3 + 0]];
+				const Vertex& b = vertices[indices[t * 3 + 1]];
+				const Vertex& d = vertices[indices[t * 3 + 2]];
+
+				const double e0[3] = { b.px - a.px, b.py - a.py, b.pz - a.pz };
+				const double e1[3] = { d.px - a.px, d.py - a.py, d.pz - a.pz };
+				const double n[3] = {
+					e0[1] * e1[2] - e0[2] * e1[1],
+					e0[2] * e1[0] - e0[0] * e1[2],
+					e0[0] * e1[1] - e0[1] * e1[0]
+				};
+				const double area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				const double centroid[3] = { (a.px + b.px + d.px) / 3.0, (a.py + b.py + d.py) / 3.0, (a.pz + b.pz + d.pz) / 3.0 };
+
+				for (uint32_t k(0); k < 3; ++k)
+				{
+					clusterCentroids[c * 3 + k] += centroid[k] * area;
+					clusterNormals[c * 3 + k] += n[k];
+					meshCentroid[k] += centroid[k] * area;
+				}
+				clusterAreas[c] += area;
+				meshArea += area;
+			}
+		}
+
+		if (meshArea <= 0)
+		{
+			return;
+		}
+		for (uint32_t k(0); k < 3; ++k)
+		{
+			meshCentroid[k] /= meshArea;
+		}
+
+		// clusters facing away from the mesh center occlude the rest from most view directions
+		std::vector<float> sortKeys(clusters.size() - 1, 0.0f);
+		for (size_t c(0); c < sortKeys.size(); ++c)
+		{
+			if (clusterAreas[c] <= 0)
+			{
+				continue;
+			}
+
+			const double* n = &clusterNormals[c * 3];
+			const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length <= 0)
+			{
+				continue;
+			}
+
+			double key = 0;
+			for (uint32_t k(0); k < 3; ++k)
+			{
+				key += (clusterCentroids[c * 3 + k] / clusterAreas[c] - meshCentroid[k]) * n[k] / length;
+			}
+			sortKeys[c] = float(key);
+		}
+
+		std::vector<uint32_t> order(sortKeys.size());
+		for (uint32_t c(0); c < order.size(); ++c)
+		{
+			order[c] = c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indexCount);
+		for (uint32_t c : order)
+		{
+			result.insert(result.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+		}
+
+		const float acmrBefore = AnalyzeVertexCache(indices, indexCount, vertices.size()).Acmr();
+		const float acmrAfter = AnalyzeVertexCache(result.data(), result.size(), vertices.size()).Acmr();
+		if (acmrAfter <= acmrBefore * threshold)
+		{
+			std::copy(result.begin(), result.end(), indices);
+		}
+	}
+
+	void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+		uint32_t vertexCount = 0;
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == UINT32_MAX)
+			{
+				remap[index] = vertexCount++;
+			}
+			index = remap[index];
+		}
+
+		std::vector<Vertex> result(vertexCount);
+		for (size_t v(0); v < vertices.size(); ++v)
+		{
+			if (remap[v] != UINT32_MAX)
+			{
+				result[remap[v]] = vertices[v];
+			}
+		}
+		vertices.swap(result);
+	}
+
+	inline void ComputeMeshletBounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const uint32_t* meshletVertices, const uint32_t* meshletTriangles)
+	{
+		float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t i(0); i < meshlet.vertexCount; ++i)
+		{
+			const Vertex& vertex = vertices[meshletVertices[i]];
+			const float position[3] = { vertex.px, vertex.py, vertex.pz };
+			for (uint32_t k(0); k < 3; ++k)
+			{
+				boundsMin[k] = std::min(boundsMin[k], position[k]);
+				boundsMax[k] = std::max(boundsMax[k], position[k]);
+			}
+		}
+
+		float radius = 0.0f;
+		for (uint32_t k(0); k < 3; ++k)
+		{
+			meshlet.center[k] = (boundsMin[k] + boundsMax[k]) * 0.5f;
+		}
+		for (uint32_t i(0); i < meshlet.vertexCount; ++i)
+		{
+			const Vertex& vertex = vertices[meshletVertices[i]];
+			const float dx = vertex.px - meshlet.center[0];
+			const float dy = vertex.py - meshlet.center[1];
+			const float dz = vertex.pz - meshlet.center[2];
+			radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+		}
+		meshlet.radius = std::sqrt(radius);
+
+		std::vector<float> normals;
+		normals.reserve(meshlet.triangleCount * 3);
+		float axis[3] = { 0, 0, 0 };
+		for (uint32_t t(0); t < meshlet.triangleCount; ++t)
+		{
+			const uint32_t packed = meshletTriangles[t];
+			const Vertex& a = vertices[meshletVertices[packed & 0xff]];
+			const Vertex& b = vertices[meshletVertices[(packed >> 8) & 0xff]];
+			const Vertex& c = vertices[meshletVertices[(packed >> 16) & 0xff]];
+
+			const float e0[3] = { b.px - a.px, b.py - a.py, b.pz - a.pz };
+			const float e1[3] = { c.px - a.px, c.py - a.py, c.pz - a.pz };
+			float n[3] = {
+				e0[1] * e1[2] - e0[2] * e1[1],
+				e0[2] * e1[0] - e0[0] * e1[2],
+				e0[0] * e1[1] - e0[1] * e1[0]
+			};
+
+			const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length <= 0.0f)
+			{
+				continue;
+			}
+
+			for (uint32_t k(0); k < 3; ++k)
+			{
+				n[k] /= length;
+				axis[k] += n[k];
+				normals.push_back(n[k]);
+			}
+		}
+
+		// a cone that can not reject anything
+		meshlet.coneAxis[0] = meshlet.coneAxis[1] = meshlet.coneAxis[2] = 0.0f;
+		meshlet.coneCutoff = 1.0f;
+
+		const float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		if (axisLength <= 0.0f)
+		{
+			return;
+		}
+
+		float minDot = 1.0f;
+		for (size_t i(0); i < normals.size(); i += 3)
+		{
+			const float d = (normals[i + 0] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2]) / axisLength;
+			minDot = std::min(minDot, d);
+		}
+
+		// wider than ~84 degrees rejects too little to be worth testing
+		if (minDot <= 0.1f)
+		{
+			return;
+		}
+
+		for (uint32_t k(0); k < 3; ++k)
+		{
+			meshlet.coneAxis[k] = axis[k] / axisLength;
+		}
+		meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+
+	void BuildMeshlets(const uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices,
+		std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint32_t>& meshletTriangles)
+	{
+		std::vector<uint32_t> localIndex(vertices.size(), UINT32_MAX);
+
+		Meshlet meshlet = {};
+		meshlet.vertexOffset = uint32_t(meshletVertices.size());
+		meshlet.triangleOffset = uint32_t(meshletTriangles.size());
+
+		const auto finish = [&]() {
+			ComputeMeshletBounds(meshlet, vertices, &meshletVertices[meshlet.vertexOffset], &meshletTriangles[meshlet.triangleOffset]);
+			for (uint32_t i(0); i < meshlet.vertexCount; ++i)
+			{
+				localIndex[meshletVertices[meshlet.vertexOffset + i]] = UINT32_MAX;
+			}
+			meshlets.push_back(meshlet);
+
+			meshlet = {};
+			meshlet.vertexOffset = uint32_t(meshletVertices.size());
+			meshlet.triangleOffset = uint32_t(meshletTriangles.size());
+		};
+
+		for (size_t i(0); i + 2 < indexCount; i += 3)
+		{
+			const uint32_t a = indices[i + 0];
+			const uint32_t b = indices[i + 1];
+			const uint32_t c = indices[i + 2];
+
+			uint32_t newVertices = (localIndex[a] == UINT32_MAX ? 1 : 0);
+			newVertices += (localIndex[b] == UINT32_MAX && b != a) ? 1 : 0;
+			newVertices += (localIndex[c] == UINT32_MAX && c != a && c != b) ? 1 : 0;
+
+			if (meshlet.vertexCount + newVertices > kMeshletMaxVertices || meshlet.triangleCount + 1 > kMeshletMaxTriangles)
+			{
+				finish();
+			}
+
+			uint32_t packed = 0;
+			const uint32_t triangle[3] = { a, b, c };
+			for (uint32_t k(0); k < 3; ++k)
+			{
+				uint32_t& local = localIndex[triangle[k]];
+				if (local == UINT32_MAX)
+				{
+					local = meshlet.vertexCount++;
+					meshletVertices.push_back(triangle[k]);
+				}
+				packed |= local << (k * 8);
+			}
+
+			meshletTriangles.push_back(packed);
+			++meshlet.triangleCount;
+		}
+
+		if (meshlet.triangleCount > 0)
+		{
+			finish();
+		}
+	}
+
+	VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		VertexCacheStats stats;
+		stats.triangles = indexCount / 3;
+
+		std::vector<bool> isUsed(vertexCount, false);
+		FifoCache cache(vertexCount, kFifoCacheSize);
+		for (size_t i(0); i < indexCount; ++i)
+		{
+			stats.misses += cache.Access(indices[i]) ? 1 : 0;
+			if (!isUsed[indices[i]])
+			{
+				isUsed[indices[i]] = true;
+				++stats.vertices;
+			}
+		}
+
+		return stats;
+	}
+
+	VertexFetchStats AnalyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize)
+	{
+		VertexFetchStats stats;
+
+		std::vector<bool> isUsed(vertexCount, false);
+		FifoCache cache((vertexCount * vertexSize + kCacheLineSize - 1) / kCacheLineSize, kFetchCacheLines);
+		for (size_t i(0); i < indexCount; ++i)
+		{
+			const uint32_t index = indices[i];
+			if (!isUsed[index])
+			{
+				isUsed[index] = true;
+				stats.bytesUsed += vertexSize;
+			}
+
+			const size_t firstLine = index * vertexSize / kCacheLineSize;
+			const size_t lastLine = ((index + 1) * vertexSize - 1) / kCacheLineSize;
+			for (size_t line(firstLine); line <= lastLine; ++line)
+			{
+				stats.bytesFetched += cache.Access(uint32_t(line)) ? kCacheLineSize : 0;
+			}
+		}
+
+		return stats;
+	}
+}
\ No newline at end of file
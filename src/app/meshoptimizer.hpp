@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "../vulkan/vkcommon.hpp"
+
+
+// Import time reordering of triangles and vertices, all functions keep the mesh visually identical.
+namespace meshopt
+{
+	struct VertexCacheStats
+	{
+		size_t triangles{ 0 };
+		size_t vertices{ 0 };			// unique vertices referenced
+		size_t misses{ 0 };
+
+		float Acmr() const { return triangles > 0 ? float(misses) / float(triangles) : 0.0f; }
+		float Atvr() const { return vertices > 0 ? float(misses) / float(vertices) : 0.0f; }
+
+		VertexCacheStats& operator+=(const VertexCacheStats& stats);
+	};
+
+	struct VertexFetchStats
+	{
+		size_t bytesFetched{ 0 };
+		size_t bytesUsed{ 0 };
+
+		float Overfetch() const { return bytesUsed > 0 ? float(bytesFetched) / float(bytesUsed) : 0.0f; }
+
+		VertexFetchStats& operator+=(const VertexFetchStats& stats);
+	};
+
+	// Forsyth's linear speed triangle order for the post-transform cache
+	void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	// Splits the cache optimized list into clusters at cache restarts and sorts them front to back
+	// from an average outside view. The result is dropped if ACMR grows by more than threshold.
+	void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices, float threshold);
+
+	// Vertices are laid out in order of first use, unreferenced vertices are removed.
+	void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	constexpr uint32_t kMeshletMaxVertices = 64;
+	constexpr uint32_t kMeshletMaxTriangles = 124;
+
+	// triangles are 3 local vertex indices packed as bytes, center/radius bound the cluster and
+	// the cone rejects it when dot(center - camera, coneAxis) >= coneCutoff * |center - camera| + radius
+	struct Meshlet
+	{
+		float center[3];
+		float radius;
+		float coneAxis[3];
+		float coneCutoff;
+		uint32_t vertexOffset;
+		uint32_t triangleOffset;
+		uint32_t vertexCount;
+		uint32_t triangleCount;
+	};
+
+	// Splits the triangle list in order into meshlets, appends to the output arrays.
+	void BuildMeshlets(const uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices,
+		std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint32_t>& meshletTriangles);
+
+	VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount);
+	VertexFetchStats AnalyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize);
+}
\ No newline at end of file
@@ -0,0 +1,486 @@
+#include "meshsimplifier.hpp"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+	constexpr double kBorderWeight = 10.0;
+
+	struct PositionHasher
+	{
+		size_t operator()(const Vertex* vertex) const
+		{
+			uint32_t bits[3];
+			::memcpy(bits, &vertex->px, sizeof(bits));
+			return size_t((bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u));
+		}
+	};
+
+	struct PositionEqual
+	{
+		bool operator()(const Vertex* a, const Vertex* b) const
+		{
+			return a->px == b->px && a->py == b->py && a->pz == b->pz;
+		}
+	};
+
+	inline uint64_t EdgeKey(uint32_t a, uint32_t b)
+	{
+		return (uint64_t(a) << 32) | uint64_t(b);
+	}
+
+	inline void Normal(const Vertex& a, const Vertex& b, const Vertex& c, double n[3])
+	{
+		const double e0[3] = { b.px - a.px, b.py - a.py, b.pz - a.pz };
+		const double e1[3] = { c.px - a.px, c.py - a.py, c.pz - a.pz };
+		n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+		n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+		n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+	}
+}
+
+
+void MeshSimplifier::Quadric::AddPlane(double a, double b, double c, double d, double w)
+{
+	a2 += a * a * w;
+	b2 += b * b * w;
+	c2 += c * c * w;
+	ab += a * b * w;
+	ac += a * c * w;
+	bc += b * c * w;
+	ad += a * d * w;
+	bd += b * d * w;
+	cd += c * d * w;
+	d2 += d * d * w;
+}
+
+void MeshSimplifier::Quadric::Add(const Quadric& quadric)
+{
+	a2 += quadric.a2;
+	b2 += quadric.b2;
+	c2 += quadric.c2;
+	ab += quadric.ab;
+	ac += quadric.ac;
+	bc += quadric.bc;
+	ad += quadric.ad;
+	bd += quadric.bd;
+	cd += quadric.cd;
+	d2 += quadric.d2;
+	weight += quadric.weight;
+}
+
+double MeshSimplifier::Quadric::Error(const Vertex& vertex) const
+{
+	const double x = vertex.px;
+	const double y = vertex.py;
+	const double z = vertex.pz;
+
+	const double rx = a2 * x + ab * y + ac * z + ad;
+	const double ry = ab * x + b2 * y + bc * z + bd;
+	const double rz = ac * x + bc * y + c2 * z + cd;
+
+	const double error = rx * x + ry * y + rz * z + ad * x + bd * y + cd * z + d2;
+	return error > 0 ? error : 0;
+}
+
+
+
+MeshSimplifier::MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+	: m_vertices(vertices)
+	, m_indices(indices)
+{
+	BuildWedges();
+	ClassifyVertices();
+	BuildQuadrics();
+}
+
+void MeshSimplifier::BuildWedges()
+{
+	m_wedge.resize(m_vertices.size());
+	m_kinds.assign(m_vertices.size(), EVertexKind::Manifold);
+
+	std::unordered_map<const Vertex*, uint32_t, PositionHasher, PositionEqual> positions;
+	positions.reserve(m_vertices.size());
+
+	std::vector<uint32_t> wedgeCount(m_vertices.size(), 0);
+	for (uint32_t i(0); i < m_vertices.size(); ++i)
+	{
+		const auto inserted = positions.insert({ &m_vertices[i], i });
+		m_wedge[i] = inserted.first->second;
+		++wedgeCount[m_wedge[i]];
+	}
+
+	// attribute seams are never collapsed
+	for (uint32_t i(0); i < m_vertices.size(); ++i)
+	{
+		if (wedgeCount[m_wedge[i]] > 1)
+		{
+			m_kinds[i] = EVertexKind::Locked;
+		}
+	}
+}
+
+void MeshSimplifier::ClassifyVertices()
+{
+	std::unordered_map<uint64_t, uint32_t> edges;
+	edges.reserve(m_indices.size());
+	for (size_t i(0); i < m_indices.size(); i += 3)
+	{
+		for (uint32_t e(0); e < 3; ++e)
+		{
+			const uint32_t a = m_wedge[m_indices[i + e]];
+			const uint32_t b = m_wedge[m_indices[i + (e + 1) % 3]];
+			++edges[EdgeKey(a, b)];
+		}
+	}
+
+	m_borderNext.assign(m_vertices.size(), UINT32_MAX);
+	m_borderPrev.assign(m_vertices.size(), UINT32_MAX);
+
+	std::vector<uint32_t> borderEdges(m_vertices.size(), 0);
+	std::vector<bool> isComplex(m_vertices.size(), false);
+	for (const auto& edge : edges)
+	{
+		const uint32_t a = uint32_t(edge.first >> 32);
+		const uint32_t b = uint32_t(edge.first & 0xFFFFFFFF);
+
+		if (edge.second > 1)
+		{
+			isComplex[a] = true;
+			isComplex[b] = true;
+		}
+
+		if (edges.find(EdgeKey(b, a)) == edges.end())
+		{
+			++borderEdges[a];
+			++borderEdges[b];
+			m_borderNext[a] = b;
+			m_borderPrev[b] = a;
+		}
+	}
+
+	for (uint32_t i(0); i < m_vertices.size(); ++i)
+	{
+		const uint32_t position = m_wedge[i];
+		if (m_kinds[i] == EVertexKind::Locked)
+		{
+			continue;
+		}
+
+		if (isComplex[position] || (borderEdges[position] != 0 && borderEdges[position] != 2))
+		{
+			m_kinds[i] = EVertexKind::Locked;
+		}
+		else if (borderEdges[position] == 2)
+		{
+			m_kinds[i] = EVertexKind::Border;
+		}
+	}
+}
+
+void MeshSimplifier::BuildQuadrics()
+{
+	m_quadrics.assign(m_vertices.size(), Quadric());
+
+	for (size_t i(0); i < m_indices.size(); i += 3)
+	{
+		const uint32_t p[3] = { m_wedge[m_indices[i + 0]], m_wedge[m_indices[i + 1]], m_wedge[m_indices[i + 2]] };
+		const Vertex& v0 = m_vertices[p[0]];
+		const Vertex& v1 = m_vertices[p[1]];
+		const Vertex& v2 = m_vertices[p[2]];
+
+		double n[3];
+		Normal(v0, v1, v2, n);
+		const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length <= 0)
+		{
+			continue;
+		}
+
+		n[0] /= length;
+		n[1] /= length;
+		n[2] /= length;
+
+		const double area = length * 0.5;
+		const double d = -(n[0] * v0.px + n[1] * v0.py + n[2] * v0.pz);
+		for (uint32_t k(0); k < 3; ++k)
+		{
+			m_quadrics[p[k]].AddPlane(n[0], n[1], n[2], d, area);
+			m_quadrics[p[k]].weight += area;
+		}
+
+		// keep borders in place with a plane perpendicular to the triangle
+		for (uint32_t e(0); e < 3; ++e)
+		{
+			const uint32_t a = p[e];
+			const uint32_t b = p[(e + 1) % 3];
+			if (m_borderNext[a] != b)
+			{
+				continue;
+			}
+
+			const Vertex& va = m_vertices[a];
+			const Vertex& vb = m_vertices[b];
+			const double edge[3] = { vb.px - va.px, vb.py - va.py, vb.pz - va.pz };
+			const double edgeLength2 = edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2];
+
+			double m[3] = {
+				edge[1] * n[2] - edge[2] * n[1],
+				edge[2] * n[0] - edge[0] * n[2],
+				edge[0] * n[1] - edge[1] * n[0]
+			};
+			const double mLength = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+			if (mLength <= 0)
+			{
+				continue;
+			}
+
+			m[0] /= mLength;
+			m[1] /= mLength;
+			m[2] /= mLength;
+
+			const double md = -(m[0] * va.px + m[1] * va.py + m[2] * va.pz);
+			m_quadrics[a].AddPlane(m[0], m[1], m[2], md, edgeLength2 * kBorderWeight);
+			m_quadrics[b].AddPlane(m[0], m[1], m[2], md, edgeLength2 * kBorderWeight);
+		}
+	}
+}
+
+bool MeshSimplifier::HasFlips(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& triangles, uint32_t v0, uint32_t v1) const
+{
+	const Vertex& target = m_vertices[v1];
+	for (uint32_t triangle : triangles)
+	{
+		const uint32_t* tri = &indices[triangle * 3];
+		if (m_wedge[tri[0]] == m_wedge[v1] || m_wedge[tri[1]] == m_wedge[v1] || m_wedge[tri[2]] == m_wedge[v1])
+		{
+			// this one degenerates
+			continue;
+		}
+
+		const Vertex* before[3] = { &m_vertices[tri[0]], &m_vertices[tri[1]], &m_vertices[tri[2]] };
+		const Vertex* after[3] = { before[0], before[1], before[2] };
+		for (uint32_t k(0); k < 3; ++k)
+		{
+			if (tri[k] == v0)
+			{
+				after[k] = &target;
+			}
+		}
+
+		double n0[3], n1[3];
+		Normal(*before[0], *before[1], *before[2], n0);
+		Normal(*after[0], *after[1], *after[2], n1);
+		if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+float MeshSimplifier::Simplify(size_t targetIndexCount, float maxError, std::vector<uint32_t>& result) const
+{
+	struct Collapse
+	{
+		uint32_t v0;
+		uint32_t v1;
+		double error;
+	};
+
+	result = m_indices;
+	std::vector<Quadric> quadrics = m_quadrics;
+	std::vector<uint32_t> borderNext = m_borderNext;
+	std::vector<uint32_t> borderPrev = m_borderPrev;
+	double resultError = 0;
+
+	const auto isBorderEdge = [&](uint32_t v0, uint32_t v1) {
+		const uint32_t a = m_wedge[v0];
+		const uint32_t b = m_wedge[v1];
+		return borderNext[a] == b || borderPrev[a] == b;
+	};
+
+	std::vector<uint32_t> remap(m_vertices.size());
+	std::vector<bool> touched(m_vertices.size());
+	std::vector<uint32_t> triangleOffsets(m_vertices.size() + 1);
+	std::vector<uint32_t> vertexTriangles;
+	std::vector<uint64_t> edges;
+	std::vector<Collapse> collapses;
+
+	while (result.size() > targetIndexCount)
+	{
+		const size_t triangleCount = result.size() / 3;
+
+		// vertex -> triangles adjacency
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (uint32_t index : result)
+		{
+			++triangleOffsets[index + 1];
+		}
+		for (size_t i(1); i < triangleOffsets.size(); ++i)
+		{
+			triangleOffsets[i] += triangleOffsets[i - 1];
+		}
+		vertexTriangles.resize(result.size());
+		{
+			std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (size_t i(0); i < result.size(); ++i)
+			{
+				vertexTriangles[fill[result[i]]++] = uint32_t(i / 3);
+			}
+		}
+
+		// unique edges
+		edges.clear();
+		edges.reserve(result.size());
+		for (size_t i(0); i < result.size(); i += 3)
+		{
+			for (uint32_t e(0); e < 3; ++e)
+			{
+				const uint32_t a = result[i + e];
+				const uint32_t b = result[i + (e + 1) % 3];
+				edges.push_back(EdgeKey(std::min(a, b), std::max(a, b)));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		// cheapest allowed direction for every edge
+		collapses.clear();
+		for (uint64_t edge : edges)
+		{
+			const uint32_t a = uint32_t(edge >> 32);
+			const uint32_t b = uint32_t(edge & 0xFFFFFFFF);
+
+			Collapse best = { UINT32_MAX, UINT32_MAX, DBL_MAX };
+			for (uint32_t dir(0); dir < 2; ++dir)
+			{
+				const uint32_t v0 = dir == 0 ? a : b;
+				const uint32_t v1 = dir == 0 ? b : a;
+
+				const EVertexKind kind = m_kinds[v0];
+				if (kind == EVertexKind::Locked || (kind == EVertexKind::Border && !isBorderEdge(v0, v1)))
+				{
+					continue;
+				}
+
+				Quadric quadric = quadrics[m_wedge[v0]];
+				quadric.Add(quadrics[m_wedge[v1]]);
+				const double error = quadric.weight > 0 ? std::sqrt(quadric.Error(m_vertices[v1]) / quadric.weight) : 0;
+				if (error < best.error)
+				{
+					best = { v0, v1, error };
+				}
+			}
+
+			if (best.v0 != UINT32_MAX)
+			{
+				collapses.push_back(best);
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+			return a.error < b.error;
+		});
+
+		for (uint32_t i(0); i < remap.size(); ++i)
+		{
+			remap[i] = i;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+
+		// a manifold collapse removes two triangles
+		const size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removed = 0;
+		size_t collapsed = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.error > maxError || removed >= trianglesToRemove)
+			{
+				break;
+			}
+
+			if (touched[m_wedge[collapse.v0]] || touched[m_wedge[collapse.v1]])
+			{
+				continue;
+			}
+
+			const std::vector<uint32_t> triangles(
+				vertexTriangles.begin() + triangleOffsets[collapse.v0],
+				vertexTriangles.begin() + triangleOffsets[collapse.v0 + 1]
+			);
+			if (HasFlips(result, triangles, collapse.v0, collapse.v1))
+			{
+				continue;
+			}
+
+			const uint32_t p0 = m_wedge[collapse.v0];
+			const uint32_t p1 = m_wedge[collapse.v1];
+			remap[collapse.v0] = collapse.v1;
+			quadrics[p1].Add(quadrics[p0]);
+
+			// stitch the border loop around the removed vertex
+			if (m_kinds[collapse.v0] == EVertexKind::Border)
+			{
+				if (borderNext[p0] == p1)
+				{
+					borderPrev[p1] = borderPrev[p0];
+					if (borderPrev[p0] != UINT32_MAX)
+					{
+						borderNext[borderPrev[p0]] = p1;
+					}
+				}
+				else
+				{
+					borderNext[p1] = borderNext[p0];
+					if (borderNext[p0] != UINT32_MAX)
+					{
+						borderPrev[borderNext[p0]] = p1;
+					}
+				}
+			}
+			resultError = std::max(resultError, collapse.error);
+
+			// neighbours stay still for the rest of the pass so flip tests remain valid
+			for (uint32_t triangle : triangles)
+			{
+				for (uint32_t k(0); k < 3; ++k)
+				{
+					touched[m_wedge[result[triangle * 3 + k]]] = true;
+				}
+			}
+
+			removed += m_kinds[collapse.v0] == EVertexKind::Border ? 1 : 2;
+			++collapsed;
+		}
+
+		if (collapsed == 0)
+		{
+			break;
+		}
+
+		size_t writeIndex = 0;
+		for (size_t i(0); i < triangleCount; ++i)
+		{
+			const uint32_t a = remap[result[i * 3 + 0]];
+			const uint32_t b = remap[result[i * 3 + 1]];
+			const uint32_t c = remap[result[i * 3 + 2]];
+			if (m_wedge[a] == m_wedge[b] || m_wedge[b] == m_wedge[c] || m_wedge[a] == m_wedge[c])
+			{
+				continue;
+			}
+
+			result[writeIndex++] = a;
+			result[writeIndex++] = b;
+			result[writeIndex++] = c;
+		}
+		result.resize(writeIndex);
+	}
+
+	return float(resultError);
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <cstdint>
+#include "../vulkan/vkcommon.hpp"
+
+
+// Quadric error edge collapse simplifier.
+// Collapses keep the position of an existing vertex, so the vertex buffer stays untouched
+// and only a new index buffer is produced. Attribute seams are locked and border vertices
+// can only slide along the border.
+class MeshSimplifier
+{
+public:
+	MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+	// returns object space error of the result
+	float Simplify(size_t targetIndexCount, float maxError, std::vector<uint32_t>& result) const;
+
+private:
+	enum class EVertexKind : uint8_t
+	{
+		Manifold,
+		Border,
+		Locked
+	};
+
+	struct Quadric
+	{
+		double a2{ 0 }, b2{ 0 }, c2{ 0 };
+		double ab{ 0 }, ac{ 0 }, bc{ 0 };
+		double ad{ 0 }, bd{ 0 }, cd{ 0 };
+		double d2{ 0 };
+		double weight{ 0 };
+
+		void AddPlane(double a, double b, double c, double d, double w);
+		void Add(const Quadric& quadric);
+		double Error(const Vertex& vertex) const;
+	};
+
+	void BuildWedges();
+	void ClassifyVertices();
+	void BuildQuadrics();
+
+	bool HasFlips(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& triangles, uint32_t v0, uint32_t v1) const;
+
+private:
+	const std::vector<Vertex>& m_vertices;
+	const std::vector<uint32_t>& m_indices;
+
+	std::vector<uint32_t> m_wedge;				// vertex -> first vertex with the same position
+	std::vector<EVertexKind> m_kinds;
+	std::vector<uint32_t> m_borderNext;			// position -> next position along the border
+	std::vector<uint32_t> m_borderPrev;
+	std::vector<Quadric> m_quadrics;			// per position
+};
\ No newline at end of file
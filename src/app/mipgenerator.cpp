@@ -0,0 +1,131 @@
+#include "mipgenerator.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+
+namespace
+{
+	struct Taps
+	{
+		uint32_t index[3];
+		float weight[3];
+		uint32_t count;
+	};
+
+	// polyphase box filter along one axis
+	std::vector<Taps> BuildTaps(uint32_t size)
+	{
+		const uint32_t mipSize = std::max(size >> 1, 1u);
+		std::vector<Taps> taps(mipSize);
+		for (uint32_t i(0); i < mipSize; ++i)
+		{
+			Taps& tap = taps[i];
+			if (size == 1)
+			{
+				tap = { { 0, 0, 0 }, { 1.0f, 0, 0 }, 1 };
+			}
+			else if ((size & 1) == 0)
+			{
+				tap = { { i * 2, i * 2 + 1, 0 }, { 0.5f, 0.5f, 0 }, 2 };
+			}
+			else
+			{
+				const float scale = 1.0f / float(size);
+				tap = { { i * 2, i * 2 + 1, i * 2 + 2 }, { float(mipSize - i) * scale, float(mipSize) * scale, float(i + 1) * scale }, 3 };
+			}
+		}
+		return taps;
+	}
+
+	inline float SrgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	inline float LinearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	}
+
+	inline uint8_t ToUnorm8(float value)
+	{
+		return uint8_t(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+	}
+}
+
+void mipgen::Downsample(const uint8_t* pSource, uint32_t width, uint32_t height, EFilter filter, std::vector<uint8_t>& mip)
+{
+	static const std::array<float, 256> srgbToLinear = []() {
+		std::array<float, 256> table;
+		for (uint32_t i(0); i < 256; ++i)
+		{
+			table[i] = SrgbToLinear(float(i) / 255.0f);
+		}
+		return table;
+	}();
+
+	const std::vector<Taps> tapsX = BuildTaps(width);
+	const std::vector<Taps> tapsY = BuildTaps(height);
+	const uint32_t mipWidth = uint32_t(tapsX.size());
+	const uint32_t mipHeight = uint32_t(tapsY.size());
+	mip.resize(size_t(mipWidth) * mipHeight * 4);
+
+	for (uint32_t y(0); y < mipHeight; ++y)
+	{
+		const Taps& tapY = tapsY[y];
+		for (uint32_t x(0); x < mipWidth; ++x)
+		{
+			const Taps& tapX = tapsX[x];
+
+			float sum[4] = {};
+			for (uint32_t ty(0); ty < tapY.count; ++ty)
+			{
+				const uint8_t* row = pSource + size_t(tapY.index[ty]) * width * 4;
+				for (uint32_t tx(0); tx < tapX.count; ++tx)
+				{
+					const uint8_t* texel = row + size_t(tapX.index[tx]) * 4;
+					const float weight = tapX.weight[tx] * tapY.weight[ty];
+					for (uint32_t c(0); c < 3; ++c)
+					{
+						const float value = filter == EFilter::Srgb ? srgbToLinear[texel[c]]
+							: filter == EFilter::Normal ? float(texel[c]) / 255.0f * 2.0f - 1.0f
+							: float(texel[c]) / 255.0f;
+						sum[c] += value * weight;
+					}
+					sum[3] += float(texel[3]) / 255.0f * weight;
+				}
+			}
+
+			uint8_t* texel = mip.data() + (size_t(y) * mipWidth + x) * 4;
+			if (filter == EFilter::Srgb)
+			{
+				for (uint32_t c(0); c < 3; ++c)
+				{
+					sum[c] = LinearToSrgb(sum[c]);
+				}
+			}
+			else if (filter == EFilter::Normal)
+			{
+				// opposite normals cancel out, those texels face straight up
+				float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+				if (length < 0.01f)
+				{
+					sum[0] = 0;
+					sum[1] = 0;
+					sum[2] = 1;
+					length = 1;
+				}
+				for (uint32_t c(0); c < 3; ++c)
+				{
+					sum[c] = sum[c] / length * 0.5f + 0.5f;
+				}
+			}
+
+			for (uint32_t c(0); c < 4; ++c)
+			{
+				texel[c] = ToUnorm8(sum[c]);
+			}
+		}
+	}
+}
\ No newline at end of file
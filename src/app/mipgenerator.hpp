@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+
+// Cook time mip chains of RGBA8 images, every level halves both sizes rounding down to at least 1.
+namespace mipgen
+{
+	enum class EFilter
+	{
+		Linear,
+		Srgb,		// color is averaged in linear space, alpha as is
+		Normal		// xyz are unit vectors, renormalized after averaging
+	};
+
+	// odd sizes are filtered with 3 weighted taps, so every source texel contributes equally
+	void Downsample(const uint8_t* pSource, uint32_t width, uint32_t height, EFilter filter, std::vector<uint8_t>& mip);
+}
\ No newline at end of file
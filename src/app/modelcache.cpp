@@ -0,0 +1,415 @@
+#include "modelcache.hpp"
+#include "mappedfile.hpp"
+#include <fstream>
+#include <cstring>
+#include <cassert>
+
+
+namespace
+{
+	constexpr uint32_t kMagic = 0x4c444d41;		// "AMDL"
+	constexpr uint32_t kTextureMagic = 0x58455441;	// "ATEX"
+	constexpr size_t kArrayAlignment = 16;		// arrays can be used in place from the mapping
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t vertexFormat;
+		uint32_t meshCount;
+		uint32_t instanceCount;
+		uint32_t materialCount;
+		float positionScale[3];
+		float positionOffset[3];
+	};
+
+	struct MeshHeader
+	{
+		uint32_t materialId;
+		uint32_t indexType;
+		uint32_t lodCount;
+		uint32_t meshletCount;
+		uint32_t meshletVertexCount;
+		uint32_t meshletTriangleCount;
+		uint32_t positionBytes;
+		uint32_t attributeBytes;
+		uint32_t indexBytes;
+		float aabbMin[3];
+		float aabbMax[3];
+	};
+
+	struct MaterialHeader
+	{
+		uint32_t materialId;
+		uint32_t diffusePathLength;
+		uint32_t normalPathLength;
+	};
+
+	struct TextureHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipCount;
+		uint64_t dataBytes;
+	};
+
+	class CacheWriter
+	{
+	public:
+		explicit CacheWriter(const std::filesystem::path& path) : m_file(path, std::ios::binary | std::ios::trunc) {}
+
+		inline bool IsGood() const { return m_file.good(); }
+
+		void Write(const void* pData, size_t size)
+		{
+			m_file.write(static_cast<const char*>(pData), std::streamsize(size));
+			m_offset += size;
+		}
+
+		template<class T>
+		void Write(const T& value)
+		{
+			Write(&value, sizeof(T));
+		}
+
+		void WriteArray(const void* pData, size_t size)
+		{
+			static const uint8_t padding[kArrayAlignment]{};
+			Write(padding, (kArrayAlignment - m_offset % kArrayAlignment) % kArrayAlignment);
+			Write(pData, size);
+		}
+
+		template<class T>
+		void WriteArray(const std::vector<T>& values)
+		{
+			WriteArray(values.data(), values.size() * sizeof(T));
+		}
+
+	private:
+		std::ofstream m_file;
+		size_t m_offset{ 0 };
+	};
+
+	class CacheReader
+	{
+	public:
+		CacheReader(const uint8_t* pData, size_t size) : m_pData(pData), m_size(size) {}
+
+		bool Read(void* pData, size_t size)
+		{
+			if (m_size - m_offset < size)
+			{
+				return false;
+			}
+
+			::memcpy(pData, m_pData + m_offset, size);
+			m_offset += size;
+			return true;
+		}
+
+		template<class T>
+		bool Read(T& value)
+		{
+			return Read(&value, sizeof(T));
+		}
+
+		template<class T>
+		bool ReadArray(std::vector<T>& values, size_t count)
+		{
+			const size_t padding = (kArrayAlignment - m_offset % kArrayAlignment) % kArrayAlignment;
+			if (m_size - m_offset < padding)
+			{
+				return false;
+			}
+			m_offset += padding;
+
+			// a corrupt count is a cache miss, not an allocation
+			if (count > (m_size - m_offset) / sizeof(T))
+			{
+				return false;
+			}
+
+			values.resize(count);
+			return Read(values.data(), count * sizeof(T));
+		}
+
+		// the array stays in the mapping, nullptr when it does not fit
+		const uint8_t* MapArray(size_t size)
+		{
+			const size_t padding = (kArrayAlignment - m_offset % kArrayAlignment) % kArrayAlignment;
+			if (m_size - m_offset < padding || m_size - m_offset - padding < size)
+			{
+				return nullptr;
+			}
+
+			const uint8_t* pArray = m_pData + m_offset + padding;
+			m_offset += padding + size;
+			return pArray;
+		}
+
+		bool MapStream(MeshStream& stream, size_t size)
+		{
+			stream.pMapped = MapArray(size);
+			stream.mappedSize = size;
+			return stream.pMapped != nullptr;
+		}
+
+		bool ReadString(std::string& value, size_t length)
+		{
+			if (length > m_size - m_offset)
+			{
+				return false;
+			}
+
+			value.resize(length);
+			return Read(value.data(), length);
+		}
+
+	private:
+		const uint8_t* m_pData;
+		size_t m_size;
+		size_t m_offset{ 0 };
+	};
+}
+
+namespace modelcache
+{
+	// FNV-1a over 8 byte words, only used to detect a changed source
+	uint64_t HashFile(const std::filesystem::path& path)
+	{
+		MappedFile file;
+		if (!file.Open(path))
+		{
+			return 0;
+		}
+
+		constexpr uint64_t kPrime = 0x100000001b3ull;
+		uint64_t hash = 0xcbf29ce484222325ull ^ uint64_t(file.size());
+
+		const size_t wordCount = file.size() / sizeof(uint64_t);
+		for (size_t i(0); i < wordCount; ++i)
+		{
+			uint64_t word;
+			::memcpy(&word, file.data() + i * sizeof(uint64_t), sizeof(word));
+			hash = (hash ^ word) * kPrime;
+		}
+		for (size_t i(wordCount * sizeof(uint64_t)); i < file.size(); ++i)
+		{
+			hash = (hash ^ file.data()[i]) * kPrime;
+		}
+
+		return hash;
+	}
+
+	bool Read(const std::filesystem::path& path, uint64_t sourceHash, EVertexFormat vertexFormat, Model& model)
+	{
+		auto file = std::make_shared<MappedFile>();
+		if (!file->Open(path))
+		{
+			return false;
+		}
+
+		CacheReader reader(file->data(), file->size());
+
+		FileHeader header;
+		if (!reader.Read(header)
+			|| header.magic != kMagic
+			|| header.version != kVersion
+			|| header.sourceHash != sourceHash
+			|| header.vertexFormat != uint32_t(vertexFormat)
+			|| header.meshCount > file->size() / sizeof(MeshHeader))
+		{
+			return false;
+		}
+
+		Model cached;
+		cached.vertexFormat = vertexFormat;
+		cached.positionScale = math::vec3(header.positionScale[0], header.positionScale[1], header.positionScale[2]);
+		cached.positionOffset = math::vec3(header.positionOffset[0], header.positionOffset[1], header.positionOffset[2]);
+
+		cached.meshes.resize(header.meshCount);
+		for (Mesh& mesh : cached.meshes)
+		{
+			MeshHeader meshHeader;
+			if (!reader.Read(meshHeader) || meshHeader.lodCount == 0 || meshHeader.lodCount > Mesh::kMaxLods)
+			{
+				return false;
+			}
+
+			mesh.materialId = meshHeader.materialId;
+			mesh.indexType = EIndexType(meshHeader.indexType);
+			mesh.aabbMin = math::vec3(meshHeader.aabbMin[0], meshHeader.aabbMin[1], meshHeader.aabbMin[2]);
+			mesh.aabbMax = math::vec3(meshHeader.aabbMax[0], meshHeader.aabbMax[1], meshHeader.aabbMax[2]);
+
+			// the small per mesh arrays are copied, the streams are uploaded straight from the mapping
+			if (!reader.ReadArray(mesh.lods, meshHeader.lodCount)
+				|| !reader.ReadArray(mesh.meshlets, meshHeader.meshletCount)
+				|| !reader.ReadArray(mesh.meshletVertices, meshHeader.meshletVertexCount)
+				|| !reader.ReadArray(mesh.meshletTriangles, meshHeader.meshletTriangleCount)
+				|| !reader.MapStream(mesh.positionStream, meshHeader.positionBytes)
+				|| !reader.MapStream(mesh.attributeStream, meshHeader.attributeBytes)
+				|| !reader.MapStream(mesh.indexStream, meshHeader.indexBytes))
+			{
+				return false;
+			}
+			mesh.file = file;
+		}
+
+		if (!reader.ReadArray(cached.instances, header.instanceCount))
+		{
+			return false;
+		}
+
+		for (uint32_t i(0); i < header.materialCount; ++i)
+		{
+			MaterialHeader materialHeader;
+			if (!reader.Read(materialHeader))
+			{
+				return false;
+			}
+
+			Material& material = cached.materials[materialHeader.materialId];
+			if (!reader.ReadString(material.diffusePath, materialHeader.diffusePathLength)
+				|| !reader.ReadString(material.normalPath, materialHeader.normalPathLength))
+			{
+				return false;
+			}
+		}
+
+		model = std::move(cached);
+		return true;
+	}
+
+	bool Write(const std::filesystem::path& path, uint64_t sourceHash, const Model& model)
+	{
+		CacheWriter writer(path);
+
+		FileHeader header{};
+		header.magic = kMagic;
+		header.version = kVersion;
+		header.sourceHash = sourceHash;
+		header.vertexFormat = uint32_t(model.vertexFormat);
+		header.meshCount = uint32_t(model.meshes.size());
+		header.instanceCount = uint32_t(model.instances.size());
+		header.materialCount = uint32_t(model.materials.size());
+		header.positionScale[0] = model.positionScale.x;
+		header.positionScale[1] = model.positionScale.y;
+		header.positionScale[2] = model.positionScale.z;
+		header.positionOffset[0] = model.positionOffset.x;
+		header.positionOffset[1] = model.positionOffset.y;
+		header.positionOffset[2] = model.positionOffset.z;
+		writer.Write(header);
+
+		for (const Mesh& mesh : model.meshes)
+		{
+			MeshHeader meshHeader{};
+			meshHeader.materialId = mesh.materialId;
+			meshHeader.indexType = uint32_t(mesh.indexType);
+			meshHeader.lodCount = uint32_t(mesh.lods.size());
+			meshHeader.meshletCount = uint32_t(mesh.meshlets.size());
+			meshHeader.meshletVertexCount = uint32_t(mesh.meshletVertices.size());
+			meshHeader.meshletTriangleCount = uint32_t(mesh.meshletTriangles.size());
+			meshHeader.positionBytes = uint32_t(mesh.positionStream.Size());
+			meshHeader.attributeBytes = uint32_t(mesh.attributeStream.Size());
+			meshHeader.indexBytes = uint32_t(mesh.indexStream.Size());
+			meshHeader.aabbMin[0] = mesh.aabbMin.x;
+			meshHeader.aabbMin[1] = mesh.aabbMin.y;
+			meshHeader.aabbMin[2] = mesh.aabbMin.z;
+			meshHeader.aabbMax[0] = mesh.aabbMax.x;
+			meshHeader.aabbMax[1] = mesh.aabbMax.y;
+			meshHeader.aabbMax[2] = mesh.aabbMax.z;
+			writer.Write(meshHeader);
+
+			writer.WriteArray(mesh.lods);
+			writer.WriteArray(mesh.meshlets);
+			writer.WriteArray(mesh.meshletVertices);
+			writer.WriteArray(mesh.meshletTriangles);
+			writer.WriteArray(mesh.positionStream.Data(), mesh.positionStream.Size());
+			writer.WriteArray(mesh.attributeStream.Data(), mesh.attributeStream.Size());
+			writer.WriteArray(mesh.indexStream.Data(), mesh.indexStream.Size());
+		}
+
+		writer.WriteArray(model.instances);
+
+		for (const auto& [materialId, material] : model.materials)
+		{
+			MaterialHeader materialHeader{};
+			materialHeader.materialId = materialId;
+			materialHeader.diffusePathLength = uint32_t(material.diffusePath.size());
+			materialHeader.normalPathLength = uint32_t(material.normalPath.size());
+			writer.Write(materialHeader);
+			writer.Write(material.diffusePath.data(), material.diffusePath.size());
+			writer.Write(material.normalPath.data(), material.normalPath.size());
+		}
+
+		return writer.IsGood();
+	}
+
+	bool ReadTexture(const std::filesystem::path& path, uint64_t sourceHash, EPixelFormat format, uint32_t firstMip, CookedTexture& texture)
+	{
+		auto file = std::make_shared<MappedFile>();
+		if (!file->Open(path))
+		{
+			return false;
+		}
+
+		CacheReader reader(file->data(), file->size());
+
+		TextureHeader header;
+		if (!reader.Read(header)
+			|| header.magic != kTextureMagic
+			|| header.version != kTextureVersion
+			|| header.sourceHash != sourceHash
+			|| header.format != uint32_t(format)
+			|| firstMip >= header.mipCount)
+		{
+			return false;
+		}
+
+		CookedTexture cached;
+		cached.width = header.width;
+		cached.height = header.height;
+		cached.mipCount = header.mipCount;
+		cached.format = format;
+		const uint8_t* pData = reader.MapArray(size_t(header.dataBytes));
+		if (!pData || header.dataBytes != cached.MipOffset(cached.mipCount))
+		{
+			return false;
+		}
+
+		for (uint32_t i(0); i < cached.mipCount; ++i)
+		{
+			cached.mappedMips.push_back(pData + cached.MipOffset(i));
+		}
+		cached.file = std::move(file);
+		cached.firstMip = firstMip;
+
+		texture = std::move(cached);
+		return true;
+	}
+
+	bool WriteTexture(const std::filesystem::path& path, uint64_t sourceHash, const CookedTexture& texture)
+	{
+		CacheWriter writer(path);
+
+		TextureHeader header{};
+		header.magic = kTextureMagic;
+		header.version = kTextureVersion;
+		header.sourceHash = sourceHash;
+		header.format = uint32_t(texture.format);
+		header.width = texture.width;
+		header.height = texture.height;
+		header.mipCount = texture.mipCount;
+		assert(texture.firstMip == 0 && !texture.file);
+		header.dataBytes = texture.data.size();
+		writer.Write(header);
+		writer.WriteArray(texture.data);
+
+		return writer.IsGood();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include "modelloader.hpp"
+
+
+// Cooked models are written after the first import and mapped on later runs.
+// A cache is only used for the source hash, vertex format and version it was written with.
+// Textures are cooked to their own file next to the image, shared by every model using it.
+namespace modelcache
+{
+	constexpr uint32_t kVersion = 1;
+	constexpr uint32_t kTextureVersion = 2;
+
+	uint64_t HashFile(const std::filesystem::path& path);
+
+	bool Read(const std::filesystem::path& path, uint64_t sourceHash, EVertexFormat vertexFormat, Model& model);
+	bool Write(const std::filesystem::path& path, uint64_t sourceHash, const Model& model);
+
+	// the levels stay in the mapped file, only the ones from firstMip on are touched
+	bool ReadTexture(const std::filesystem::path& path, uint64_t sourceHash, EPixelFormat format, uint32_t firstMip, CookedTexture& texture);
+	bool WriteTexture(const std::filesystem::path& path, uint64_t sourceHash, const CookedTexture& texture);
+}
\ No newline at end of file
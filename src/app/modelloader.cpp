@@ -1,33 +1,47 @@
 #include "modelloader.hpp"
+#include "meshsimplifier.hpp"
+#include "modelcache.hpp"
+#include "workerpool.hpp"
+#include "bcencoder.hpp"
+#include "mipgenerator.hpp"
+#include "ktx2.hpp"
+#include "../vulkan/vkutils.hpp"
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/matrix4x4.h>
 #include <assimp/matrix4x4.inl>
-#include <assimp/quaternion.h>
-#include <assimp/quaternion.inl>
 #include <stack>
 #include <filesystem>
+#include <cfloat>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <immintrin.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stbi/stb_image.h>
 
 
+// benchmark switch: on a cache miss the meshes are also extracted on a single worker first and the
+// import log compares both, which runs the whole extraction twice
+constexpr bool kLogSerialExtraction = false;
 
 
-inline void ReadMeshFromNode(aiMesh* pMesh, const aiMatrix4x4& mat, Mesh& mesh)
+
+
+inline void ReadMesh(aiMesh* pMesh, Mesh& mesh)
 {
 	mesh.vertices.resize(pMesh->mNumVertices);
 	mesh.materialId = pMesh->mMaterialIndex;
+	mesh.aabbMin = math::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	mesh.aabbMax = math::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	for (uint32_t i(0); i < pMesh->mNumVertices; i++)
 	{
-
-		aiVector3D temp;
-		aiQuaterniont<ai_real> quat;
-		mat.DecomposeNoScaling(quat, temp);
-		const aiVector3D pPos = mat * pMesh->mVertices[i];
-		const aiVector3D& pNormal = quat.Rotate(pMesh->mNormals[i]).Normalize();
-		const aiVector3D& pTangent = quat.Rotate(pMesh->mTangents[i]).Normalize();
-		const aiVector3D& pBitangents = quat.Rotate(pMesh->mBitangents[i]).Normalize();
+		const aiVector3D& pPos = pMesh->mVertices[i];
+		const aiVector3D& pNormal = pMesh->mNormals[i];
+		const aiVector3D& pTangent = pMesh->mTangents[i];
+		const aiVector3D& pBitangents = pMesh->mBitangents[i];
 
 		mesh.vertices[i].uv = 0;
 		mesh.vertices[i].uw = 0;
@@ -50,6 +64,9 @@ inline void ReadMeshFromNode(aiMesh* pMesh, const aiMatrix4x4& mat, Mesh& mesh)
 		mesh.vertices[i].bx = pBitangents.x;
 		mesh.vertices[i].by = pBitangents.y;
 		mesh.vertices[i].bz = pBitangents.z;
+
+		mesh.aabbMin = math::vec3(std::min(mesh.aabbMin.x, pPos.x), std::min(mesh.aabbMin.y, pPos.y), std::min(mesh.aabbMin.z, pPos.z));
+		mesh.aabbMax = math::vec3(std::max(mesh.aabbMax.x, pPos.x), std::max(mesh.aabbMax.y, pPos.y), std::max(mesh.aabbMax.z, pPos.z));
 	}
 
 	mesh.indices.reserve(pMesh->mNumFaces * 3);
@@ -61,33 +78,270 @@ inline void ReadMeshFromNode(aiMesh* pMesh, const aiMatrix4x4& mat, Mesh& mesh)
 		mesh.indices.push_back(Face.mIndices[2]);
 	}
 }
-#include <iostream>
-void ModelLoader::LoadTexture(RawTexture& texture, std::string_view path)
+
+// every lod targets half of the previous one, simplification error is limited by the mesh size
+inline void GenerateLods(Mesh& mesh)
 {
-	int width{ 0 }, height{ 0 }, chanels{ 0 };
-	if (1 == stbi_info(path.data(), &width, &height, &chanels))
+	constexpr float kMaxLodError = 0.1f;
+	constexpr float kMinLodReduction = 0.85f;
+
+	mesh.lods.clear();
+	mesh.lods.push_back({ 0, uint32_t(mesh.indices.size()), 0.0f });
+
+	const std::vector<uint32_t> source = mesh.indices;
+	const float maxError = (mesh.aabbMax - mesh.aabbMin).magnitude() * kMaxLodError;
+	MeshSimplifier simplifier(mesh.vertices, source);
+
+	std::vector<uint32_t> lodIndices;
+	while (mesh.lods.size() < Mesh::kMaxLods)
 	{
-		if (width == 0)
+		const uint32_t previousCount = mesh.lods.back().indexCount;
+		const float error = simplifier.Simplify(previousCount / 6 * 3, maxError, lodIndices);
+		if (lodIndices.empty() || lodIndices.size() > size_t(previousCount * kMinLodReduction))
 		{
-			int a = 0;
+			break;
 		}
-		int reqChanels = chanels;
-		if (chanels == 3)
+
+		meshopt::OptimizeVertexCache(lodIndices.data(), lodIndices.size(), mesh.vertices.size());
+
+		mesh.lods.push_back({ uint32_t(mesh.indices.size()), uint32_t(lodIndices.size()), error });
+		mesh.indices.insert(mesh.indices.end(), lodIndices.begin(), lodIndices.end());
+	}
+}
+
+struct MeshOptimizationStats
+{
+	meshopt::VertexCacheStats cacheBefore;
+	meshopt::VertexCacheStats cacheAfter;
+	meshopt::VertexFetchStats fetchBefore;
+	meshopt::VertexFetchStats fetchAfter;
+
+	MeshOptimizationStats& operator+=(const MeshOptimizationStats& stats)
+	{
+		cacheBefore += stats.cacheBefore;
+		cacheAfter += stats.cacheAfter;
+		fetchBefore += stats.fetchBefore;
+		fetchAfter += stats.fetchAfter;
+		return *this;
+	}
+};
+
+// statistics cover lod 0 only and both fetch numbers use the stride the passes read, so the numbers stay comparable
+inline void OptimizeMesh(Mesh& mesh, size_t vertexSize, MeshOptimizationStats& stats)
+{
+	constexpr float kOverdrawThreshold = 1.05f;
+
+	stats.cacheBefore += meshopt::AnalyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	stats.fetchBefore += meshopt::AnalyzeVertexFetch(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), vertexSize);
+
+	meshopt::OptimizeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	meshopt::OptimizeOverdraw(mesh.indices.data(), mesh.indices.size(), mesh.vertices, kOverdrawThreshold);
+
+	GenerateLods(mesh);
+
+	meshopt::OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+	for (MeshLod& lod : mesh.lods)
+	{
+		lod.meshletOffset = uint32_t(mesh.meshlets.size());
+		meshopt::BuildMeshlets(&mesh.indices[lod.indexOffset], lod.indexCount, mesh.vertices, mesh.meshlets, mesh.meshletVertices, mesh.meshletTriangles);
+		lod.meshletCount = uint32_t(mesh.meshlets.size()) - lod.meshletOffset;
+	}
+
+	const uint32_t lod0Count = mesh.lods[0].indexCount;
+	stats.cacheAfter += meshopt::AnalyzeVertexCache(mesh.indices.data(), lod0Count, mesh.vertices.size());
+	stats.fetchAfter += meshopt::AnalyzeVertexFetch(mesh.indices.data(), lod0Count, mesh.vertices.size(), vertexSize);
+}
+
+inline int16_t QuantizeSnorm16(float value)
+{
+	return int16_t(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline int8_t QuantizeSnorm8(float value)
+{
+	return int8_t(std::lround(std::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+inline uint16_t QuantizeHalf(float value)
+{
+	uint32_t bits = 0;
+	::memcpy(&bits, &value, sizeof(bits));
+
+	const uint32_t sign = (bits >> 16) & 0x8000;
+	const int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+	const uint32_t mantissa = bits & 0x7fffff;
+
+	if (exponent <= 0)
+	{
+		// too small even for a denormal half
+		if (exponent < -10)
 		{
-			reqChanels = 4;
+			return uint16_t(sign);
 		}
 
-		texture.width = uint32_t(width);
-		texture.height = uint32_t(height);
-		texture.chanels = uint32_t(reqChanels);
+		const uint32_t denormal = (mantissa | 0x800000) >> (1 - exponent);
+		return uint16_t(sign | ((denormal + 0x1000) >> 13));
+	}
+	if (exponent >= 31)
+	{
+		return uint16_t(sign | 0x7c00);
+	}
+
+	// round to nearest, a mantissa overflow correctly carries into the exponent
+	return uint16_t(sign | ((uint32_t(exponent) << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+inline void OctahedralEncode(float x, float y, float z, float& u, float& v)
+{
+	const float length = std::abs(x) + std::abs(y) + std::abs(z);
+	if (length <= 0.0f)
+	{
+		u = v = 0.0f;
+		return;
+	}
+
+	x /= length;
+	y /= length;
+	if (z < 0.0f)
+	{
+		const float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		const float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	u = x;
+	v = y;
+}
+
+// (p - offset) / scale to snorm16 for a whole vertex array, w is 1
+inline void QuantizePositions(const std::vector<Vertex>& vertices, const math::vec3& scale, const math::vec3& offset, std::vector<CompactPosition>& positions)
+{
+	static_assert(offsetof(Vertex, nx) == offsetof(Vertex, px) + 3 * sizeof(float), "positions are loaded with the following float");
+
+	const __m128 vOffset = _mm_setr_ps(offset.x, offset.y, offset.z, 0.0f);
+	const __m128 vInvScale = _mm_setr_ps(1.0f / scale.x, 1.0f / scale.y, 1.0f / scale.z, 0.0f);
+	const __m128 vMin = _mm_set1_ps(-1.0f);
+	const __m128 vMax = _mm_set1_ps(1.0f);
+	const __m128 vSnorm = _mm_set1_ps(32767.0f);
+
+	positions.resize(vertices.size());
+	for (size_t i(0); i < vertices.size(); i += 2)
+	{
+		const size_t second = std::min(i + 1, vertices.size() - 1);
+
+		__m128 p0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&vertices[i].px), vOffset), vInvScale);
+		__m128 p1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&vertices[second].px), vOffset), vInvScale);
+		p0 = _mm_blend_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(p0, vMin), vMax), vSnorm), vSnorm, 0x8);
+		p1 = _mm_blend_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(p1, vMin), vMax), vSnorm), vSnorm, 0x8);
+
+		const __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(p0), _mm_cvtps_epi32(p1));
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(&positions[i]), packed);
+		if (second != i)
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&positions[second]), _mm_unpackhi_epi64(packed, packed));
+		}
+	}
+}
+
+template<typename T>
+inline void WriteStream(MeshStream& stream, const std::vector<T>& elements)
+{
+	stream.data.resize(elements.size() * sizeof(T));
+	::memcpy(stream.data.data(), elements.data(), stream.data.size());
+}
+
+inline void BuildVertexStreams(Mesh& mesh, EVertexFormat vertexFormat, const math::vec3& scale, const math::vec3& offset)
+{
+	if (vertexFormat == EVertexFormat::Compact)
+	{
+		std::vector<CompactPosition> positions;
+		QuantizePositions(mesh.vertices, scale, offset, positions);
+
+		std::vector<CompactAttributes> attributes(mesh.vertices.size());
+		for (size_t i(0); i < mesh.vertices.size(); ++i)
+		{
+			const Vertex& vertex = mesh.vertices[i];
+			CompactAttributes& attribute = attributes[i];
+
+			float u = 0, v = 0;
+			OctahedralEncode(vertex.nx, vertex.ny, vertex.nz, u, v);
+			attribute.nx = QuantizeSnorm16(u);
+			attribute.ny = QuantizeSnorm16(v);
+
+			OctahedralEncode(vertex.tx, vertex.ty, vertex.tz, u, v);
+			attribute.tx = QuantizeSnorm8(u);
+			attribute.ty = QuantizeSnorm8(v);
+
+			// bitangent is rebuilt as cross(normal, tangent) * sign
+			const float cx = vertex.ny * vertex.tz - vertex.nz * vertex.ty;
+			const float cy = vertex.nz * vertex.tx - vertex.nx * vertex.tz;
+			const float cz = vertex.nx * vertex.ty - vertex.ny * vertex.tx;
+			attribute.tw = (cx * vertex.bx + cy * vertex.by + cz * vertex.bz) < 0.0f ? -127 : 127;
+
+			attribute.uv = QuantizeHalf(vertex.uv);
+			attribute.uw = QuantizeHalf(vertex.uw);
+		}
+
+		WriteStream(mesh.positionStream, positions);
+		WriteStream(mesh.attributeStream, attributes);
+	}
+	else
+	{
+		std::vector<VertexPosition> positions(mesh.vertices.size());
+		std::vector<VertexAttributes> attributes(mesh.vertices.size());
+		for (size_t i(0); i < mesh.vertices.size(); ++i)
+		{
+			const Vertex& vertex = mesh.vertices[i];
+			positions[i] = { vertex.px, vertex.py, vertex.pz };
+			attributes[i] = { vertex.nx, vertex.ny, vertex.nz, vertex.tx, vertex.ty, vertex.tz, vertex.bx, vertex.by, vertex.bz, vertex.uv, vertex.uw };
+		}
+
+		WriteStream(mesh.positionStream, positions);
+		WriteStream(mesh.attributeStream, attributes);
+	}
+
+	std::vector<Vertex>().swap(mesh.vertices);
+}
+
+// meshes with less than 64k vertices store 16 bit indices
+inline void BuildIndexStream(Mesh& mesh)
+{
+	if (mesh.vertices.size() <= size_t(UINT16_MAX) + 1)
+	{
+		std::vector<uint16_t> indices(mesh.indices.begin(), mesh.indices.end());
+		WriteStream(mesh.indexStream, indices);
+		mesh.indexType = EIndexType::UInt16;
+	}
+	else
+	{
+		WriteStream(mesh.indexStream, mesh.indices);
+		mesh.indexType = EIndexType::UInt32;
+	}
 
-		stbi_uc* rawbuff = stbi_load(path.data(), &width, &height, &chanels, reqChanels);
+	std::vector<uint32_t>().swap(mesh.indices);
+}
 
-		const uint32_t imSize = width * height * reqChanels * sizeof(uint8_t);
-		texture.data.resize(imSize);
-		::memcpy(&texture.data[0], rawbuff, imSize);
+#include <iostream>
+void RawTexture::PixelsDeleter::operator()(uint8_t* pPixels) const
+{
+	stbi_image_free(pPixels);
+}
+
+// textures are uploaded as RGBA8, the decoder expands to 4 channels while decoding
+void ModelLoader::LoadTexture(RawTexture& texture, std::string_view path)
+{
+	constexpr int kChanels = 4;
 
-		stbi_image_free(rawbuff);
+	int width{ 0 }, height{ 0 }, chanels{ 0 };
+	texture.pixels.reset(stbi_load(path.data(), &width, &height, &chanels, kChanels));
+	if (texture.pixels)
+	{
+		texture.width = uint32_t(width);
+		texture.height = uint32_t(height);
+		texture.chanels = uint32_t(kChanels);
 	}
 	else
 	{
@@ -96,6 +350,108 @@ void ModelLoader::LoadTexture(RawTexture& texture, std::string_view path)
 	}
 }
 
+size_t CookedTexture::MipOffset(uint32_t mip) const
+{
+	size_t offset = 0;
+	for (uint32_t i(0); i < mip; ++i)
+	{
+		offset += CompressedMipSize(format, std::max(width >> i, 1u), std::max(height >> i, 1u));
+	}
+	return offset;
+}
+
+const uint8_t* CookedTexture::MipData(uint32_t mip) const
+{
+	assert(mip >= firstMip && mip < mipCount);
+	return file ? mappedMips[mip] : data.data() + MipOffset(mip) - MipOffset(firstMip);
+}
+
+void CookedTexture::DropMipsBefore(uint32_t mip)
+{
+	if (mip <= firstMip)
+	{
+		return;
+	}
+
+	if (!file)
+	{
+		const size_t droppedBytes = MipOffset(mip) - MipOffset(firstMip);
+		data.erase(data.begin(), data.begin() + droppedBytes);
+	}
+	firstMip = mip;
+}
+
+// color maps go to BC7 and normal maps to BC5, the mips are filtered before compression.
+// A KTX2 file, or one next to the image, is used as is.
+void ModelLoader::LoadCookedTexture(CookedTexture& texture, std::string_view path, ETextureUsage usage, uint32_t firstMip, uint64_t* pSourceHash)
+{
+	const EPixelFormat format = usage == ETextureUsage::Normal ? EPixelFormat::BC5 : EPixelFormat::BC7;
+	const std::filesystem::path ktxPath = std::filesystem::path(path.data()).replace_extension(".ktx2");
+	// a KTX2 that is not plain BC7/BC5 or is damaged falls back to the cooked cache
+	if (std::filesystem::exists(ktxPath) && ktx2::Read(ktxPath, format, firstMip, texture))
+	{
+		return;
+	}
+
+	const std::filesystem::path cachePath = std::filesystem::path(path.data()).replace_extension(".almtex");
+	if (pSourceHash && *pSourceHash == 0)
+	{
+		*pSourceHash = modelcache::HashFile(path.data());
+	}
+	const uint64_t sourceHash = pSourceHash ? *pSourceHash : modelcache::HashFile(path.data());
+	if (modelcache::ReadTexture(cachePath, sourceHash, format, firstMip, texture))
+	{
+		return;
+	}
+
+	RawTexture raw;
+	LoadTexture(raw, path);
+	if (!raw.IsValid())
+	{
+		return;
+	}
+
+	const uint32_t mipCount = MipCount(raw.width, raw.height);
+	size_t dataSize = 0;
+	for (uint32_t i(0); i < mipCount; ++i)
+	{
+		dataSize += CompressedMipSize(format, std::max(raw.width >> i, 1u), std::max(raw.height >> i, 1u));
+	}
+
+	texture.width = raw.width;
+	texture.height = raw.height;
+	texture.mipCount = mipCount;
+	texture.format = format;
+	texture.data.resize(dataSize);
+
+	// albedo images are authored in sRGB, averaging the encoded values would darken the mips
+	const mipgen::EFilter filter = usage == ETextureUsage::Normal ? mipgen::EFilter::Normal : mipgen::EFilter::Srgb;
+	std::vector<uint8_t> mip;
+	std::vector<uint8_t> nextMip;
+	const uint8_t* pMip = raw.pixels.get();
+	size_t offset = 0;
+	for (uint32_t i(0); i < mipCount; ++i)
+	{
+		const uint32_t width = std::max(raw.width >> i, 1u);
+		const uint32_t height = std::max(raw.height >> i, 1u);
+		bcenc::Encode(pMip, width, height, format, texture.data.data() + offset);
+		offset += CompressedMipSize(format, width, height);
+
+		if (i + 1 < mipCount)
+		{
+			mipgen::Downsample(pMip, width, height, filter, nextMip);
+			mip.swap(nextMip);
+			pMip = mip.data();
+		}
+	}
+
+	if (!modelcache::WriteTexture(cachePath, sourceHash, texture))
+	{
+		std::cout << "\tCan not write texture cache: " << cachePath << std::endl;
+	}
+	texture.DropMipsBefore(std::min(firstMip, mipCount - 1));
+}
+
 inline void ReadMaterial(Material& material, const std::filesystem::path& path, const aiScene* pScene, int32_t matId)
 {
 	aiMaterial* pMaterial = pScene->mMaterials[matId];
@@ -109,7 +465,7 @@ inline void ReadMaterial(Material& material, const std::filesystem::path& path,
 
 			std::string parentPath = (path / std::filesystem::path(texturePath.C_Str()).filename()).string();
 
-			ModelLoader::LoadTexture(material.diffuseTexture, (path / std::filesystem::path(texturePath.C_Str()).filename()).string());
+			material.diffusePath = parentPath;
 		}
 	}
 	else if (pMaterial->GetTextureCount(aiTextureType_BASE_COLOR) > 0)
@@ -121,7 +477,7 @@ inline void ReadMaterial(Material& material, const std::filesystem::path& path,
 
 			std::string parentPath = (path / std::filesystem::path(texturePath.C_Str()).filename()).string();
 
-			ModelLoader::LoadTexture(material.diffuseTexture, (path / std::filesystem::path(texturePath.C_Str()).filename()).string());
+			material.diffusePath = parentPath;
 		}
 	}
 
@@ -134,12 +490,79 @@ inline void ReadMaterial(Material& material, const std::filesystem::path& path,
 
 			std::string parentPath = (path / std::filesystem::path(texturePath.C_Str()).filename()).string();
 
-			ModelLoader::LoadTexture(material.normalTexture, (path / std::filesystem::path(texturePath.C_Str()).filename()).string());
+			material.normalPath = parentPath;
+		}
+	}
+}
+
+// every file gets one texture, materials using the same file share it
+inline void AssignTextures(Model& model)
+{
+	std::unordered_map<std::string, uint32_t> textureIds;
+	auto textureId = [&](const std::string& path, ETextureUsage usage) {
+		if (path.empty())
+		{
+			return UINT32_MAX;
+		}
+
+		const auto [it, isNew] = textureIds.try_emplace(path, uint32_t(model.texturePaths.size()));
+		if (isNew)
+		{
+			model.texturePaths.push_back(path);
+			model.textureUsages.push_back(usage);
+		}
+		return it->second;
+	};
+
+	for (auto& [materialId, material] : model.materials)
+	{
+		material.diffuseTexture = textureId(material.diffusePath, ETextureUsage::Color);
+		material.normalTexture = textureId(material.normalPath, ETextureUsage::Normal);
+	}
+}
+
+inline void DecodeTextures(Model& model)
+{
+	model.textures.resize(model.texturePaths.size());
+	WorkerPool workers;
+	workers.ParallelFor(model.texturePaths.size(), [&](size_t i) {
+		ModelLoader::LoadCookedTexture(model.textures[i], model.texturePaths[i], model.textureUsages[i]);
+	});
+}
+
+Model ModelLoader::Load(std::string_view pilepath, EVertexFormat vertexFormat, bool decodeTextures)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	const std::filesystem::path cachePath = std::filesystem::path(pilepath.data()).replace_extension(".almmodel");
+	const uint64_t sourceHash = modelcache::HashFile(pilepath.data());
+
+	Model model;
+	if (modelcache::Read(cachePath, sourceHash, vertexFormat, model))
+	{
+		std::cout << "Model cache: " << cachePath << std::endl;
+		std::cout << "\tmeshes " << model.meshes.size() << ", instances " << model.instances.size() << std::endl;
+	}
+	else
+	{
+		model = Import(pilepath, vertexFormat);
+		if (!model.meshes.empty() && !modelcache::Write(cachePath, sourceHash, model))
+		{
+			std::cout << "\tCan not write model cache: " << cachePath << std::endl;
 		}
 	}
+
+	const std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - start;
+	std::cout << "\tgeometry loaded in " << loadTime.count() << " ms" << std::endl;
+
+	AssignTextures(model);
+	if (decodeTextures)
+	{
+		DecodeTextures(model);
+	}
+	return model;
 }
 
-Model ModelLoader::Load(std::string_view pilepath)
+Model ModelLoader::Import(std::string_view pilepath, EVertexFormat vertexFormat)
 {
 	const std::filesystem::path texturePath = std::filesystem::path(pilepath.data()).parent_path() / "textures";
 
@@ -148,19 +571,25 @@ Model ModelLoader::Load(std::string_view pilepath)
 		| aiProcess_Triangulate
 		| aiProcess_GenSmoothNormals
 		| aiProcess_EmbedTextures
-		| aiProcess_OptimizeGraph
 		| aiProcess_OptimizeMeshes
 		| aiProcess_CalcTangentSpace;
 	const aiScene* pScene = Importer.ReadFile(pilepath.data(), flags);
 
 	Model model;
+	model.vertexFormat = vertexFormat;
+	MeshOptimizationStats stats;
+	const size_t vertexSize = vertexFormat == EVertexFormat::Compact
+		? sizeof(CompactPosition) + sizeof(CompactAttributes)
+		: sizeof(VertexPosition) + sizeof(VertexAttributes);
 
 	if (pScene && (pScene->mNumMeshes > 0))
 	{
 		std::stack<aiNode*, std::vector<aiNode*>> nodeStack;
 		std::stack<aiMatrix4x4, std::vector<aiMatrix4x4>> matrixStack;
 
-		model.meshes.reserve(pScene->mNumMeshes);
+		// assimp mesh index -> model mesh index
+		std::unordered_map<uint32_t, uint32_t> meshIds;
+		std::vector<uint32_t> sceneMeshIds;
 
 		nodeStack.push(pScene->mRootNode);
 		matrixStack.push(pScene->mRootNode->mTransformation);
@@ -176,17 +605,31 @@ Model ModelLoader::Load(std::string_view pilepath)
 			{
 				for (uint32_t i(0); i < pNode->mNumMeshes; ++i)
 				{
-					Mesh mesh;
-					ReadMeshFromNode(pScene->mMeshes[pNode->mMeshes[i]], nodeMtx, mesh);
-
-					if (model.materials.find(mesh.materialId) == model.materials.end())
+					const uint32_t sceneMeshId = pNode->mMeshes[i];
+					if (meshIds.find(sceneMeshId) == meshIds.end())
 					{
-						Material material;
-						ReadMaterial(material, texturePath, pScene, mesh.materialId);
-						model.materials[mesh.materialId] = std::move(material);
+						const uint32_t materialId = pScene->mMeshes[sceneMeshId]->mMaterialIndex;
+						if (model.materials.find(materialId) == model.materials.end())
+						{
+							Material material;
+							ReadMaterial(material, texturePath, pScene, materialId);
+							model.materials[materialId] = std::move(material);
+						}
+
+						meshIds[sceneMeshId] = uint32_t(sceneMeshIds.size());
+						sceneMeshIds.push_back(sceneMeshId);
 					}
 
-					model.meshes.push_back(std::move(mesh));
+					MeshInstance instance;
+					instance.meshId = meshIds[sceneMeshId];
+					for (uint32_t row(0); row < 3; ++row)
+					{
+						for (uint32_t column(0); column < 4; ++column)
+						{
+							instance.transform.rows[row][column] = nodeMtx[row][column];
+						}
+					}
+					model.instances.push_back(instance);
 				}
 			}
 
@@ -200,7 +643,93 @@ Model ModelLoader::Load(std::string_view pilepath)
 			}
 		}
 
-		model.meshes.shrink_to_fit();
+		size_t vertexCount = 0;
+		for (uint32_t sceneMeshId : sceneMeshIds)
+		{
+			vertexCount += pScene->mMeshes[sceneMeshId]->mNumVertices;
+		}
+
+		// meshes are independent, extraction and optimization run on all workers
+		WorkerPool workers;
+		model.meshes.resize(sceneMeshIds.size());
+		std::vector<MeshOptimizationStats> meshStats(model.meshes.size());
+
+		std::chrono::duration<double> serialTime(0);
+		if (kLogSerialExtraction)
+		{
+			WorkerPool serialWorker(1);
+			std::vector<Mesh> serialMeshes(model.meshes.size());
+			std::vector<MeshOptimizationStats> serialStats(model.meshes.size());
+
+			const auto serialStart = std::chrono::high_resolution_clock::now();
+			serialWorker.ParallelFor(serialMeshes.size(), [&](size_t i) {
+				ReadMesh(pScene->mMeshes[sceneMeshIds[i]], serialMeshes[i]);
+				OptimizeMesh(serialMeshes[i], vertexSize, serialStats[i]);
+			});
+			serialTime = std::chrono::high_resolution_clock::now() - serialStart;
+		}
+
+		const auto extractStart = std::chrono::high_resolution_clock::now();
+		workers.ParallelFor(model.meshes.size(), [&](size_t i) {
+			ReadMesh(pScene->mMeshes[sceneMeshIds[i]], model.meshes[i]);
+			OptimizeMesh(model.meshes[i], vertexSize, meshStats[i]);
+		});
+		const std::chrono::duration<double> extractTime = std::chrono::high_resolution_clock::now() - extractStart;
+
+		for (const MeshOptimizationStats& meshStat : meshStats)
+		{
+			stats += meshStat;
+		}
+
+		if (vertexFormat == EVertexFormat::Compact)
+		{
+			math::vec3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+			math::vec3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (const Mesh& mesh : model.meshes)
+			{
+				boundsMin = math::vec3(std::min(boundsMin.x, mesh.aabbMin.x), std::min(boundsMin.y, mesh.aabbMin.y), std::min(boundsMin.z, mesh.aabbMin.z));
+				boundsMax = math::vec3(std::max(boundsMax.x, mesh.aabbMax.x), std::max(boundsMax.y, mesh.aabbMax.y), std::max(boundsMax.z, mesh.aabbMax.z));
+			}
+
+			model.positionOffset = (boundsMin + boundsMax) * 0.5f;
+			model.positionScale = math::vec3(
+				std::max((boundsMax.x - boundsMin.x) * 0.5f, FLT_EPSILON),
+				std::max((boundsMax.y - boundsMin.y) * 0.5f, FLT_EPSILON),
+				std::max((boundsMax.z - boundsMin.z) * 0.5f, FLT_EPSILON)
+			);
+		}
+
+		size_t indexCount = 0;
+		for (const Mesh& mesh : model.meshes)
+		{
+			indexCount += mesh.indices.size();
+		}
+
+		workers.ParallelFor(model.meshes.size(), [&](size_t i) {
+			BuildIndexStream(model.meshes[i]);
+			BuildVertexStreams(model.meshes[i], vertexFormat, model.positionScale, model.positionOffset);
+		});
+
+		size_t indexBytes = 0;
+		for (const Mesh& mesh : model.meshes)
+		{
+			indexBytes += mesh.indexStream.Size();
+		}
+
+		std::cout << "Mesh optimization: " << pilepath << std::endl;
+		std::cout << "\tmeshes " << model.meshes.size() << ", instances " << model.instances.size() << std::endl;
+		std::cout << "\tACMR " << stats.cacheBefore.Acmr() << " -> " << stats.cacheAfter.Acmr() << std::endl;
+		std::cout << "\tATVR " << stats.cacheBefore.Atvr() << " -> " << stats.cacheAfter.Atvr() << std::endl;
+		std::cout << "\toverfetch " << stats.fetchBefore.Overfetch() << " -> " << stats.fetchAfter.Overfetch() << std::endl;
+		std::cout << "\tindex memory " << indexCount * sizeof(uint32_t) / 1024 << " KB -> " << indexBytes / 1024 << " KB" << std::endl;
+		std::cout << "\textracted " << vertexCount << " vertices in " << extractTime.count() * 1000.0 << " ms on " << workers.ThreadCount() << " workers, "
+			<< double(vertexCount) / std::max(extractTime.count(), 1e-6) / 1000000.0 << " M vertices/s" << std::endl;
+		if (kLogSerialExtraction)
+		{
+			std::cout << "\tserial baseline " << serialTime.count() * 1000.0 << " ms on 1 worker, "
+				<< double(vertexCount) / std::max(serialTime.count(), 1e-6) / 1000000.0 << " M vertices/s, speedup "
+				<< serialTime.count() / std::max(extractTime.count(), 1e-6) << "x" << std::endl;
+		}
 	}
 
 	return model;
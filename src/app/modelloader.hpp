@@ -1,44 +1,143 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <string_view>
 #include <array>
+#include <memory>
 #include <unordered_map>
 #include "../vulkan/vkcommon.hpp"
+#include "../math/vec3.hpp"
+#include "meshoptimizer.hpp"
+#include "mappedfile.hpp"
 
 
+struct MeshLod
+{
+	uint32_t indexOffset{ 0 };
+	uint32_t indexCount{ 0 };
+	float error{ 0 };				// object space deviation from the full mesh
+	uint32_t meshletOffset{ 0 };
+	uint32_t meshletCount{ 0 };
+};
+
+// a vertex or index stream, built on import or used in place from the cache mapping
+struct MeshStream
+{
+	std::vector<uint8_t> data;					// empty when mapped
+	const uint8_t* pMapped{ nullptr };
+	size_t mappedSize{ 0 };
+
+	inline const uint8_t* Data() const { return pMapped ? pMapped : data.data(); }
+	inline size_t Size() const { return pMapped ? mappedSize : data.size(); }
+	inline void Release() { std::vector<uint8_t>().swap(data); pMapped = nullptr; mappedSize = 0; }
+};
+
 struct Mesh
 {
+	static constexpr uint32_t kMaxLods = 4;
+
 	uint32_t materialId{ UINT32_MAX };
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	std::vector<Vertex> vertices;				// import format, released once the streams are built
+	MeshStream positionStream;
+	MeshStream attributeStream;
+	std::vector<uint32_t> indices;	// all lods one after another, released once the index stream is built
+	MeshStream indexStream;
+	std::shared_ptr<MappedFile> file;			// the cache the streams are mapped from
+	EIndexType indexType{ EIndexType::UInt32 };
+	std::vector<MeshLod> lods;
+	std::vector<meshopt::Meshlet> meshlets;		// all lods one after another
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint32_t> meshletTriangles;
+	math::vec3 aabbMin;							// object space
+	math::vec3 aabbMax;
+};
+
+// a placement of a mesh in the scene, meshes referenced by several nodes are stored once
+struct MeshInstance
+{
+	uint32_t meshId{ 0 };
+	InstanceTransform transform;
 };
 
 struct RawTexture
 {
+	struct PixelsDeleter
+	{
+		void operator()(uint8_t* pPixels) const;
+	};
+
 	uint32_t width{ 0 };
 	uint32_t height{ 0 };
 	uint32_t chanels{ 0 };
-	std::vector<uint8_t> data;
+	std::unique_ptr<uint8_t, PixelsDeleter> pixels;	// the decoder allocation, used without a copy
 
-	bool IsValid() const { return width > 0 && height > 0 && chanels > 0; }
+	size_t size() const { return size_t(width) * height * chanels; }
+	bool IsValid() const { return width > 0 && height > 0 && chanels > 0 && pixels; }
+};
+
+enum class ETextureUsage : uint8_t
+{
+	Color,		// BC7
+	Normal		// BC5, the shader rebuilds z
+};
+
+// block compressed at cook time with the whole mip chain, streaming keeps the levels from firstMip on
+struct CookedTexture
+{
+	uint32_t width{ 0 };				// of the full image
+	uint32_t height{ 0 };
+	uint32_t mipCount{ 0 };
+	uint32_t firstMip{ 0 };
+	EPixelFormat format{ EPixelFormat::BC7 };
+	std::vector<uint8_t> data;			// mip levels one after another, empty when mapped
+	std::shared_ptr<MappedFile> file;	// cached and KTX2 levels are used in place
+	std::vector<const uint8_t*> mappedMips;		// every level of the full chain, into the file
+
+	bool IsValid() const { return width > 0 && height > 0 && mipCount > 0 && (!data.empty() || file); }
+
+	// bytes of the levels from firstMip on
+	size_t size() const { return MipOffset(mipCount) - MipOffset(firstMip); }
+	// bytes of the levels before mip in the full chain
+	size_t MipOffset(uint32_t mip) const;
+	const uint8_t* MipData(uint32_t mip) const;
+	void DropMipsBefore(uint32_t mip);
 };
 
 struct Material
 {
-	RawTexture diffuseTexture;
-	RawTexture normalTexture;
+	std::string diffusePath;		// decoded into the textures after the meshes are read
+	std::string normalPath;
+	uint32_t diffuseTexture{ UINT32_MAX };		// Model::textures, materials using the same file share it
+	uint32_t normalTexture{ UINT32_MAX };
 };
 
 class Model
 {
 public:
 	std::vector<Mesh> meshes;
+	std::vector<MeshInstance> instances;
 	std::unordered_map<uint32_t, Material> materials;
+	std::vector<std::string> texturePaths;
+	std::vector<ETextureUsage> textureUsages;
+	std::vector<CookedTexture> textures;		// empty until decoded, same order as the paths
+
+	EVertexFormat vertexFormat{ EVertexFormat::Full };
+	math::vec3 positionScale{ 1, 1, 1 };		// compact positions are snorm * scale + offset
+	math::vec3 positionOffset{ 0, 0, 0 };
 };
 
 class ModelLoader
 {
 public:
-	Model Load(std::string_view pilepath);
+	// the cooked cache next to the source is used while the source is unchanged,
+	// without decodeTextures only the texture paths are filled in
+	Model Load(std::string_view pilepath, EVertexFormat vertexFormat = EVertexFormat::Full, bool decodeTextures = true);
 	static void LoadTexture(RawTexture& texture, std::string_view path);
+
+	// the cooked cache next to the image is used while the image is unchanged, a zero
+	// *pSourceHash is filled in so later loads of the same image skip hashing it
+	static void LoadCookedTexture(CookedTexture& texture, std::string_view path, ETextureUsage usage, uint32_t firstMip = 0, uint64_t* pSourceHash = nullptr);
+
+private:
+	Model Import(std::string_view pilepath, EVertexFormat vertexFormat);
 };
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "scenestreamer.hpp"
+#include "workerpool.hpp"
+#include <algorithm>
+
+
+SceneStreamer::~SceneStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isCancelled = true;
+	}
+	m_requestAdded.notify_all();
+
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void SceneStreamer::Start(const std::string& path, EVertexFormat vertexFormat, uint32_t initialTextureSize)
+{
+	m_initialTextureSize = initialTextureSize;
+	m_thread = std::thread(&SceneStreamer::LoadThread, this, path, vertexFormat);
+}
+
+bool SceneStreamer::TakeModel(Model& model)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_hasModel)
+	{
+		return false;
+	}
+
+	model = std::move(m_model);
+	m_hasModel = false;
+	return true;
+}
+
+bool SceneStreamer::TakeTexture(uint32_t& textureId, CookedTexture& texture)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_textures.empty())
+	{
+		return false;
+	}
+
+	textureId = m_textures.front().first;
+	texture = std::move(m_textures.front().second);
+	m_textures.pop_front();
+	return true;
+}
+
+void SceneStreamer::RequestMips(uint32_t textureId, uint32_t firstMip)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = std::find_if(m_requests.begin(), m_requests.end(), [textureId](const auto& request) { return request.first == textureId; });
+		if (it != m_requests.end())
+		{
+			it->second = firstMip;
+		}
+		else
+		{
+			m_requests.emplace_back(textureId, firstMip);
+		}
+	}
+	m_requestAdded.notify_one();
+}
+
+void SceneStreamer::LoadThread(std::string path, EVertexFormat vertexFormat)
+{
+	Model model = ModelLoader().Load(path, vertexFormat, false);
+	m_texturePaths = model.texturePaths;
+	m_textureUsages = model.textureUsages;
+	m_textureHashes.assign(m_texturePaths.size(), 0);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_model = std::move(model);
+		m_hasModel = true;
+	}
+
+	// textures are cooked at full size, only the small mips are kept for now
+	WorkerPool workers;
+	workers.ParallelFor(m_texturePaths.size(), [&](size_t i) {
+		if (m_isCancelled)
+		{
+			return;
+		}
+
+		CookedTexture texture;
+		ModelLoader::LoadCookedTexture(texture, m_texturePaths[i], m_textureUsages[i], 0, &m_textureHashes[i]);
+		if (texture.IsValid())
+		{
+			uint32_t firstMip = 0;
+			while (firstMip + 1 < texture.mipCount && std::max(texture.width, texture.height) >> firstMip > m_initialTextureSize)
+			{
+				++firstMip;
+			}
+			texture.DropMipsBefore(firstMip);
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_textures.emplace_back(uint32_t(i), std::move(texture));
+	});
+
+	m_isDone = true;
+
+	while (true)
+	{
+		std::pair<uint32_t, uint32_t> request;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_requestAdded.wait(lock, [this]() { return m_isCancelled || !m_requests.empty(); });
+			if (m_isCancelled)
+			{
+				return;
+			}
+
+			request = m_requests.front();
+			m_requests.pop_front();
+		}
+
+		CookedTexture texture;
+		ModelLoader::LoadCookedTexture(texture, m_texturePaths[request.first], m_textureUsages[request.first], request.second, &m_textureHashes[request.first]);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_textures.emplace_back(request.first, std::move(texture));
+	}
+}
\ No newline at end of file
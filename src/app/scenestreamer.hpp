@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "modelloader.hpp"
+
+
+// Loads a model on a background thread and hands it over in pieces: the geometry first,
+// then every texture as soon as it is cooked or read from its cache. Textures are handed over
+// with their low mips only, other mip ranges are read from the texture cache on request.
+// All other calls come from the render thread.
+class SceneStreamer
+{
+public:
+	static constexpr uint32_t kInitialTextureSize = 128;		// largest side of the first mip handed over
+
+	SceneStreamer() = default;
+	~SceneStreamer();
+
+	// UINT32_MAX hands textures over with all of their mips
+	void Start(const std::string& path, EVertexFormat vertexFormat, uint32_t initialTextureSize = kInitialTextureSize);
+
+	// succeeds once, the model has texture paths but no decoded textures
+	bool TakeModel(Model& model);
+
+	// failed decodes are handed over as well, with an invalid texture
+	bool TakeTexture(uint32_t& textureId, CookedTexture& texture);
+
+	// the texture comes back through TakeTexture with the levels from firstMip on,
+	// a newer request for the same texture replaces a pending one
+	void RequestMips(uint32_t textureId, uint32_t firstMip);
+
+	inline bool IsLoading() const { return !m_isDone; }
+
+public:
+	SceneStreamer(const SceneStreamer&) = delete;
+	SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+private:
+	void LoadThread(std::string path, EVertexFormat vertexFormat);
+
+private:
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_requestAdded;
+	Model m_model;
+	bool m_hasModel{ false };
+	std::vector<std::string> m_texturePaths;
+	std::vector<ETextureUsage> m_textureUsages;
+	std::vector<uint64_t> m_textureHashes;						// of the source images, taken once at scene load
+	std::deque<std::pair<uint32_t, CookedTexture>> m_textures;
+	std::deque<std::pair<uint32_t, uint32_t>> m_requests;		// texture, first mip
+	uint32_t m_initialTextureSize{ kInitialTextureSize };
+	std::atomic<bool> m_isDone{ false };
+	std::atomic<bool> m_isCancelled{ false };
+};
\ No newline at end of file
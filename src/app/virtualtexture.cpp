@@ -0,0 +1,300 @@
+#include "virtualtexture.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+
+namespace
+{
+	constexpr size_t kBlockBytes = 16;						// BC5 and BC7
+	constexpr uint32_t kSlotBlocks = VirtualTextureCache::kSlotSize / 4;
+	constexpr uint32_t kPageBlocks = VirtualTextureCache::kPageSize / 4;
+	constexpr uint32_t kBorderBlocks = VirtualTextureCache::kPageBorder / 4;
+	constexpr size_t kSlotBytes = size_t(kSlotBlocks) * kSlotBlocks * kBlockBytes;
+
+	inline uint32_t PageKey(uint32_t id, uint32_t mip, uint32_t pageX, uint32_t pageY)
+	{
+		return ((id + 1) << 20) | (mip << 16) | (pageY << 8) | pageX;
+	}
+
+	inline uint32_t KeyTexture(uint32_t key) { return (key >> 20) - 1; }
+	inline uint32_t KeyMip(uint32_t key) { return (key >> 16) & 0xf; }
+	inline uint32_t KeyPageX(uint32_t key) { return key & 0xff; }
+	inline uint32_t KeyPageY(uint32_t key) { return (key >> 8) & 0xff; }
+
+	inline uint32_t Wrap(int32_t value, uint32_t count)
+	{
+		const int32_t wrapped = value % int32_t(count);
+		return uint32_t(wrapped < 0 ? wrapped + int32_t(count) : wrapped);
+	}
+}
+
+void VirtualTextureCache::Create()
+{
+	const EPixelFormat formats[2] = { EPixelFormat::BC7, EPixelFormat::BC5 };
+	for (uint32_t i(0); i < 2; ++i)
+	{
+		PhysicalAtlas& atlas = m_atlases[i];
+		// with host image copy the page uploads skip the staging buffer and the submit
+		const VkFormat format = to_vk_enum(formats[i]);
+		const VkImageUsageFlags hostUsage = VulkanEngine::IsHostImageCopySupported(format) ? VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT : 0;
+		atlas.texture.Create(kSlotSize * kAtlasSlots, kSlotSize * kAtlasSlots, format, 1, hostUsage);
+		atlas.slots.resize(kAtlasSlots * kAtlasSlots);
+
+		// materials can be bound to an atlas before anything is uploaded to it
+		VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
+			atlas.texture.SetBarier(commandBuffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		});
+	}
+
+	// fixed sizes, the descriptors stay valid while textures are added
+	m_pageTableData.assign(kPageTableEntries, 0);
+	m_textureData.assign(kMaxTextures, {});
+	m_pageTable.Load(m_pageTableData);
+	m_textureInfo.Load(m_textureData);
+}
+
+uint32_t VirtualTextureCache::AddTexture(CookedTexture&& texture)
+{
+	assert(texture.IsValid() && texture.firstMip == 0);
+	assert(texture.format == EPixelFormat::BC5 || texture.format == EPixelFormat::BC7);
+
+	const uint32_t id = uint32_t(m_textures.size());
+	VirtualTexture vt;
+	vt.atlas = texture.format == EPixelFormat::BC5 ? 1 : 0;
+	vt.data = std::move(texture);
+	while (vt.tailMip + 1 < vt.data.mipCount && std::max(vt.data.width, vt.data.height) >> vt.tailMip > kPageSize)
+	{
+		++vt.tailMip;
+	}
+
+	uint32_t pageTableSize = m_pageTableSize;
+	for (uint32_t mip(0); mip <= vt.tailMip; ++mip)
+	{
+		vt.mipOffsets.push_back(pageTableSize);
+		pageTableSize += PagesX(vt, mip) * PagesY(vt, mip);
+	}
+
+	// every texture pins one slot, a full atlas only holds pinned pages
+	if (id >= kMaxTextures || pageTableSize > kPageTableEntries || PagesX(vt, 0) > 256 || PagesY(vt, 0) > 256
+		|| std::max(vt.data.width, vt.data.height) >> vt.tailMip > kPageSize
+		|| FindSlot(m_atlases[vt.atlas], UINT32_MAX) == UINT32_MAX)
+	{
+		return UINT32_MAX;
+	}
+
+	m_pageTableSize = pageTableSize;
+	m_textureData[id] = { vt.data.width, vt.data.height, vt.tailMip, vt.mipOffsets[0] };
+	m_textures.push_back(std::move(vt));
+	m_textureInfo.Load(m_textureData);
+
+	UploadPages({ PageKey(id, m_textures[id].tailMip, 0, 0) }, 0, true);
+	FlushPageTable();
+	return id;
+}
+
+void VirtualTextureCache::Update(const std::vector<uint32_t>& feedback, uint32_t frame)
+{
+	std::vector<uint32_t> keys = feedback;
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	// the coarser pages a page falls back to are touched as well, missing ones are loaded first
+	std::vector<uint32_t> requests;
+	for (uint32_t key : keys)
+	{
+		const uint32_t id = KeyTexture(key);
+		if (key == 0 || id >= m_textures.size())
+		{
+			continue;
+		}
+
+		const VirtualTexture& vt = m_textures[id];
+		PhysicalAtlas& atlas = m_atlases[vt.atlas];
+		uint32_t pageX = KeyPageX(key);
+		uint32_t pageY = KeyPageY(key);
+		for (uint32_t mip(std::min(KeyMip(key), vt.tailMip)); mip <= vt.tailMip; ++mip)
+		{
+			pageX = std::min(pageX, PagesX(vt, mip) - 1);
+			pageY = std::min(pageY, PagesY(vt, mip) - 1);
+
+			const uint32_t page = PageKey(id, mip, pageX, pageY);
+			auto it = atlas.pages.find(page);
+			if (it != atlas.pages.end())
+			{
+				atlas.slots[it->second].lastUsed = frame;
+			}
+			else
+			{
+				requests.push_back(page);
+			}
+
+			pageX >>= 1;
+			pageY >>= 1;
+		}
+	}
+
+	std::sort(requests.begin(), requests.end());
+	requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+	std::stable_sort(requests.begin(), requests.end(), [](uint32_t pageA, uint32_t pageB) { return KeyMip(pageA) > KeyMip(pageB); });
+	if (requests.size() > kPagesPerFrame)
+	{
+		requests.resize(kPagesPerFrame);
+	}
+
+	if (!requests.empty())
+	{
+		UploadPages(requests, frame, false);
+		FlushPageTable();
+	}
+}
+
+const Texture& VirtualTextureCache::Atlas(EPixelFormat format) const
+{
+	return m_atlases[format == EPixelFormat::BC5 ? 1 : 0].texture;
+}
+
+uint32_t VirtualTextureCache::PagesX(const VirtualTexture& texture, uint32_t mip) const
+{
+	return (std::max(texture.data.width >> mip, 1u) + kPageSize - 1) / kPageSize;
+}
+
+uint32_t VirtualTextureCache::PagesY(const VirtualTexture& texture, uint32_t mip) const
+{
+	return (std::max(texture.data.height >> mip, 1u) + kPageSize - 1) / kPageSize;
+}
+
+// a free slot or the least recently used page that was not used in the frame
+uint32_t VirtualTextureCache::FindSlot(const PhysicalAtlas& atlas, uint32_t frame) const
+{
+	uint32_t best = UINT32_MAX;
+	for (uint32_t i(0); i < atlas.slots.size(); ++i)
+	{
+		const Slot& slot = atlas.slots[i];
+		if (slot.page == 0)
+		{
+			return i;
+		}
+		if (!slot.isPinned && slot.lastUsed < frame && (best == UINT32_MAX || slot.lastUsed < atlas.slots[best].lastUsed))
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+// blocks outside the mip wrap around, like the repeat sampler does
+void VirtualTextureCache::CopyPage(const VirtualTexture& texture, uint32_t mip, uint32_t pageX, uint32_t pageY, uint8_t* pOut) const
+{
+	const uint32_t blocksX = (std::max(texture.data.width >> mip, 1u) + 3) / 4;
+	const uint32_t blocksY = (std::max(texture.data.height >> mip, 1u) + 3) / 4;
+	const uint8_t* pMip = texture.data.MipData(mip);
+
+	for (uint32_t by(0); by < kSlotBlocks; ++by)
+	{
+		const uint32_t sourceY = Wrap(int32_t(pageY * kPageBlocks + by) - int32_t(kBorderBlocks), blocksY);
+		for (uint32_t bx(0); bx < kSlotBlocks; ++bx)
+		{
+			const uint32_t sourceX = Wrap(int32_t(pageX * kPageBlocks + bx) - int32_t(kBorderBlocks), blocksX);
+			memcpy(pOut + (size_t(by) * kSlotBlocks + bx) * kBlockBytes, pMip + (size_t(sourceY) * blocksX + sourceX) * kBlockBytes, kBlockBytes);
+		}
+	}
+}
+
+void VirtualTextureCache::UploadPages(const std::vector<uint32_t>& pages, uint32_t frame, bool isPinned)
+{
+	std::vector<uint8_t> data[2];
+	std::vector<VkBufferImageCopy> regions[2];
+	for (uint32_t page : pages)
+	{
+		VirtualTexture& vt = m_textures[KeyTexture(page)];
+		PhysicalAtlas& atlas = m_atlases[vt.atlas];
+		const uint32_t slotId = FindSlot(atlas, isPinned ? UINT32_MAX : frame);
+		if (slotId == UINT32_MAX)
+		{
+			continue;
+		}
+
+		Slot& slot = atlas.slots[slotId];
+		if (slot.page != 0)
+		{
+			atlas.pages.erase(slot.page);
+			m_textures[KeyTexture(slot.page)].isDirty = true;
+		}
+		slot.page = page;
+		slot.lastUsed = frame;
+		slot.isPinned = isPinned;
+		atlas.pages[page] = slotId;
+		vt.isDirty = true;
+
+		const size_t offset = data[vt.atlas].size();
+		data[vt.atlas].resize(offset + kSlotBytes);
+		CopyPage(vt, KeyMip(page), KeyPageX(page), KeyPageY(page), data[vt.atlas].data() + offset);
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = offset;
+		region.imageOffset = { int32_t(slotId % kAtlasSlots * kSlotSize), int32_t(slotId / kAtlasSlots * kSlotSize), 0 };
+		region.imageExtent = { kSlotSize, kSlotSize, 1 };
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		regions[vt.atlas].push_back(region);
+	}
+
+	for (uint32_t i(0); i < 2; ++i)
+	{
+		if (!regions[i].empty())
+		{
+			m_atlases[i].texture.LoadRegions(data[i].data(), data[i].size(), regions[i]);
+		}
+	}
+}
+
+// pages that are not resident point at the closest coarser page that is
+void VirtualTextureCache::RebuildPageTable(uint32_t id)
+{
+	VirtualTexture& vt = m_textures[id];
+	const PhysicalAtlas& atlas = m_atlases[vt.atlas];
+	for (int32_t mip(int32_t(vt.tailMip)); mip >= 0; --mip)
+	{
+		const uint32_t pagesX = PagesX(vt, mip);
+		const uint32_t pagesY = PagesY(vt, mip);
+		for (uint32_t pageY(0); pageY < pagesY; ++pageY)
+		{
+			for (uint32_t pageX(0); pageX < pagesX; ++pageX)
+			{
+				uint32_t& entry = m_pageTableData[vt.mipOffsets[mip] + pageY * pagesX + pageX];
+				auto it = atlas.pages.find(PageKey(id, mip, pageX, pageY));
+				if (it != atlas.pages.end())
+				{
+					entry = (it->second % kAtlasSlots) | ((it->second / kAtlasSlots) << 8) | (uint32_t(mip) << 16);
+					continue;
+				}
+
+				assert(uint32_t(mip) < vt.tailMip);
+				const uint32_t parentPagesX = PagesX(vt, mip + 1);
+				const uint32_t parentX = std::min(pageX >> 1, parentPagesX - 1);
+				const uint32_t parentY = std::min(pageY >> 1, PagesY(vt, mip + 1) - 1);
+				entry = m_pageTableData[vt.mipOffsets[mip + 1] + parentY * parentPagesX + parentX];
+			}
+		}
+	}
+	vt.isDirty = false;
+}
+
+void VirtualTextureCache::FlushPageTable()
+{
+	bool hasChanges = false;
+	for (uint32_t i(0); i < m_textures.size(); ++i)
+	{
+		if (m_textures[i].isDirty)
+		{
+			RebuildPageTable(i);
+			hasChanges = true;
+		}
+	}
+
+	if (hasChanges)
+	{
+		m_pageTable.Load(m_pageTableData);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "modelloader.hpp"
+#include "../vulkan/vktexture.hpp"
+#include "../vulkan/vkbuffer.hpp"
+
+
+// Block compressed textures sampled through a page table. A page is 128x128 texels of one mip
+// with a one block border, pages live in a fixed atlas per format, so video memory does not grow
+// with the scene. The first mip that fits a single page is pinned, finer pages are requested by
+// the gbuffer feedback and evicted least recently used first. The cooked mips of every texture
+// stay in system memory.
+class VirtualTextureCache
+{
+public:
+	static constexpr uint32_t kPageSize = 128;
+	static constexpr uint32_t kPageBorder = 4;
+	static constexpr uint32_t kSlotSize = kPageSize + 2 * kPageBorder;
+	static constexpr uint32_t kAtlasSlots = 30;					// per side, 4080 texels
+	static constexpr uint32_t kMaxTextures = 1024;
+	static constexpr uint32_t kPageTableEntries = 1 << 18;
+	static constexpr uint32_t kPagesPerFrame = 16;
+
+	void Create();
+
+	// returns the id the shader and the feedback use, UINT32_MAX when the page table is full
+	uint32_t AddTexture(CookedTexture&& texture);
+
+	// feedback entries are (id + 1) << 20 | mip << 16 | page y << 8 | page x, zero is no request
+	void Update(const std::vector<uint32_t>& feedback, uint32_t frame);
+
+	const Texture& Atlas(EPixelFormat format) const;
+	inline const Buffer& PageTable() const { return m_pageTable; }
+	inline const Buffer& Textures() const { return m_textureInfo; }
+
+private:
+	// matches VirtualTexture in include/virtualtexture.almfx
+	struct GpuTexture
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t tailMip;
+		uint32_t pageTableOffset;
+	};
+
+	struct VirtualTexture
+	{
+		CookedTexture data;
+		uint32_t atlas{ 0 };
+		uint32_t tailMip{ 0 };
+		std::vector<uint32_t> mipOffsets;		// page table entry of the first page of every mip
+		bool isDirty{ false };
+	};
+
+	struct Slot
+	{
+		uint32_t page{ 0 };						// feedback key, zero when free
+		uint32_t lastUsed{ 0 };
+		bool isPinned{ false };
+	};
+
+	struct PhysicalAtlas
+	{
+		Texture texture;
+		std::vector<Slot> slots;
+		std::unordered_map<uint32_t, uint32_t> pages;		// feedback key -> slot
+	};
+
+	uint32_t PagesX(const VirtualTexture& texture, uint32_t mip) const;
+	uint32_t PagesY(const VirtualTexture& texture, uint32_t mip) const;
+	uint32_t FindSlot(const PhysicalAtlas& atlas, uint32_t frame) const;
+	void CopyPage(const VirtualTexture& texture, uint32_t mip, uint32_t pageX, uint32_t pageY, uint8_t* pOut) const;
+	void UploadPages(const std::vector<uint32_t>& pages, uint32_t frame, bool isPinned);
+	void RebuildPageTable(uint32_t id);
+	void FlushPageTable();
+
+private:
+	PhysicalAtlas m_atlases[2];					// BC7 color, BC5 normals
+	std::vector<VirtualTexture> m_textures;
+	std::vector<uint32_t> m_pageTableData;
+	uint32_t m_pageTableSize{ 0 };
+	std::vector<GpuTexture> m_textureData;
+	Buffer m_pageTable{ EBufferType::Storage };
+	Buffer m_textureInfo{ EBufferType::Storage };
+};
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "workerpool.hpp"
+#include <atomic>
+#include <algorithm>
+
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+{
+	threadCount = std::max(threadCount, 1u);
+	m_threads.reserve(threadCount);
+	for (uint32_t i(0); i < threadCount; ++i)
+	{
+		m_threads.emplace_back(&WorkerPool::WorkerLoop, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isStopping = true;
+	}
+	m_jobAdded.notify_all();
+
+	for (std::thread& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void WorkerPool::Submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+		++m_pendingJobs;
+	}
+	m_jobAdded.notify_one();
+}
+
+void WorkerPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_jobsDone.wait(lock, [this]() { return m_pendingJobs == 0; });
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& func)
+{
+	std::atomic<size_t> next{ 0 };
+	const size_t jobCount = std::min<size_t>(count, m_threads.size());
+	for (size_t i(0); i < jobCount; ++i)
+	{
+		Submit([&next, &func, count]() {
+			for (size_t index = next++; index < count; index = next++)
+			{
+				func(index);
+			}
+		});
+	}
+
+	Wait();
+}
+
+void WorkerPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobAdded.wait(lock, [this]() { return m_isStopping || !m_jobs.empty(); });
+			if (m_jobs.empty())
+			{
+				return;
+			}
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_pendingJobs == 0)
+			{
+				m_jobsDone.notify_all();
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+// Fixed set of worker threads for import work, jobs run in submission order.
+class WorkerPool
+{
+public:
+	explicit WorkerPool(uint32_t threadCount = std::thread::hardware_concurrency());
+	~WorkerPool();
+
+	void Submit(std::function<void()> job);
+
+	// blocks until every submitted job is finished
+	void Wait();
+
+	// calls func(i) for every i in [0, count) and waits, indices are handed out one at a time
+	void ParallelFor(size_t count, const std::function<void(size_t)>& func);
+
+	inline uint32_t ThreadCount() const { return uint32_t(m_threads.size()); }
+
+public:
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+private:
+	void WorkerLoop();
+
+private:
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_jobAdded;
+	std::condition_variable m_jobsDone;
+	size_t m_pendingJobs{ 0 };
+	bool m_isStopping{ false };
+};
\ No newline at end of file
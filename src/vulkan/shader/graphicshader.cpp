@@ -114,44 +114,46 @@ void ShaderGraphics::CreateGraphicsPso(VulkanShader& shader, PipeStateObj& pipel
 
 
 
-	VkVertexInputBindingDescription vertexBindingDescriptions = {};
+	std::vector<VkVertexInputBindingDescription> vertexBindingDescriptions;
 	std::vector<VkVertexInputAttributeDescription> attributeDescription;
 	if (renderState.hasInputAttachment)
 	{
-		vertexBindingDescriptions.binding = 0;
-		vertexBindingDescriptions.stride = sizeof(Vertex);
-		vertexBindingDescriptions.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-		attributeDescription.resize(5);
-		attributeDescription[0].binding = 0;
-		attributeDescription[0].location = 0;
-		attributeDescription[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescription[0].offset = 0;
-
-		attributeDescription[1].binding = 0;
-		attributeDescription[1].location = 1;
-		attributeDescription[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescription[1].offset = 12;
-
-		attributeDescription[2].binding = 0;
-		attributeDescription[2].location = 2;
-		attributeDescription[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescription[2].offset = 24;
-
-		attributeDescription[3].binding = 0;
-		attributeDescription[3].location = 3;
-		attributeDescription[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescription[3].offset = 36;
-
-		attributeDescription[4].binding = 0;
-		attributeDescription[4].location = 4;
-		attributeDescription[4].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescription[4].offset = 48;
+		const bool isCompact = renderState.vertexFormat == EVertexFormat::Compact;
+
+		vertexBindingDescriptions.push_back({ 0, PositionStride(renderState.vertexFormat), VK_VERTEX_INPUT_RATE_VERTEX });
+		attributeDescription.push_back({ 0, 0, PositionFormat(renderState.vertexFormat), 0 });
+
+		if (renderState.hasAttributeStream && isCompact)
+		{
+			vertexBindingDescriptions.push_back({ 1, AttributeStride(renderState.vertexFormat), VK_VERTEX_INPUT_RATE_VERTEX });
+			attributeDescription.push_back({ 1, 1, VK_FORMAT_R16G16_SNORM, offsetof(CompactAttributes, nx) });
+			attributeDescription.push_back({ 2, 1, VK_FORMAT_R8G8B8A8_SNORM, offsetof(CompactAttributes, tx) });
+			attributeDescription.push_back({ 3, 1, VK_FORMAT_R16G16_SFLOAT, offsetof(CompactAttributes, uv) });
+		}
+		else if (renderState.hasAttributeStream)
+		{
+			vertexBindingDescriptions.push_back({ 1, AttributeStride(renderState.vertexFormat), VK_VERTEX_INPUT_RATE_VERTEX });
+			attributeDescription.push_back({ 1, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexAttributes, nx) });
+			attributeDescription.push_back({ 2, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexAttributes, tx) });
+			attributeDescription.push_back({ 3, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexAttributes, bx) });
+			attributeDescription.push_back({ 4, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(VertexAttributes, uv) });
+		}
+
+		if (renderState.hasInstanceStream)
+		{
+			const uint32_t binding = uint32_t(vertexBindingDescriptions.size());
+			const uint32_t location = uint32_t(attributeDescription.size());
+			vertexBindingDescriptions.push_back({ binding, sizeof(InstanceTransform), VK_VERTEX_INPUT_RATE_INSTANCE });
+			for (uint32_t row(0); row < 3; ++row)
+			{
+				attributeDescription.push_back({ location + row, binding, VK_FORMAT_R32G32B32A32_SFLOAT, uint32_t(sizeof(float) * 4 * row) });
+			}
+		}
 	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
-	vertexInputStateCreateInfo.vertexBindingDescriptionCount = 1;
-	vertexInputStateCreateInfo.pVertexBindingDescriptions = &vertexBindingDescriptions;
+	vertexInputStateCreateInfo.vertexBindingDescriptionCount = uint32_t(vertexBindingDescriptions.size());
+	vertexInputStateCreateInfo.pVertexBindingDescriptions = vertexBindingDescriptions.data();
 	vertexInputStateCreateInfo.vertexAttributeDescriptionCount = uint32_t(attributeDescription.size());
 	vertexInputStateCreateInfo.pVertexAttributeDescriptions = attributeDescription.data();
 
@@ -190,7 +192,10 @@ RenderState::RenderState()
 	, fillMode(EFillMode::Fill)
 	, frontFace(EFrontFace::CCW)
 	, depthFunc(EDepthFunc::Less)
+	, vertexFormat(EVertexFormat::Full)
 	, hasInputAttachment(true)
+	, hasAttributeStream(true)
+	, hasInstanceStream(false)
 	, depthWrite(true)
 {
 	
@@ -206,6 +211,9 @@ uint64_t RenderState::Hash() const
 	hash += uint64_t(depthFunc) * 10000;
 	hash += uint64_t(hasInputAttachment) * 100000;
 	hash += uint64_t(depthWrite) * 1000000;
+	hash += uint64_t(vertexFormat) * 10000000;
+	hash += uint64_t(hasAttributeStream) * 100000000;
+	hash += uint64_t(hasInstanceStream) * 1000000000;
 
 	return hash;
 }
\ No newline at end of file
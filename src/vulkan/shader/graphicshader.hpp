@@ -9,7 +9,10 @@ struct RenderState
 	EFillMode fillMode;
 	EFrontFace frontFace;
 	EDepthFunc depthFunc;
+	EVertexFormat vertexFormat;
 	bool hasInputAttachment : 1;
+	bool hasAttributeStream : 1;		// positions only when false
+	bool hasInstanceStream : 1;			// InstanceTransform per instance after the vertex streams
 	bool depthWrite : 1;
 
 	RenderState();
@@ -217,4 +217,22 @@ void ShaderRaytrace::Draw(VkCommandBuffer commandBuffer, uint32_t width, uint32_
 		&emptySbtEntry,
 		width, height, 1
 	);
+}
+
+void ShaderRaytrace::DrawIndirect(VkCommandBuffer commandBuffer, VkDeviceAddress argsAddress)
+{
+	static PFN_vkCmdTraceRaysIndirectKHR vkCmdTraceRaysIndirect = (PFN_vkCmdTraceRaysIndirectKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdTraceRaysIndirectKHR");
+	assert(vkCmdTraceRaysIndirect != nullptr);
+
+	auto& pipelineAndTables = CompileStages(m_bitmask).GetPso<PipeStateObjWithShaderBindTable>();
+
+	VkStridedDeviceAddressRegionKHR emptySbtEntry = {};
+	vkCmdTraceRaysIndirect(
+		commandBuffer,
+		&pipelineAndTables.tableRaygenAddressRegion,
+		&pipelineAndTables.tableMissAddressRegion,
+		&pipelineAndTables.tableHitAddressRegion,
+		&emptySbtEntry,
+		argsAddress
+	);
 }
\ No newline at end of file
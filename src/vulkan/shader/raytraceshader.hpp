@@ -32,6 +32,8 @@ public:
 	void Bind(VkCommandBuffer commandBuffer) override;
 
 	void Draw(VkCommandBuffer commandBuffer, uint32_t width, uint32_t height);
+	// the launch size is read from a VkTraceRaysIndirectCommandKHR on the gpu
+	void DrawIndirect(VkCommandBuffer commandBuffer, VkDeviceAddress argsAddress);
 
 private:
 	void CreatePipeline(VulkanShader& shader, PipeStateObjWithShaderBindTable& pipelineAndTables, uint32_t descriptorSetMask);
@@ -1,6 +1,93 @@
 #include "vkacstructure.hpp"
 #include "vkutils.hpp"
 #include <cassert>
+#include <thread>
+
+
+
+AccStructScratch::AccStructScratch()
+	: m_vkBuffer(VK_NULL_HANDLE)
+	, m_vkMemory(VK_NULL_HANDLE)
+	, m_size(0)
+	, m_address(0)
+{
+}
+
+AccStructScratch::AccStructScratch(AccStructScratch&& scratch) noexcept
+	: AccStructScratch()
+{
+	*this = std::move(scratch);
+}
+
+AccStructScratch& AccStructScratch::operator=(AccStructScratch&& scratch) noexcept
+{
+	std::swap(m_vkBuffer, scratch.m_vkBuffer);
+	std::swap(m_vkMemory, scratch.m_vkMemory);
+	std::swap(m_size, scratch.m_size);
+	std::swap(m_address, scratch.m_address);
+	return *this;
+}
+
+AccStructScratch::~AccStructScratch()
+{
+	Free();
+}
+
+VkDeviceSize AccStructScratch::Alignment()
+{
+	static VkDeviceSize alignment = 0;
+	if (alignment == 0)
+	{
+		VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationProps = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+		VkPhysicalDeviceProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		properties.pNext = &accelerationProps;
+		vkGetPhysicalDeviceProperties2(VkGlobals::vkGPU, &properties);
+		alignment = std::max<VkDeviceSize>(accelerationProps.minAccelerationStructureScratchOffsetAlignment, 1);
+	}
+	return alignment;
+}
+
+void AccStructScratch::Reserve(VkDeviceSize size)
+{
+	if (size <= m_size)
+	{
+		return;
+	}
+	Free();
+
+	// the buffer itself may be less aligned than the builds need, the slack moves the address up
+	const VkDeviceSize alignment = Alignment();
+	VkBufferCreateInfo scratchBufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	scratchBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	scratchBufferInfo.size = size + alignment - 1;
+	VK_ASSERT(vkCreateBuffer(VkGlobals::vkDevice, &scratchBufferInfo, VkGlobals::vkAllocatorCallback, &m_vkBuffer));
+
+	m_vkMemory = VulkanEngine::AllocateMemory(m_vkBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
+	VK_ASSERT(vkBindBufferMemory(VkGlobals::vkDevice, m_vkBuffer, m_vkMemory, 0));
+
+	VkBufferDeviceAddressInfo addressInfo = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+	addressInfo.buffer = m_vkBuffer;
+	m_address = (vkGetBufferDeviceAddress(VkGlobals::vkDevice, &addressInfo) + alignment - 1) & ~(alignment - 1);
+	m_size = size;
+}
+
+void AccStructScratch::Free()
+{
+	if (m_vkMemory != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(VkGlobals::vkDevice, m_vkMemory, VkGlobals::vkAllocatorCallback);
+		m_vkMemory = VK_NULL_HANDLE;
+	}
+	if (m_vkBuffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(VkGlobals::vkDevice, m_vkBuffer, VkGlobals::vkAllocatorCallback);
+		m_vkBuffer = VK_NULL_HANDLE;
+	}
+	m_size = 0;
+	m_address = 0;
+}
+
+
 
 
 
@@ -8,17 +95,21 @@ AccelerationStructure::AccelerationStructure()
 	: m_vkAcBuffer(VK_NULL_HANDLE)
 	, m_vkAcBufferMemory(VK_NULL_HANDLE)
 	, m_vkAccelerationStructure(VK_NULL_HANDLE)
+	, m_kind(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR)
+	, m_size(0)
+	, m_flags(0)
+	, m_vkInstanceBuffer(VK_NULL_HANDLE)
+	, m_vkInstanceMemory(VK_NULL_HANDLE)
+	, m_pInstances(nullptr)
+	, m_instanceCount(0)
+	, m_scratch()
 {
 }
 
 AccelerationStructure::AccelerationStructure(AccelerationStructure&& acstructure) noexcept
-	: m_vkAcBuffer(acstructure.m_vkAcBuffer)
-	, m_vkAcBufferMemory(acstructure.m_vkAcBufferMemory)
-	, m_vkAccelerationStructure(acstructure.m_vkAccelerationStructure)
+	: AccelerationStructure()
 {
-	acstructure.m_vkAcBuffer = VK_NULL_HANDLE;
-	acstructure.m_vkAcBufferMemory = VK_NULL_HANDLE;
-	acstructure.m_vkAccelerationStructure = VK_NULL_HANDLE;
+	*this = std::move(acstructure);
 }
 
 AccelerationStructure& AccelerationStructure::operator = (AccelerationStructure && acstructure) noexcept
@@ -26,10 +117,23 @@ AccelerationStructure& AccelerationStructure::operator = (AccelerationStructure
 	std::swap(m_vkAcBuffer, acstructure.m_vkAcBuffer);
 	std::swap(m_vkAcBufferMemory, acstructure.m_vkAcBufferMemory);
 	std::swap(m_vkAccelerationStructure, acstructure.m_vkAccelerationStructure);
+	std::swap(m_kind, acstructure.m_kind);
+	std::swap(m_size, acstructure.m_size);
+	std::swap(m_flags, acstructure.m_flags);
+	std::swap(m_vkInstanceBuffer, acstructure.m_vkInstanceBuffer);
+	std::swap(m_vkInstanceMemory, acstructure.m_vkInstanceMemory);
+	std::swap(m_pInstances, acstructure.m_pInstances);
+	std::swap(m_instanceCount, acstructure.m_instanceCount);
+	std::swap(m_scratch, acstructure.m_scratch);
 	return *this;
 }
 
 AccelerationStructure::~AccelerationStructure()
+{
+	Free();
+}
+
+void AccelerationStructure::Free()
 {
 	static PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructure = (PFN_vkDestroyAccelerationStructureKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkDestroyAccelerationStructureKHR");
 	assert(vkDestroyAccelerationStructure != nullptr);
@@ -49,6 +153,19 @@ AccelerationStructure::~AccelerationStructure()
 		vkDestroyBuffer(VkGlobals::vkDevice, m_vkAcBuffer, VkGlobals::vkAllocatorCallback);
 		m_vkAcBuffer = VK_NULL_HANDLE;
 	}
+	if (m_vkInstanceMemory != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(VkGlobals::vkDevice, m_vkInstanceMemory, VkGlobals::vkAllocatorCallback);
+		m_vkInstanceMemory = VK_NULL_HANDLE;
+		m_pInstances = nullptr;
+		m_instanceCount = 0;
+	}
+	if (m_vkInstanceBuffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(VkGlobals::vkDevice, m_vkInstanceBuffer, VkGlobals::vkAllocatorCallback);
+		m_vkInstanceBuffer = VK_NULL_HANDLE;
+	}
+	m_scratch.Free();
 }
 
 
@@ -72,6 +189,170 @@ VkDeviceAddress AccelerationStructure::GetBufferAddress() const
 	return vkGetBufferDeviceAddress(VkGlobals::vkDevice, &pInfo);
 }
 
+void AccelerationStructure::Create(VkAccelerationStructureTypeKHR kind, VkDeviceSize size, bool isHostBuild)
+{
+	static PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructure = (PFN_vkCreateAccelerationStructureKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCreateAccelerationStructureKHR");
+	assert(vkCreateAccelerationStructure != nullptr);
+
+	m_kind = kind;
+	m_size = size;
+
+	// create buffer for accelerationStructure
+	VkBufferCreateInfo accelerationBufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	accelerationBufferInfo.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	accelerationBufferInfo.size = size;
+	vkCreateBuffer(VkGlobals::vkDevice, &accelerationBufferInfo, VkGlobals::vkAllocatorCallback, &m_vkAcBuffer);
+
+	// the cpu writes host built structures straight into their memory
+	const VkMemoryPropertyFlags memoryProperties = isHostBuild ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	m_vkAcBufferMemory = VulkanEngine::AllocateMemory(m_vkAcBuffer, memoryProperties, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
+
+	vkBindBufferMemory(VkGlobals::vkDevice, m_vkAcBuffer, m_vkAcBufferMemory, 0);
+
+	// create acceleration structure
+	VkAccelerationStructureCreateInfoKHR structureInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+	structureInfo.type = kind;
+	structureInfo.buffer = m_vkAcBuffer;
+	structureInfo.size = size;
+
+	vkCreateAccelerationStructure(VkGlobals::vkDevice, &structureInfo, VkGlobals::vkAllocatorCallback, &m_vkAccelerationStructure);
+}
+
+VkDeviceSize AccelerationStructure::Compact(const std::vector<AccelerationStructure*>& structures)
+{
+	static PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresProperties = (PFN_vkCmdWriteAccelerationStructuresPropertiesKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdWriteAccelerationStructuresPropertiesKHR");
+	static PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructure = (PFN_vkCmdCopyAccelerationStructureKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdCopyAccelerationStructureKHR");
+	assert(vkCmdWriteAccelerationStructuresProperties != nullptr);
+	assert(vkCmdCopyAccelerationStructure != nullptr);
+
+	if (structures.empty())
+	{
+		return 0;
+	}
+
+	const uint32_t count = uint32_t(structures.size());
+	std::vector<VkAccelerationStructureKHR> handles(count);
+	for (uint32_t i(0); i < count; ++i)
+	{
+		handles[i] = structures[i]->m_vkAccelerationStructure;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+	queryPoolInfo.queryCount = count;
+	VkQueryPool vkQueryPool = VK_NULL_HANDLE;
+	VK_ASSERT(vkCreateQueryPool(VkGlobals::vkDevice, &queryPoolInfo, VkGlobals::vkAllocatorCallback, &vkQueryPool));
+
+	VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
+		vkCmdResetQueryPool(commandBuffer, vkQueryPool, 0, count);
+		VulkanEngine::PipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+			VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+		vkCmdWriteAccelerationStructuresProperties(commandBuffer, count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, vkQueryPool, 0);
+	});
+
+	std::vector<VkDeviceSize> compactedSizes(count);
+	VK_ASSERT(vkGetQueryPoolResults(VkGlobals::vkDevice, vkQueryPool, 0, count, sizeof(VkDeviceSize) * count, compactedSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+	vkDestroyQueryPool(VkGlobals::vkDevice, vkQueryPool, VkGlobals::vkAllocatorCallback);
+
+	std::vector<AccelerationStructure> compacted(count);
+	VkDeviceSize savedBytes = 0;
+	for (uint32_t i(0); i < count; ++i)
+	{
+		assert(compactedSizes[i] > 0 && compactedSizes[i] <= structures[i]->m_size);
+		compacted[i].Create(structures[i]->m_kind, compactedSizes[i]);
+		savedBytes += structures[i]->m_size - compactedSizes[i];
+	}
+
+	VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
+		for (uint32_t i(0); i < count; ++i)
+		{
+			VkCopyAccelerationStructureInfoKHR copyInfo = { VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+			copyInfo.src = structures[i]->m_vkAccelerationStructure;
+			copyInfo.dst = compacted[i].m_vkAccelerationStructure;
+			copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+			vkCmdCopyAccelerationStructure(commandBuffer, &copyInfo);
+		}
+	});
+
+	// the copies are done, the full size originals go away with the swapped out objects
+	for (uint32_t i(0); i < count; ++i)
+	{
+		*structures[i] = std::move(compacted[i]);
+	}
+	return savedBytes;
+}
+
+void AccelerationStructure::CreateInstanceBuffer(const std::vector<VkAccelerationStructureInstanceKHR>& instances)
+{
+	m_instanceCount = uint32_t(instances.size());
+	const VkDeviceSize instancesSize = sizeof(VkAccelerationStructureInstanceKHR) * instances.size();
+
+	VkBufferCreateInfo accelerationInstanceBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	accelerationInstanceBufferCreateInfo.usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+	accelerationInstanceBufferCreateInfo.size = instancesSize;
+	VK_ASSERT(vkCreateBuffer(VkGlobals::vkDevice, &accelerationInstanceBufferCreateInfo, VkGlobals::vkAllocatorCallback, &m_vkInstanceBuffer));
+
+	m_vkInstanceMemory = VulkanEngine::AllocateMemory(m_vkInstanceBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
+
+	VK_ASSERT(vkBindBufferMemory(VkGlobals::vkDevice, m_vkInstanceBuffer, m_vkInstanceMemory, 0));
+	void* pMapped = nullptr;
+	VK_ASSERT(vkMapMemory(VkGlobals::vkDevice, m_vkInstanceMemory, VkDeviceSize(0), instancesSize, 0, &pMapped));
+	m_pInstances = static_cast<VkAccelerationStructureInstanceKHR*>(pMapped);
+	memcpy(m_pInstances, instances.data(), size_t(instancesSize));
+}
+
+VkAccelerationStructureGeometryKHR AccelerationStructure::InstanceGeometry() const
+{
+	VkBufferDeviceAddressInfoKHR accelerationInstanceBufferAddresInfo = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+	accelerationInstanceBufferAddresInfo.buffer = m_vkInstanceBuffer;
+
+	VkAccelerationStructureGeometryKHR instanceGeometry = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+	instanceGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+	instanceGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+	instanceGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+	instanceGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
+	instanceGeometry.geometry.instances.data.deviceAddress = vkGetBufferDeviceAddress(VkGlobals::vkDevice, &accelerationInstanceBufferAddresInfo);
+	return instanceGeometry;
+}
+
+void AccelerationStructure::Refit(VkCommandBuffer commandBuffer, const std::vector<VkAccelerationStructureInstanceKHR>& instances)
+{
+	static PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructures = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdBuildAccelerationStructuresKHR");
+	assert(vkCmdBuildAccelerationStructures != nullptr);
+	assert(m_kind == VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR && (m_flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR));
+	assert(m_pInstances != nullptr && instances.size() == m_instanceCount);
+
+	// the previous frame is done with the instances, host coherent writes are visible at submit
+	memcpy(m_pInstances, instances.data(), sizeof(VkAccelerationStructureInstanceKHR) * instances.size());
+
+	const VkAccelerationStructureGeometryKHR instanceGeometry = InstanceGeometry();
+
+	VkAccelerationStructureBuildGeometryInfoKHR buildInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+	buildInfo.type = m_kind;
+	buildInfo.flags = m_flags;
+	buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+	buildInfo.srcAccelerationStructure = m_vkAccelerationStructure;
+	buildInfo.dstAccelerationStructure = m_vkAccelerationStructure;
+	buildInfo.geometryCount = 1;
+	buildInfo.pGeometries = &instanceGeometry;
+	buildInfo.scratchData.deviceAddress = m_scratch.GetAddress();
+
+	VkAccelerationStructureBuildRangeInfoKHR range = {};
+	range.primitiveCount = m_instanceCount;
+	const VkAccelerationStructureBuildRangeInfoKHR* pRange = &range;
+
+	// the previous trace read the structure that is updated in place, ray pipelines and ray queries alike
+	const VkPipelineStageFlags2 traceStages = VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	VulkanEngine::PipelineBarrier(commandBuffer,
+		traceStages, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+		VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+	vkCmdBuildAccelerationStructures(commandBuffer, 1, &buildInfo, &pRange);
+	VulkanEngine::PipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+		traceStages, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+}
+
 
 
 
@@ -79,11 +360,13 @@ VkDeviceAddress AccelerationStructure::GetBufferAddress() const
 AccStructBuilder::AccStructBuilder(AccelerationStructure* pAccStructure, VkAccelerationStructureTypeKHR kind)
 	: m_pAccStructure(pAccStructure)
 	, m_kind(kind)
+	, m_flags(0)
 	, m_primitivesCount()
 	, m_geometries()
 	, m_ranges()
-	, m_instanceBuffers()
-	, m_instanceBuffersMemory()
+	, m_instances()
+	, m_buildInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR }
+	, m_buildSizes{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR }
 {
 }
 
@@ -93,6 +376,24 @@ AccStructBuilder::~AccStructBuilder()
 
 
 AccStructBuilder& AccStructBuilder::AddTriangles(const Buffer& vertices, const Buffer& indices)
+{
+	VkDeviceOrHostAddressConstKHR vertexData = {};
+	VkDeviceOrHostAddressConstKHR indexData = {};
+	vertexData.deviceAddress = vertices.GetDeviceAddress();
+	indexData.deviceAddress = indices.GetDeviceAddress();
+	return AddTriangles(vertexData, indexData);
+}
+
+AccStructBuilder& AccStructBuilder::AddTriangles(const void* pVertices, const void* pIndices)
+{
+	VkDeviceOrHostAddressConstKHR vertexData = {};
+	VkDeviceOrHostAddressConstKHR indexData = {};
+	vertexData.hostAddress = pVertices;
+	indexData.hostAddress = pIndices;
+	return AddTriangles(vertexData, indexData);
+}
+
+AccStructBuilder& AccStructBuilder::AddTriangles(VkDeviceOrHostAddressConstKHR vertexData, VkDeviceOrHostAddressConstKHR indexData)
 {
 	VkAccelerationStructureGeometryKHR modelGeometry = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
 	modelGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
@@ -100,8 +401,8 @@ AccStructBuilder& AccStructBuilder::AddTriangles(const Buffer& vertices, const B
 	modelGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
 	modelGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
 	modelGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-	modelGeometry.geometry.triangles.indexData.deviceAddress = indices.GetDeviceAddress();
-	modelGeometry.geometry.triangles.vertexData.deviceAddress = vertices.GetDeviceAddress();
+	modelGeometry.geometry.triangles.indexData = indexData;
+	modelGeometry.geometry.triangles.vertexData = vertexData;
 	modelGeometry.geometry.triangles.maxVertex = 0;
 	modelGeometry.geometry.triangles.vertexStride = 0;
 	//VkDeviceOrHostAddressConstKHR    transformData; Indicate identity transform by setting transformData to null device pointer.
@@ -137,8 +438,26 @@ AccStructBuilder& AccStructBuilder::Stride(uint32_t stride)
 	return *this;
 }
 
+AccStructBuilder& AccStructBuilder::VertexFormat(VkFormat format)
+{
+	m_geometries.back().geometry.triangles.vertexFormat = format;
+	return *this;
+}
+
+AccStructBuilder& AccStructBuilder::IndexType(VkIndexType indexType)
+{
+	m_geometries.back().geometry.triangles.indexType = indexType;
+	return *this;
+}
 
-AccStructBuilder AccStructBuilder::AddAccelerationStructure(AccelerationStructure* blac)
+AccStructBuilder& AccStructBuilder::Flags(VkBuildAccelerationStructureFlagsKHR flags)
+{
+	m_flags = flags;
+	return *this;
+}
+
+
+AccStructBuilder& AccStructBuilder::AddAccelerationStructure(AccelerationStructure* blac)
 {
 	VkTransformMatrixKHR transformMatrix = {
 		1, 0, 0, 0,
@@ -146,142 +465,260 @@ AccStructBuilder AccStructBuilder::AddAccelerationStructure(AccelerationStructur
 		0, 0, 1, 0,
 	};
 
+	return AddAccelerationStructure(blac, transformMatrix);
+}
+
+AccStructBuilder& AccStructBuilder::AddAccelerationStructure(AccelerationStructure* blac, const VkTransformMatrixKHR& transform, uint32_t mask)
+{
 	VkAccelerationStructureInstanceKHR acInstance = {};
-	acInstance.transform = transformMatrix;
-	acInstance.instanceCustomIndex = 0;
-	acInstance.mask = 0xFF;
+	acInstance.transform = transform;
+	acInstance.instanceCustomIndex = uint32_t(m_instances.size());
+	acInstance.mask = mask;
 	acInstance.instanceShaderBindingTableRecordOffset = 0;
 	acInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
 	acInstance.accelerationStructureReference = blac->GetAddress();
 
-	VkBuffer accelerationInstanceBuffer = VK_NULL_HANDLE;
-	VkBufferCreateInfo accelerationInstanceBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-	accelerationInstanceBufferCreateInfo.usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-	accelerationInstanceBufferCreateInfo.size = sizeof(VkAccelerationStructureInstanceKHR);
-	VK_ASSERT(vkCreateBuffer(VkGlobals::vkDevice, &accelerationInstanceBufferCreateInfo, VkGlobals::vkAllocatorCallback, &accelerationInstanceBuffer));
+	m_instances.push_back(acInstance);
 
-	VkDeviceMemory accelerationInstanceBufferMemoty = VulkanEngine::AllocateMemory(accelerationInstanceBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
-
-	VK_ASSERT(vkBindBufferMemory(VkGlobals::vkDevice, accelerationInstanceBuffer, accelerationInstanceBufferMemoty, 0));
-	void* pMapped = nullptr;
-	vkMapMemory(VkGlobals::vkDevice, accelerationInstanceBufferMemoty, VkDeviceSize(0), sizeof(VkAccelerationStructureInstanceKHR), 0, &pMapped);
-	memcpy(pMapped, &acInstance, sizeof(VkAccelerationStructureInstanceKHR));
-
-
-	VkBufferDeviceAddressInfoKHR accelerationInstanceBufferAddresInfo = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
-	accelerationInstanceBufferAddresInfo.buffer = accelerationInstanceBuffer;
-	VkDeviceAddress accelerationInstanceBufferAddress = vkGetBufferDeviceAddress(VkGlobals::vkDevice, &accelerationInstanceBufferAddresInfo);
-
-
-	VkAccelerationStructureGeometryKHR instanceGeometry = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-	instanceGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-	instanceGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-	instanceGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-	instanceGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
-	instanceGeometry.geometry.instances.data.deviceAddress = accelerationInstanceBufferAddress;
+	return *this;
+}
 
+void AccStructBuilder::CreateInstanceGeometry()
+{
+	m_pAccStructure->CreateInstanceBuffer(m_instances);
 
 	VkAccelerationStructureBuildRangeInfoKHR toplevelRange = {};
-	toplevelRange.primitiveCount = 1;
+	toplevelRange.primitiveCount = uint32_t(m_instances.size());
 	toplevelRange.primitiveOffset = 0;
 	toplevelRange.firstVertex = 0;
 	toplevelRange.transformOffset = 0;
 
 	m_ranges.push_back(toplevelRange);
-	m_primitivesCount.push_back(1);
-	m_geometries.push_back(instanceGeometry);
-	m_instanceBuffers.push_back(accelerationInstanceBuffer);
-	m_instanceBuffersMemory.push_back(accelerationInstanceBufferMemoty);
-
-	return *this;
+	m_primitivesCount.push_back(uint32_t(m_instances.size()));
+	m_geometries.push_back(m_pAccStructure->InstanceGeometry());
 }
 
 
-void AccStructBuilder::Build()
+VkDeviceSize AccStructBuilder::Prepare(VkAccelerationStructureBuildTypeKHR buildType)
 {
 	static PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizes = (PFN_vkGetAccelerationStructureBuildSizesKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkGetAccelerationStructureBuildSizesKHR");
-	static PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructure = (PFN_vkCreateAccelerationStructureKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCreateAccelerationStructureKHR");
-	static PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructures = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdBuildAccelerationStructuresKHR");
-
-	assert(vkCmdBuildAccelerationStructures != nullptr);
 	assert(vkGetAccelerationStructureBuildSizes != nullptr);
-	assert(vkCreateAccelerationStructure != nullptr);
 
-	VkAccelerationStructureBuildGeometryInfoKHR buildInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-	buildInfo.type = m_kind;
-	buildInfo.geometryCount = uint32_t(m_geometries.size());
-	buildInfo.pGeometries = m_geometries.data();
-	buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	m_pAccStructure->Free();
+	m_pAccStructure->m_flags = m_flags;
+	if (!m_instances.empty())
+	{
+		CreateInstanceGeometry();
+	}
+
+	m_buildInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+	m_buildInfo.type = m_kind;
+	m_buildInfo.geometryCount = uint32_t(m_geometries.size());
+	m_buildInfo.pGeometries = m_geometries.data();
+	m_buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	m_buildInfo.flags = m_flags;
 
 	// get buffer size for accelerationStructure
-	VkAccelerationStructureBuildSizesInfoKHR accelerationBufferSize = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+	m_buildSizes = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
 	vkGetAccelerationStructureBuildSizes(
 		VkGlobals::vkDevice,
-		VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-		&buildInfo,
+		buildType,
+		&m_buildInfo,
 		m_primitivesCount.data(),
-		&accelerationBufferSize
+		&m_buildSizes
 	);
 
-	// create buffer for accelerationStructure
-	VkBufferCreateInfo accelerationBufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-	accelerationBufferInfo.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-	accelerationBufferInfo.size = accelerationBufferSize.accelerationStructureSize;
-	vkCreateBuffer(VkGlobals::vkDevice, &accelerationBufferInfo, VkGlobals::vkAllocatorCallback, &m_pAccStructure->m_vkAcBuffer);
+	m_pAccStructure->Create(m_kind, m_buildSizes.accelerationStructureSize, buildType == VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR);
+	m_buildInfo.dstAccelerationStructure = m_pAccStructure->m_vkAccelerationStructure;
 
-	m_pAccStructure->m_vkAcBufferMemory = VulkanEngine::AllocateMemory(m_pAccStructure->m_vkAcBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
+	return m_buildSizes.buildScratchSize;
+}
 
-	vkBindBufferMemory(VkGlobals::vkDevice, m_pAccStructure->m_vkAcBuffer, m_pAccStructure->m_vkAcBufferMemory, 0);
+void AccStructBuilder::Build()
+{
+	static PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructures = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdBuildAccelerationStructuresKHR");
+	assert(vkCmdBuildAccelerationStructures != nullptr);
 
-	// create acceleration structure
-	VkAccelerationStructureCreateInfoKHR structureInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
-	structureInfo.type = m_kind;
-	structureInfo.buffer = m_pAccStructure->m_vkAcBuffer;
-	structureInfo.size = accelerationBufferSize.accelerationStructureSize;
+	const VkDeviceSize scratchSize = Prepare();
 
-	vkCreateAccelerationStructure(VkGlobals::vkDevice, &structureInfo, VkGlobals::vkAllocatorCallback, &m_pAccStructure->m_vkAccelerationStructure);
+	// refits reuse the scratch memory of the build, one off builds free theirs right away
+	AccStructScratch scratch;
+	AccStructScratch& buildScratch = (m_flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR) ? m_pAccStructure->m_scratch : scratch;
+	buildScratch.Reserve(std::max(scratchSize, m_buildSizes.updateScratchSize));
+	m_buildInfo.scratchData.deviceAddress = buildScratch.GetAddress();
 
+	// one range per geometry
+	const VkAccelerationStructureBuildRangeInfoKHR* pRanges = m_ranges.data();
+	VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
+		vkCmdBuildAccelerationStructures(commandBuffer, 1, &m_buildInfo, &pRanges);
+	});
+}
 
 
-	VkBuffer stagingAccelerationBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory stagingAccelerationBufferMemory = VK_NULL_HANDLE;
 
-	// create staging buffer for building accelerationStructure
-	VkBufferCreateInfo stagingAccelerationBufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-	stagingAccelerationBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-	stagingAccelerationBufferInfo.size = accelerationBufferSize.accelerationStructureSize;
-	vkCreateBuffer(VkGlobals::vkDevice, &stagingAccelerationBufferInfo, VkGlobals::vkAllocatorCallback, &stagingAccelerationBuffer);
 
-	stagingAccelerationBufferMemory = VulkanEngine::AllocateMemory(stagingAccelerationBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
 
-	vkBindBufferMemory(VkGlobals::vkDevice, stagingAccelerationBuffer, stagingAccelerationBufferMemory, 0);
+AccStructBatch::~AccStructBatch()
+{
+	WaitHostBuild();
+}
 
-	VkBufferDeviceAddressInfoKHR bufferDeviceAddresInfo = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
-	bufferDeviceAddresInfo.buffer = stagingAccelerationBuffer;
-	VkDeviceAddress stagingAccelerationBufferAddress = vkGetBufferDeviceAddress(VkGlobals::vkDevice, &bufferDeviceAddresInfo);
+AccStructBuilder& AccStructBatch::Add(AccelerationStructure* pAccStructure, VkAccelerationStructureTypeKHR kind)
+{
+	m_builders.emplace_back(pAccStructure, kind);
+	return m_builders.back();
+}
+
+void AccStructBatch::Build()
+{
+	static PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructures = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCmdBuildAccelerationStructuresKHR");
+	assert(vkCmdBuildAccelerationStructures != nullptr);
 
+	if (m_builders.empty())
+	{
+		return;
+	}
 
-	buildInfo.dstAccelerationStructure = m_pAccStructure->m_vkAccelerationStructure;
-	buildInfo.scratchData.deviceAddress = stagingAccelerationBufferAddress;
+	const VkDeviceSize alignment = AccStructScratch::Alignment();
+	std::vector<VkDeviceSize> scratchSizes(m_builders.size());
+	VkDeviceSize largestScratch = 0;
+	for (size_t i(0); i < m_builders.size(); ++i)
+	{
+		AccStructBuilder& builder = m_builders[i];
+		scratchSizes[i] = (builder.Prepare() + alignment - 1) & ~(alignment - 1);
+		largestScratch = std::max(largestScratch, scratchSizes[i]);
+		if (builder.m_flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)
+		{
+			builder.m_pAccStructure->m_scratch.Reserve(builder.m_buildSizes.updateScratchSize);
+		}
+	}
+	m_scratch.Reserve(std::max(kScratchPoolSize, largestScratch));
 
 	VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
-		std::vector<VkAccelerationStructureBuildRangeInfoKHR*> copyInfos(m_ranges.size());
-		for (uint32_t i(0); i < m_ranges.size(); ++i) {
-			copyInfos[i] = &m_ranges[i];
+		std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos;
+		std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+		VkDeviceSize scratchOffset = 0;
+
+		const auto flush = [&]() {
+			vkCmdBuildAccelerationStructures(commandBuffer, uint32_t(buildInfos.size()), buildInfos.data(), rangeInfos.data());
+			buildInfos.clear();
+			rangeInfos.clear();
+		};
+
+		for (size_t i(0); i < m_builders.size(); ++i)
+		{
+			if (scratchOffset + scratchSizes[i] > m_scratch.GetSize())
+			{
+				// the pool is full, the next builds overwrite scratch memory the recorded ones still use
+				flush();
+				VulkanEngine::PipelineBarrier(commandBuffer,
+					VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+					VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+				scratchOffset = 0;
+			}
+
+			AccStructBuilder& builder = m_builders[i];
+			builder.m_buildInfo.scratchData.deviceAddress = m_scratch.GetAddress() + scratchOffset;
+			buildInfos.push_back(builder.m_buildInfo);
+			rangeInfos.push_back(builder.m_ranges.data());
+			scratchOffset += scratchSizes[i];
 		}
-		vkCmdBuildAccelerationStructures(commandBuffer, 1, &buildInfo, copyInfos.data());
+		flush();
 	});
 
-	vkFreeMemory(VkGlobals::vkDevice, stagingAccelerationBufferMemory, VkGlobals::vkAllocatorCallback);
-	vkDestroyBuffer(VkGlobals::vkDevice, stagingAccelerationBuffer, VkGlobals::vkAllocatorCallback);
+	m_builders.clear();
+}
 
-	for (VkDeviceMemory& bufferMemory : m_instanceBuffersMemory)
+void AccStructBatch::BuildOnHost(uint32_t threadCount, const ParallelFor& parallelFor)
+{
+	static PFN_vkCreateDeferredOperationKHR vkCreateDeferredOperation = (PFN_vkCreateDeferredOperationKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCreateDeferredOperationKHR");
+	static PFN_vkGetDeferredOperationMaxConcurrencyKHR vkGetDeferredOperationMaxConcurrency = (PFN_vkGetDeferredOperationMaxConcurrencyKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkGetDeferredOperationMaxConcurrencyKHR");
+	static PFN_vkGetDeferredOperationResultKHR vkGetDeferredOperationResult = (PFN_vkGetDeferredOperationResultKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkGetDeferredOperationResultKHR");
+	static PFN_vkDeferredOperationJoinKHR vkDeferredOperationJoin = (PFN_vkDeferredOperationJoinKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkDeferredOperationJoinKHR");
+	static PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructures = (PFN_vkBuildAccelerationStructuresKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkBuildAccelerationStructuresKHR");
+	assert(vkCreateDeferredOperation != nullptr && vkGetDeferredOperationMaxConcurrency != nullptr);
+	assert(vkGetDeferredOperationResult != nullptr && vkDeferredOperationJoin != nullptr);
+	assert(vkBuildAccelerationStructures != nullptr);
+	assert(VulkanEngine::IsHostAccStructBuildSupported());
+
+	if (m_builders.empty() || IsHostBuildPending())
 	{
-		vkFreeMemory(VkGlobals::vkDevice, bufferMemory, VkGlobals::vkAllocatorCallback);
+		return;
 	}
 
-	for (VkBuffer& buffer : m_instanceBuffers)
+	// swapping keeps the builders where they are, their build infos point into them
+	m_hostBuilders.swap(m_builders);
+
+	const size_t count = m_hostBuilders.size();
+	m_hostScratch.resize(count);
+	m_hostBuildInfos.resize(count);
+	m_hostRangeInfos.resize(count);
+	for (size_t i(0); i < count; ++i)
+	{
+		AccStructBuilder& builder = m_hostBuilders[i];
+		assert(!(builder.m_flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR));
+		m_hostScratch[i].resize(size_t(builder.Prepare(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR)));
+		m_hostBuildInfos[i] = builder.m_buildInfo;
+		m_hostBuildInfos[i].scratchData.hostAddress = m_hostScratch[i].data();
+		m_hostRangeInfos[i] = builder.m_ranges.data();
+	}
+
+	VK_ASSERT(vkCreateDeferredOperation(VkGlobals::vkDevice, VkGlobals::vkAllocatorCallback, &m_vkDeferredOperation));
+
+	m_isHostBuildDone = false;
+	m_hostThread = std::thread([this, threadCount, parallelFor]() {
+		const VkResult result = vkBuildAccelerationStructures(VkGlobals::vkDevice, m_vkDeferredOperation, uint32_t(m_hostBuildInfos.size()), m_hostBuildInfos.data(), m_hostRangeInfos.data());
+		if (result == VK_OPERATION_DEFERRED_KHR)
+		{
+			// every worker joins until there is no work left for it, the operation is complete once all of them returned
+			const uint32_t concurrency = std::min(vkGetDeferredOperationMaxConcurrency(VkGlobals::vkDevice, m_vkDeferredOperation), std::max(threadCount, 1u));
+			parallelFor(std::max(concurrency, 1u), [this](size_t) {
+				while (vkDeferredOperationJoin(VkGlobals::vkDevice, m_vkDeferredOperation) == VK_THREAD_IDLE_KHR)
+				{
+					std::this_thread::yield();
+				}
+			});
+			VK_ASSERT(vkGetDeferredOperationResult(VkGlobals::vkDevice, m_vkDeferredOperation));
+		}
+		else if (result != VK_OPERATION_NOT_DEFERRED_KHR)
+		{
+			VK_ASSERT(result);
+		}
+
+		m_isHostBuildDone = true;
+	});
+}
+
+bool AccStructBatch::FinishHostBuild()
+{
+	static PFN_vkDestroyDeferredOperationKHR vkDestroyDeferredOperation = (PFN_vkDestroyDeferredOperationKHR)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkDestroyDeferredOperationKHR");
+	assert(vkDestroyDeferredOperation != nullptr);
+
+	if (!IsHostBuildPending())
+	{
+		return true;
+	}
+	if (!m_isHostBuildDone)
 	{
-		vkDestroyBuffer(VkGlobals::vkDevice, buffer, VkGlobals::vkAllocatorCallback);
+		return false;
 	}
+
+	m_hostThread.join();
+	vkDestroyDeferredOperation(VkGlobals::vkDevice, m_vkDeferredOperation, VkGlobals::vkAllocatorCallback);
+	m_vkDeferredOperation = VK_NULL_HANDLE;
+
+	std::vector<std::vector<uint8_t>>().swap(m_hostScratch);
+	m_hostBuildInfos.clear();
+	m_hostRangeInfos.clear();
+	m_hostBuilders.clear();
+	return true;
 }
+
+void AccStructBatch::WaitHostBuild()
+{
+	if (m_hostThread.joinable())
+	{
+		m_hostThread.join();
+	}
+	FinishHostBuild();
+}
\ No newline at end of file
@@ -2,37 +2,132 @@
 #include "vkengine.hpp"
 #include "vkcommon.hpp"
 #include "vkbuffer.hpp"
+#include <deque>
+#include <thread>
+#include <atomic>
 
 class AccelerationStructure;
 
+// device local scratch memory for builds, the address honours minAccelerationStructureScratchOffsetAlignment
+class AccStructScratch
+{
+public:
+	AccStructScratch();
+	AccStructScratch(AccStructScratch&& scratch) noexcept;
+	~AccStructScratch();
+
+	AccStructScratch& operator=(AccStructScratch&& scratch) noexcept;
+
+	// grows to at least size bytes, keeps the memory when it is large enough already
+	void Reserve(VkDeviceSize size);
+	void Free();
+
+	inline VkDeviceAddress GetAddress() const { return m_address; }
+	inline VkDeviceSize GetSize() const { return m_size; }
+	static VkDeviceSize Alignment();
+
+public:
+	AccStructScratch(const AccStructScratch&) = delete;
+	AccStructScratch& operator=(const AccStructScratch&) = delete;
+
+private:
+	VkBuffer m_vkBuffer;
+	VkDeviceMemory m_vkMemory;
+	VkDeviceSize m_size;
+	VkDeviceAddress m_address;
+};
+
 class AccStructBuilder
 {
+	friend class AccStructBatch;
 public:
 	AccStructBuilder(AccelerationStructure* pAccStructure, VkAccelerationStructureTypeKHR kind);
 	~AccStructBuilder();
 
 	AccStructBuilder& AddTriangles(const Buffer& vertices, const Buffer& indices);
+	// host memory, for builds on the cpu only, the data must outlive the build
+	AccStructBuilder& AddTriangles(const void* pVertices, const void* pIndices);
 	AccStructBuilder& Primitives(uint32_t primitives);
 	AccStructBuilder& MaxVertices(uint32_t maxVertices);
 	AccStructBuilder& Stride(uint32_t stride);
+	AccStructBuilder& VertexFormat(VkFormat format);
+	AccStructBuilder& IndexType(VkIndexType indexType);
+	// PREFER_FAST_TRACE for static geometry, PREFER_FAST_BUILD for what is rebuilt often, ALLOW_COMPACTION to Compact it later
+	AccStructBuilder& Flags(VkBuildAccelerationStructureFlagsKHR flags);
 
-	AccStructBuilder AddAccelerationStructure(AccelerationStructure* blac);
+	// every call adds one instance, all instances go into a single instances geometry
+	AccStructBuilder& AddAccelerationStructure(AccelerationStructure* blac);
+	AccStructBuilder& AddAccelerationStructure(AccelerationStructure* blac, const VkTransformMatrixKHR& transform, uint32_t mask = 0xFF);
 
 	void Build();
 
+private:
+	AccStructBuilder& AddTriangles(VkDeviceOrHostAddressConstKHR vertexData, VkDeviceOrHostAddressConstKHR indexData);
+	void CreateInstanceGeometry();
+	// creates the structure and fills the build info, returns the scratch bytes the build needs
+	VkDeviceSize Prepare(VkAccelerationStructureBuildTypeKHR buildType = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR);
+
 private:
 	AccelerationStructure* m_pAccStructure;
 	VkAccelerationStructureTypeKHR m_kind;
+	VkBuildAccelerationStructureFlagsKHR m_flags;
 	std::vector<uint32_t> m_primitivesCount;
 	std::vector<VkAccelerationStructureGeometryKHR> m_geometries;
 	std::vector<VkAccelerationStructureBuildRangeInfoKHR> m_ranges;
-	std::vector<VkBuffer> m_instanceBuffers;
-	std::vector<VkDeviceMemory> m_instanceBuffersMemory;
+	std::vector<VkAccelerationStructureInstanceKHR> m_instances;
+	VkAccelerationStructureBuildGeometryInfoKHR m_buildInfo;
+	VkAccelerationStructureBuildSizesInfoKHR m_buildSizes;
+};
+
+// Records many builds into one submit. The builds share a scratch pool that is kept between
+// batches, builds that fit the pool together run without barriers between them, a barrier is only
+// placed where the pool wraps around and scratch memory is reused.
+class AccStructBatch
+{
+public:
+	static constexpr VkDeviceSize kScratchPoolSize = 32 * 1024 * 1024;
+	// calls job(i) for every i in [0, count) on worker threads and waits
+	using ParallelFor = std::function<void(size_t count, const std::function<void(size_t)>& job)>;
+
+	AccStructBatch() = default;
+	~AccStructBatch();
+
+	AccStructBuilder& Add(AccelerationStructure* pAccStructure, VkAccelerationStructureTypeKHR kind);
+	inline bool IsEmpty() const { return m_builders.empty(); }
+	void Build();
+	// starts the builds on the cpu as one deferred operation and returns, a background thread joins it with up
+	// to threadCount workers. The geometry must use host addresses and stay valid until FinishHostBuild succeeds.
+	// The structures live in host visible memory, Compact moves them to video memory. Only one host build runs
+	// at a time, builders added meanwhile wait for the next call.
+	void BuildOnHost(uint32_t threadCount, const ParallelFor& parallelFor);
+	inline bool IsHostBuildPending() const { return !m_hostBuilders.empty(); }
+	// true once the pending host build is complete and its structures can be used, never blocks
+	bool FinishHostBuild();
+	// blocks until the pending host build is complete
+	void WaitHostBuild();
+
+public:
+	AccStructBatch(const AccStructBatch&) = delete;
+	AccStructBatch& operator=(const AccStructBatch&) = delete;
+
+private:
+	std::deque<AccStructBuilder> m_builders;		// the builders hold pointers into themselves
+	AccStructScratch m_scratch;
+
+	// the host build in flight
+	std::deque<AccStructBuilder> m_hostBuilders;
+	std::vector<std::vector<uint8_t>> m_hostScratch;
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> m_hostBuildInfos;
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> m_hostRangeInfos;
+	VkDeferredOperationKHR m_vkDeferredOperation{ VK_NULL_HANDLE };
+	std::thread m_hostThread;
+	std::atomic<bool> m_isHostBuildDone{ false };
 };
 
 class AccelerationStructure
 {
 	friend class AccStructBuilder;
+	friend class AccStructBatch;
 public:
 	AccelerationStructure();
 	AccelerationStructure(AccelerationStructure&& acstructure) noexcept;
@@ -43,6 +138,16 @@ public:
 
 	VkDeviceAddress GetAddress() const;
 	VkDeviceAddress GetBufferAddress() const;
+	inline VkDeviceSize GetSize() const { return m_size; }
+
+	inline uint32_t GetInstanceCount() const { return m_instanceCount; }
+
+	// rewrites the transforms and masks of a TLAS built with ALLOW_UPDATE and refits it, the instances
+	// must reference the same BLASes in the same order, anything else needs a new build
+	void Refit(VkCommandBuffer commandBuffer, const std::vector<VkAccelerationStructureInstanceKHR>& instances);
+
+	// copies structures built with ALLOW_COMPACTION into buffers of their compacted size, returns the bytes freed
+	static VkDeviceSize Compact(const std::vector<AccelerationStructure*>& structures);
 
 	AccStructBuilder Builder(VkAccelerationStructureTypeKHR kind) { return AccStructBuilder(this, kind); }
 
@@ -54,8 +159,26 @@ public:
 	AccelerationStructure(const AccelerationStructure&) = delete;
 	AccelerationStructure& operator=(const AccelerationStructure&) = delete;
 
+private:
+	void Create(VkAccelerationStructureTypeKHR kind, VkDeviceSize size, bool isHostBuild = false);
+	void CreateInstanceBuffer(const std::vector<VkAccelerationStructureInstanceKHR>& instances);
+	VkAccelerationStructureGeometryKHR InstanceGeometry() const;
+	void Free();
+
 private:
 	VkBuffer m_vkAcBuffer;
 	VkDeviceMemory m_vkAcBufferMemory;
 	VkAccelerationStructureKHR m_vkAccelerationStructure;
+	VkAccelerationStructureTypeKHR m_kind;
+	VkDeviceSize m_size;
+	VkBuildAccelerationStructureFlagsKHR m_flags;
+
+	// top level only, the instances stay mapped so a refit only rewrites them
+	VkBuffer m_vkInstanceBuffer;
+	VkDeviceMemory m_vkInstanceMemory;
+	VkAccelerationStructureInstanceKHR* m_pInstances;
+	uint32_t m_instanceCount;
+
+	// kept when the structure allows updates, large enough for both a build and an update
+	AccStructScratch m_scratch;
 };
\ No newline at end of file
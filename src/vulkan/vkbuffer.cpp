@@ -55,7 +55,16 @@ void Buffer::Load(const void* pMem, uint32_t size, VkCommandPool commandPool)
 
         if (!m_isCpuCoherent)
         {
-            vbufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+            vbufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+            if (VulkanEngine::IsRaytracingSupported())
+            {
+                vbufferInfo.usage |= VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+            }
+        }
+        else
+        {
+            // mapped buffers also stage copies from and to images
+            vbufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
         }
 
         VK_ASSERT(vkCreateBuffer(VkGlobals::vkDevice, &vbufferInfo, VkGlobals::vkAllocatorCallback, &m_vkBuffer));
@@ -118,6 +127,16 @@ void Buffer::Load(const void* pMem, uint32_t size, VkCommandPool commandPool)
     }
 }
 
+void Buffer::Read(void* pMem, uint32_t size) const
+{
+    assert(m_isCpuCoherent && size <= m_size);
+
+    void* pMapedMemory = nullptr;
+    VK_ASSERT(vkMapMemory(VkGlobals::vkDevice, m_vkMemory, 0, size, 0, &pMapedMemory));
+    ::memcpy(pMem, pMapedMemory, size);
+    vkUnmapMemory(VkGlobals::vkDevice, m_vkMemory);
+}
+
 VkDescriptorBufferInfo Buffer::GetDscInfo() const
 {
     VkDescriptorBufferInfo bufferInfo = {};
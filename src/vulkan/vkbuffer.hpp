@@ -14,6 +14,8 @@ public:
     Buffer& operator=(Buffer&& buff) noexcept;
 
     void Load(const void* pMem, uint32_t size, VkCommandPool commandPool = VK_NULL_HANDLE);
+    // cpu coherent buffers only, the gpu must be done writing
+    void Read(void* pMem, uint32_t size) const;
     VkDescriptorBufferInfo GetDscInfo() const;
 
     VkDeviceAddress GetDeviceAddress() const;
@@ -43,4 +45,11 @@ public:
         constexpr uint32_t dSize = sizeof(T);
         Load(static_cast<const void*>(source.data()), static_cast<uint32_t>(source.size() * dSize), commandPool);
     }
+
+    template<class T>
+    void Read(std::vector<T>& destination) const
+    {
+        destination.resize(m_size / sizeof(T));
+        Read(static_cast<void*>(destination.data()), static_cast<uint32_t>(destination.size() * sizeof(T)));
+    }
 };
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <cstdint>
 #define STRINGIFY(x) L#x
 #define TOSTRING(x) STRINGIFY(x)
 #define DECLARE_DESC_SET_OFFSET(name, offset) constexpr int name = offset; constexpr auto name##_str = STRINGIFY(offset)
@@ -55,6 +56,8 @@ enum class EBufferType
 	Index,
 	Uniform,
 	Storage,
+	Indirect,
+	StorageIndex,
 
 	COUNT
 };
@@ -139,6 +142,56 @@ struct Vertex
 	float uv{ 0 }, uw{ 0 };
 };
 
+// GPU vertices are split in two streams, depth only passes and BLAS builds read positions only
+struct VertexPosition
+{
+	float px{ 0 }, py{ 0 }, pz{ 0 };
+};
+
+struct VertexAttributes
+{
+	float nx{ 0 }, ny{ 0 }, nz{ 0 };
+	float tx{ 0 }, ty{ 0 }, tz{ 0 };
+	float bx{ 0 }, by{ 0 }, bz{ 0 };
+	float uv{ 0 }, uw{ 0 };
+};
+
+// positions are snorm in the model bounds
+struct CompactPosition
+{
+	int16_t px{ 0 }, py{ 0 }, pz{ 0 }, pw{ 0 };
+};
+
+// normal and tangent are octahedral, bitangent sign is stored in the tangent w and uv are half floats
+struct CompactAttributes
+{
+	int16_t nx{ 0 }, ny{ 0 };
+	int8_t tx{ 0 }, ty{ 0 }, tz{ 0 }, tw{ 0 };
+	uint16_t uv{ 0 }, uw{ 0 };
+};
+
+// per instance vertex stream, rows of the object to world matrix
+struct InstanceTransform
+{
+	float rows[3][4];
+};
+
+enum class EVertexFormat
+{
+	Full,
+	Compact,
+
+	COUNT
+};
+
+enum class EIndexType
+{
+	UInt16,
+	UInt32,
+
+	COUNT
+};
+
 enum class EPixelFormat
 {
 	Mono,
@@ -151,6 +204,10 @@ enum class EPixelFormat
 	RGBA16,
 	RGBA32,
 
+	BC1,		// 4x4 blocks, the data holds every mip level
+	BC5,
+	BC7,
+
 	D32,
 	D32S8,
 	D24S8,
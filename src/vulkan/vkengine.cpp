@@ -14,6 +14,10 @@ VkQueryPool             VkGlobals::vkQueryPool = VK_NULL_HANDLE;
 Swapchain               VkGlobals::swapchain = { 0, 0, 0, {}, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_NULL_HANDLE, {} };
 double                  VulkanEngine::uGpuTimestampPeriod = 0;
 bool                    VulkanEngine::bIsSwapchainCreated = false;
+bool                    VulkanEngine::bHasHostImageCopy = false;
+bool                    VulkanEngine::bHasRaytracing = false;
+bool                    VulkanEngine::bHasHostAccStructBuild = false;
+bool                    VulkanEngine::bHasRayQuery = false;
 static                  VkDebugUtilsMessengerEXT g_pDebugger = VK_NULL_HANDLE;
 
 
@@ -123,7 +127,7 @@ void VulkanEngine::ChooseGpu(const list& devextensions, const list& devlayers)
             vkGetPhysicalDeviceProperties(physDevice, &deviceProperties);
         }
 
-        if (!deviceFeatures.samplerAnisotropy)
+        if (!deviceFeatures.samplerAnisotropy || !deviceFeatures.drawIndirectFirstInstance || !deviceFeatures.multiDrawIndirect)
         {
             continue;
         }
@@ -176,17 +180,60 @@ void VulkanEngine::CreateDevice(const list& devextensions, const list& devlayers
     VkPhysicalDeviceBufferDeviceAddressFeatures bufferAddress = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES };
     bufferAddress.bufferDeviceAddress = VK_TRUE;
 
+    // ray tracing is optional, shadows are traced on the cpu without it
+    list extensions = devextensions;
+    const list raytracingExtensions = { VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME, VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME };
+    if (IsDeviceExtensionsSupports(VkGlobals::vkGPU, raytracingExtensions))
+    {
+        VkPhysicalDeviceRayTracingPipelineFeaturesKHR supportedRaytracing = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR };
+        VkPhysicalDeviceAccelerationStructureFeaturesKHR supportedAcceleration = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+        supportedAcceleration.pNext = &supportedRaytracing;
+        VkPhysicalDeviceFeatures2 supportedFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supportedFeatures.pNext = &supportedAcceleration;
+        vkGetPhysicalDeviceFeatures2(VkGlobals::vkGPU, &supportedFeatures);
+
+        // shadow rays are launched over a list of pixels compacted on the gpu
+        bHasRaytracing = supportedRaytracing.rayTracingPipeline == VK_TRUE && supportedRaytracing.rayTracingPipelineTraceRaysIndirect == VK_TRUE
+            && supportedAcceleration.accelerationStructure == VK_TRUE;
+        // host builds are optional too, they run through VK_KHR_deferred_host_operations on the cpu
+        bHasHostAccStructBuild = bHasRaytracing && supportedAcceleration.accelerationStructureHostCommands == VK_TRUE;
+    }
+
+    if (bHasRaytracing)
+    {
+        extensions.insert(extensions.end(), raytracingExtensions.begin(), raytracingExtensions.end());
+    }
+
+    // inline ray queries from compute shaders trace the shadows at a reduced resolution
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeature = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR };
+    if (bHasRaytracing && IsDeviceExtensionsSupports(VkGlobals::vkGPU, { VK_KHR_RAY_QUERY_EXTENSION_NAME }))
+    {
+        VkPhysicalDeviceFeatures2 supportedFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supportedFeatures.pNext = &rayQueryFeature;
+        vkGetPhysicalDeviceFeatures2(VkGlobals::vkGPU, &supportedFeatures);
+
+        bHasRayQuery = rayQueryFeature.rayQuery == VK_TRUE;
+    }
+
+    if (bHasRayQuery)
+    {
+        extensions.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+        rayQueryFeature.pNext = &bufferAddress;
+    }
+
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR raytraccingFeature = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR };
     raytraccingFeature.rayTracingPipeline = VK_TRUE;
-    raytraccingFeature.pNext = &bufferAddress;
+    raytraccingFeature.rayTracingPipelineTraceRaysIndirect = VK_TRUE;
+    raytraccingFeature.pNext = bHasRayQuery ? static_cast<void*>(&rayQueryFeature) : &bufferAddress;
 
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationFeature = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
     accelerationFeature.accelerationStructure = VK_TRUE;
+    accelerationFeature.accelerationStructureHostCommands = bHasHostAccStructBuild ? VK_TRUE : VK_FALSE;
     accelerationFeature.pNext = &raytraccingFeature;
 
     VkPhysicalDeviceSeparateDepthStencilLayoutsFeatures separateDepthStencil = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SEPARATE_DEPTH_STENCIL_LAYOUTS_FEATURES };
     separateDepthStencil.separateDepthStencilLayouts = VK_TRUE;
-    separateDepthStencil.pNext = &accelerationFeature;
+    separateDepthStencil.pNext = bHasRaytracing ? static_cast<void*>(&accelerationFeature) : &bufferAddress;
 
     VkPhysicalDeviceShaderDemoteToHelperInvocationFeatures demoteFeature = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DEMOTE_TO_HELPER_INVOCATION_FEATURES };
     demoteFeature.shaderDemoteToHelperInvocation = VK_TRUE;
@@ -196,17 +243,49 @@ void VulkanEngine::CreateDevice(const list& devextensions, const list& devlayers
     synchronization2.synchronization2 = VK_TRUE;
     synchronization2.pNext = &demoteFeature;
 
+    // host image copy is optional, static textures fall back to staging uploads without it
+    VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopy = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT };
+    if (IsDeviceExtensionsSupports(VkGlobals::vkGPU, { VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME }))
+    {
+        VkPhysicalDeviceFeatures2 supportedFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supportedFeatures.pNext = &hostImageCopy;
+        vkGetPhysicalDeviceFeatures2(VkGlobals::vkGPU, &supportedFeatures);
+
+        VkPhysicalDeviceHostImageCopyPropertiesEXT hostImageCopyProps = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT };
+        VkPhysicalDeviceProperties2 props = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+        props.pNext = &hostImageCopyProps;
+        vkGetPhysicalDeviceProperties2(VkGlobals::vkGPU, &props);
+
+        std::vector<VkImageLayout> dstLayouts(hostImageCopyProps.copyDstLayoutCount);
+        hostImageCopyProps.pCopyDstLayouts = dstLayouts.data();
+        vkGetPhysicalDeviceProperties2(VkGlobals::vkGPU, &props);
+
+        // textures are written straight into the layout they are sampled in
+        const bool isReadOnlyDst = std::find(dstLayouts.begin(), dstLayouts.end(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) != dstLayouts.end();
+        bHasHostImageCopy = hostImageCopy.hostImageCopy == VK_TRUE && isReadOnlyDst;
+    }
+
+    if (bHasHostImageCopy)
+    {
+        extensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+        hostImageCopy.pNext = &synchronization2;
+    }
+
     VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
     physicalDeviceFeatures2.features.samplerAnisotropy = VK_TRUE;
-    physicalDeviceFeatures2.pNext = &synchronization2;
+    physicalDeviceFeatures2.features.multiDrawIndirect = VK_TRUE;
+    // the indirect draw arguments carry the instance index in firstInstance
+    physicalDeviceFeatures2.features.drawIndirectFirstInstance = VK_TRUE;
+    physicalDeviceFeatures2.features.fragmentStoresAndAtomics = VK_TRUE;
+    physicalDeviceFeatures2.pNext = bHasHostImageCopy ? static_cast<void*>(&hostImageCopy) : &synchronization2;
 
     VkDeviceCreateInfo deviceInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
     deviceInfo.queueCreateInfoCount = 1;
     deviceInfo.pQueueCreateInfos = &deviceQueueInfo;
     deviceInfo.enabledLayerCount = uint32_t(devlayers.size());
-    deviceInfo.enabledExtensionCount = uint32_t(devextensions.size());
+    deviceInfo.enabledExtensionCount = uint32_t(extensions.size());
     deviceInfo.ppEnabledLayerNames = devlayers.data();
-    deviceInfo.ppEnabledExtensionNames = devextensions.data();
+    deviceInfo.ppEnabledExtensionNames = extensions.data();
     deviceInfo.pNext = &physicalDeviceFeatures2;
 
     VK_ASSERT(vkCreateDevice(VkGlobals::vkGPU, &deviceInfo, VkGlobals::vkAllocatorCallback, &VkGlobals::vkDevice));
@@ -226,9 +305,9 @@ void VulkanEngine::CreatePools()
     //descriptors pool
     std::vector<VkDescriptorPoolSize> sizes = {
         {VK_DESCRIPTOR_TYPE_SAMPLER, 2},
-        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 5},
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
+        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 9},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 32},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}
     };
 
@@ -686,6 +765,20 @@ bool VulkanEngine::IsDeviceLayersSupports(VkPhysicalDevice phd, const list& laye
     return isSupports;
 }
 
+bool VulkanEngine::IsHostImageCopySupported(VkFormat format)
+{
+    if (!bHasHostImageCopy)
+    {
+        return false;
+    }
+
+    VkFormatProperties3 formatProps3 = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3 };
+    VkFormatProperties2 formatProps = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2 };
+    formatProps.pNext = &formatProps3;
+    vkGetPhysicalDeviceFormatProperties2(VkGlobals::vkGPU, format, &formatProps);
+    return (formatProps3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT) != 0;
+}
+
 bool VulkanEngine::IsDeviceExtensionsSupports(VkPhysicalDevice phd, const list& extensions)
 {
     uint32_t count = 0;
@@ -711,6 +804,20 @@ bool VulkanEngine::IsDeviceExtensionsSupports(VkPhysicalDevice phd, const list&
     return isSupports;
 }
 
+void VulkanEngine::PipelineBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask)
+{
+    VkMemoryBarrier2 memoryBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    memoryBarrier.srcStageMask = srcStageMask;
+    memoryBarrier.srcAccessMask = srcAccessMask;
+    memoryBarrier.dstStageMask = dstStageMask;
+    memoryBarrier.dstAccessMask = dstAccessMask;
+
+    VkDependencyInfo depInfo = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    depInfo.memoryBarrierCount = 1;
+    depInfo.pMemoryBarriers = &memoryBarrier;
+    vkCmdPipelineBarrier2(commandBuffer, &depInfo);
+}
+
 double VulkanEngine::GetGpuTimestampPeriod()
 {
     return uGpuTimestampPeriod;
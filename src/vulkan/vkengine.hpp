@@ -1,5 +1,6 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include "vkextensions.hpp"
 #include <functional>
 #include <Windows.h>
 #include <vector>
@@ -61,8 +62,17 @@ public:
 	static VkDeviceMemory AllocateMemory(VkBuffer vkBuffer, VkMemoryPropertyFlags properties, VkMemoryAllocateFlagBits flags = VK_MEMORY_ALLOCATE_FLAG_BITS_MAX_ENUM);
 	static VkDeviceMemory AllocateMemory(VkImage vkImage, VkMemoryPropertyFlags properties);
 	static void SubmitOnce(std::function<void(VkCommandBuffer)> callback, VkCommandPool commandPool = VK_NULL_HANDLE);
+	static void PipelineBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask);
 
 	static double GetGpuTimestampPeriod();
+	// VK_EXT_host_image_copy is enabled and the format can be written from the host with optimal tiling
+	static bool IsHostImageCopySupported(VkFormat format);
+	// acceleration structures and ray tracing pipelines are enabled
+	static inline bool IsRaytracingSupported() { return bHasRaytracing; }
+	// accelerationStructureHostCommands is enabled, structures can be built by cpu threads
+	static inline bool IsHostAccStructBuildSupported() { return bHasHostAccStructBuild; }
+	// VK_KHR_ray_query is enabled, compute shaders trace the acceleration structures inline
+	static inline bool IsRayQuerySupported() { return bHasRayQuery; }
 
 private:
 	static void ChooseGpu(const list& devextensions, const list& devlayers);
@@ -77,4 +87,8 @@ private:
 private:
 	static bool bIsSwapchainCreated;
 	static double uGpuTimestampPeriod;
+	static bool bHasHostImageCopy;
+	static bool bHasRaytracing;
+	static bool bHasHostAccStructBuild;
+	static bool bHasRayQuery;
 };
\ No newline at end of file
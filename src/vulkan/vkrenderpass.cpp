@@ -170,4 +170,10 @@ RenderpassBuilder& RenderpassBuilder::ClearOnBegin()
 {
 	m_AttachmentDescriptions[count - 1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	return *this;
+}
+
+RenderpassBuilder& RenderpassBuilder::LoadOnBegin()
+{
+	m_AttachmentDescriptions[count - 1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	return *this;
 }
\ No newline at end of file
@@ -60,6 +60,7 @@ public:
 	RenderpassBuilder& AddAttachment(VkFormat format, VkImageLayout initialLayout, VkImageLayout finalLayout);
 	RenderpassBuilder& IsDepth();
 	RenderpassBuilder& ClearOnBegin();
+	RenderpassBuilder& LoadOnBegin();
 
 public:
 	RenderpassBuilder& AddAttachment(EPixelFormat format, VkImageLayout initialLayout, VkImageLayout finalLayout) { return AddAttachment(to_vk_enum(format), initialLayout, finalLayout); }
@@ -14,6 +14,7 @@ Texture::Texture()
 	, m_vkImageMemory(VK_NULL_HANDLE)
     , m_currentLayout(VK_IMAGE_LAYOUT_UNDEFINED)
     , m_aspect(VK_IMAGE_ASPECT_COLOR_BIT)
+    , m_usage(0)
 {
 }
 
@@ -33,6 +34,7 @@ Texture::Texture(Texture&& texture) noexcept
     , m_vkImageMemory(texture.m_vkImageMemory)
     , m_currentLayout(texture.m_currentLayout)
     , m_aspect(texture.m_aspect)
+    , m_usage(texture.m_usage)
 {
     texture.m_width = 0;
     texture.m_height = 0;
@@ -44,6 +46,7 @@ Texture::Texture(Texture&& texture) noexcept
     texture.m_vkImageMemory = VK_NULL_HANDLE;
     texture.m_currentLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     texture.m_aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    texture.m_usage = 0;
 }
 
 Texture& Texture::operator=(Texture&& texture) noexcept
@@ -58,6 +61,7 @@ Texture& Texture::operator=(Texture&& texture) noexcept
     std::swap(m_vkImageMemory, texture.m_vkImageMemory);
     std::swap(m_currentLayout, texture.m_currentLayout);
     std::swap(m_aspect, texture.m_aspect);
+    std::swap(m_usage, texture.m_usage);
     return *this;;
 }
 
@@ -84,6 +88,7 @@ void Texture::CreateCube(uint32_t width, uint32_t height, EPixelFormat format)
     imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
     imageCreateInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+    m_usage = imageCreateInfo.usage;
 
     VK_ASSERT(vkCreateImage(VkGlobals::vkDevice, &imageCreateInfo, VkGlobals::vkAllocatorCallback, &m_vkImage));
 
@@ -96,7 +101,7 @@ void Texture::Create(uint32_t width, uint32_t height, EPixelFormat format, uint3
     Create(width, height, to_vk_enum(format), mip);
 }
 
-void Texture::Create(uint32_t width, uint32_t height, VkFormat format, uint32_t mip)
+void Texture::Create(uint32_t width, uint32_t height, VkFormat format, uint32_t mip, VkImageUsageFlags extraUsage)
 {
     m_width = width;
     m_height = height;
@@ -127,6 +132,12 @@ void Texture::Create(uint32_t width, uint32_t height, VkFormat format, uint32_t
     {
         imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     }
+    else if (IsBlockCompressed())
+    {
+        imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    }
+    imageCreateInfo.usage |= extraUsage;
+    m_usage = imageCreateInfo.usage;
 
     VK_ASSERT(vkCreateImage(VkGlobals::vkDevice, &imageCreateInfo, VkGlobals::vkAllocatorCallback, &m_vkImage));
 
@@ -162,15 +173,21 @@ void Texture::Create(uint32_t width, uint32_t height, VkFormat format, uint32_t
     VK_ASSERT(vkCreateImageView(VkGlobals::vkDevice, &imageViewInfo, VkGlobals::vkAllocatorCallback, &m_vkImageView));
 }
 
-void Texture::Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip)
+void Texture::Load(const void* pData, size_t size, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip)
+{
+    Load(size, width, height, format, mip, [pData, size](uint8_t* pStaging) { ::memcpy(pStaging, pData, size); });
+}
+
+void Texture::Load(size_t size, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip, const std::function<void(uint8_t*)>& fill)
 {
     Create(width, height, format, mip);
+    const bool isBlockCompressed = IsBlockCompressed();
 
     VkBuffer vkStagingBuffer = VK_NULL_HANDLE;
     VkDeviceMemory vkStagingMemory = VK_NULL_HANDLE;
 
     VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-    bufferInfo.size = uint32_t(data.size());
+    bufferInfo.size = size;
     bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     vkCreateBuffer(VkGlobals::vkDevice, &bufferInfo, VkGlobals::vkAllocatorCallback, &vkStagingBuffer);
@@ -179,8 +196,8 @@ void Texture::Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t he
     vkBindBufferMemory(VkGlobals::vkDevice, vkStagingBuffer, vkStagingMemory, 0);
 
     void* pMem = nullptr;
-    vkMapMemory(VkGlobals::vkDevice, vkStagingMemory, 0, uint32_t(data.size()), 0, &pMem);
-    ::memcpy(pMem, data.data(), data.size());
+    vkMapMemory(VkGlobals::vkDevice, vkStagingMemory, 0, size, 0, &pMem);
+    fill(static_cast<uint8_t*>(pMem));
 
 
     VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
@@ -206,22 +223,36 @@ void Texture::Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t he
         depinfoDestOptimal.pImageMemoryBarriers = &imageMemoryBarrierDestOptimal;
         vkCmdPipelineBarrier2(commandBuffer, &depinfoDestOptimal);
 
-        // copy data
-        VkBufferImageCopy regions = {};
-        regions.bufferOffset = 0;
-        regions.bufferRowLength = 0;
-        regions.bufferImageHeight = 0;
-        regions.imageOffset = {0, 0, 0};
-        regions.imageExtent = {m_width, m_height, 1};
-        regions.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        regions.imageSubresource.layerCount = 1;
-        regions.imageSubresource.mipLevel = 0;
-        regions.imageSubresource.baseArrayLayer = 0;
+        // copy data, compressed mips follow each other in the staging buffer
+        const uint32_t copyLevels = isBlockCompressed ? mip : 1;
+        std::vector<VkBufferImageCopy> regions(copyLevels);
+        VkDeviceSize bufferOffset = 0;
+        for (uint32_t i(0); i < copyLevels; ++i)
+        {
+            const uint32_t mipWidth = std::max(m_width >> i, 1u);
+            const uint32_t mipHeight = std::max(m_height >> i, 1u);
+
+            regions[i].bufferOffset = bufferOffset;
+            regions[i].bufferRowLength = 0;
+            regions[i].bufferImageHeight = 0;
+            regions[i].imageOffset = {0, 0, 0};
+            regions[i].imageExtent = {mipWidth, mipHeight, 1};
+            regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[i].imageSubresource.layerCount = 1;
+            regions[i].imageSubresource.mipLevel = i;
+            regions[i].imageSubresource.baseArrayLayer = 0;
+
+            if (isBlockCompressed)
+            {
+                bufferOffset += CompressedMipSize(format, mipWidth, mipHeight);
+            }
+        }
+        assert(!isBlockCompressed || bufferOffset <= size);
 
-        vkCmdCopyBufferToImage(commandBuffer, vkStagingBuffer, m_vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &regions);
+        vkCmdCopyBufferToImage(commandBuffer, vkStagingBuffer, m_vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copyLevels, regions.data());
 
 
-        if (mip > 1)
+        if (mip > 1 && !isBlockCompressed)
         {
             uint32_t mip_width = m_width;
             uint32_t mip_height = m_height;
@@ -258,11 +289,11 @@ void Texture::Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t he
                 imageBlit.srcSubresource.baseArrayLayer = 0;
                 imageBlit.srcSubresource.layerCount = 1;
 
-                mip_width = mip_width >> 1;
-                mip_height = mip_height >> 1;
+                mip_width = std::max(mip_width >> 1, 1u);
+                mip_height = std::max(mip_height >> 1, 1u);
 
                 imageBlit.dstOffsets[0] = { 0,0,0 };
-                imageBlit.dstOffsets[1] = { (int32_t)mip_width, (int32_t)mip_width, 1 };
+                imageBlit.dstOffsets[1] = { (int32_t)mip_width, (int32_t)mip_height, 1 };
                 imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
                 imageBlit.dstSubresource.mipLevel = i;
                 imageBlit.dstSubresource.baseArrayLayer = 0;
@@ -298,7 +329,7 @@ void Texture::Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t he
         imageMemoryBarrierShaderRead.subresourceRange.levelCount = mip;
         imageMemoryBarrierShaderRead.subresourceRange.baseMipLevel = 0;
         imageMemoryBarrierShaderRead.subresourceRange.baseArrayLayer = 0;
-        if (mip > 1)
+        if (mip > 1 && !isBlockCompressed)
         {
             imageMemoryBarrierShaderRead.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
             imageMemoryBarrierShaderRead.srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
@@ -316,6 +347,126 @@ void Texture::Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t he
     
 }
 
+void Texture::Load(const std::vector<const uint8_t*>& mips, uint32_t width, uint32_t height, EPixelFormat format)
+{
+    const uint32_t mip = uint32_t(mips.size());
+    const VkFormat vkFormat = to_vk_enum(format);
+    if (!VulkanEngine::IsHostImageCopySupported(vkFormat))
+    {
+        size_t size = 0;
+        for (uint32_t i(0); i < mip; ++i)
+        {
+            size += CompressedMipSize(format, std::max(width >> i, 1u), std::max(height >> i, 1u));
+        }
+
+        Load(size, width, height, format, mip, [&](uint8_t* pStaging) {
+            for (uint32_t i(0); i < mip; ++i)
+            {
+                const size_t mipSize = CompressedMipSize(format, std::max(width >> i, 1u), std::max(height >> i, 1u));
+                ::memcpy(pStaging, mips[i], mipSize);
+                pStaging += mipSize;
+            }
+        });
+        return;
+    }
+
+    static PFN_vkTransitionImageLayoutEXT vkTransitionImageLayout = (PFN_vkTransitionImageLayoutEXT)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkTransitionImageLayoutEXT");
+    static PFN_vkCopyMemoryToImageEXT vkCopyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCopyMemoryToImageEXT");
+
+    // no staging memory and no submit, the texels go from the host pointers straight into the image
+    Create(width, height, vkFormat, mip, VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT);
+    assert(IsBlockCompressed());
+
+    VkHostImageLayoutTransitionInfoEXT transition = { VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT };
+    transition.image = m_vkImage;
+    transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    transition.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    transition.subresourceRange.levelCount = mip;
+    transition.subresourceRange.layerCount = 1;
+    VK_ASSERT(vkTransitionImageLayout(VkGlobals::vkDevice, 1, &transition));
+
+    std::vector<VkMemoryToImageCopyEXT> regions(mip);
+    for (uint32_t i(0); i < mip; ++i)
+    {
+        regions[i] = { VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT };
+        regions[i].pHostPointer = mips[i];
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageExtent = { std::max(width >> i, 1u), std::max(height >> i, 1u), 1 };
+    }
+
+    VkCopyMemoryToImageInfoEXT copyInfo = { VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT };
+    copyInfo.dstImage = m_vkImage;
+    copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    copyInfo.regionCount = mip;
+    copyInfo.pRegions = regions.data();
+    VK_ASSERT(vkCopyMemoryToImage(VkGlobals::vkDevice, &copyInfo));
+
+    m_currentLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
+
+void Texture::LoadRegions(const void* pData, size_t size, const std::vector<VkBufferImageCopy>& regions)
+{
+    assert(m_vkImage != VK_NULL_HANDLE && !regions.empty());
+
+    // images created for host transfer take the regions straight from pData, the caller makes sure the
+    // device is not using the image meanwhile
+    if (m_usage & VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT)
+    {
+        static PFN_vkCopyMemoryToImageEXT vkCopyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetInstanceProcAddr(VkGlobals::vkInstance, "vkCopyMemoryToImageEXT");
+        assert(m_currentLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        std::vector<VkMemoryToImageCopyEXT> hostRegions(regions.size());
+        for (size_t i(0); i < regions.size(); ++i)
+        {
+            assert(regions[i].bufferOffset < size);
+            hostRegions[i] = { VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT };
+            hostRegions[i].pHostPointer = static_cast<const uint8_t*>(pData) + regions[i].bufferOffset;
+            hostRegions[i].memoryRowLength = regions[i].bufferRowLength;
+            hostRegions[i].memoryImageHeight = regions[i].bufferImageHeight;
+            hostRegions[i].imageSubresource = regions[i].imageSubresource;
+            hostRegions[i].imageOffset = regions[i].imageOffset;
+            hostRegions[i].imageExtent = regions[i].imageExtent;
+        }
+
+        VkCopyMemoryToImageInfoEXT copyInfo = { VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT };
+        copyInfo.dstImage = m_vkImage;
+        copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        copyInfo.regionCount = uint32_t(hostRegions.size());
+        copyInfo.pRegions = hostRegions.data();
+        VK_ASSERT(vkCopyMemoryToImage(VkGlobals::vkDevice, &copyInfo));
+        return;
+    }
+
+    VkBuffer vkStagingBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory vkStagingMemory = VK_NULL_HANDLE;
+
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_ASSERT(vkCreateBuffer(VkGlobals::vkDevice, &bufferInfo, VkGlobals::vkAllocatorCallback, &vkStagingBuffer));
+
+    vkStagingMemory = VulkanEngine::AllocateMemory(vkStagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    VK_ASSERT(vkBindBufferMemory(VkGlobals::vkDevice, vkStagingBuffer, vkStagingMemory, 0));
+
+    void* pMem = nullptr;
+    VK_ASSERT(vkMapMemory(VkGlobals::vkDevice, vkStagingMemory, 0, size, 0, &pMem));
+    ::memcpy(pMem, pData, size);
+    vkUnmapMemory(VkGlobals::vkDevice, vkStagingMemory);
+
+    VulkanEngine::SubmitOnce([&](VkCommandBuffer commandBuffer) {
+        SetBarier(commandBuffer, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        vkCmdCopyBufferToImage(commandBuffer, vkStagingBuffer, m_vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(regions.size()), regions.data());
+        SetBarier(commandBuffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    });
+
+    vkFreeMemory(VkGlobals::vkDevice, vkStagingMemory, VkGlobals::vkAllocatorCallback);
+    vkDestroyBuffer(VkGlobals::vkDevice, vkStagingBuffer, VkGlobals::vkAllocatorCallback);
+}
+
 bool Texture::IsDepth() const
 {
     return m_format == VK_FORMAT_D32_SFLOAT;
@@ -326,6 +477,11 @@ bool Texture::IsDepthStencil() const
     return (m_format == VK_FORMAT_D24_UNORM_S8_UINT) || (m_format == VK_FORMAT_D32_SFLOAT_S8_UINT);
 }
 
+bool Texture::IsBlockCompressed() const
+{
+    return m_format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && m_format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
 void Texture::Free()
 {
     if (m_vkImageView != VK_NULL_HANDLE)
@@ -17,10 +17,19 @@ public:
 
 	void CreateCube(uint32_t width, uint32_t height, EPixelFormat format);
 	void Create(uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip = 1);
-	void Create(uint32_t width, uint32_t height, VkFormat format, uint32_t mip = 1);
-	void Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip = 1);
+	void Create(uint32_t width, uint32_t height, VkFormat format, uint32_t mip = 1, VkImageUsageFlags extraUsage = 0);
+	// block compressed data holds every mip level, other formats hold the first and blit the rest
+	void Load(const void* pData, size_t size, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip = 1);
+	// fill writes the size bytes of data straight into the mapped staging memory
+	void Load(size_t size, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip, const std::function<void(uint8_t*)>& fill);
+	// one pointer per level of block compressed data, written from the host when the device allows it
+	void Load(const std::vector<const uint8_t*>& mips, uint32_t width, uint32_t height, EPixelFormat format);
+	inline void Load(const std::vector<uint8_t>& data, uint32_t width, uint32_t height, EPixelFormat format, uint32_t mip = 1) { Load(data.data(), data.size(), width, height, format, mip); }
+	// updates parts of a created image, the rest keeps its content, leaves the image shader readable
+	void LoadRegions(const void* pData, size_t size, const std::vector<VkBufferImageCopy>& regions);
 	bool IsDepth() const;
 	bool IsDepthStencil() const;
+	bool IsBlockCompressed() const;
 
 	void SetViewType(VkImageViewType type);
 	void SetBarier(VkCommandBuffer commandBuffer,
@@ -53,6 +62,7 @@ private:
 	VkDeviceMemory m_vkImageMemory;
 	VkImageLayout m_currentLayout;
 	VkImageAspectFlags m_aspect;
+	VkImageUsageFlags m_usage;
 };
 
 
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <vulkan/vulkan.h>
 #include <cassert>
+#include <algorithm>
 #include "vkcommon.hpp"
 
 #define ALM_LOG_VK_ERROR(VkError) case VkError: std::cout << "VK_ERROR: " << #VkError << std::endl; break
@@ -110,6 +111,8 @@ inline auto to_vk_enum(EBufferType e)
 	case EBufferType::Vertex: return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	case EBufferType::Index: return VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 	case EBufferType::Uniform: return VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	case EBufferType::Indirect: return VkBufferUsageFlagBits(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	case EBufferType::StorageIndex: return VkBufferUsageFlagBits(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 	default: return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 	}
 }
@@ -189,6 +192,59 @@ inline auto to_vk_enum(EDepthFunc e)
 	}
 }
 
+template<>
+inline auto to_vk_enum(EIndexType e)
+{
+	switch (e)
+	{
+	case EIndexType::UInt16: return VK_INDEX_TYPE_UINT16;
+	default: return VK_INDEX_TYPE_UINT32;
+	}
+}
+
+inline uint32_t IndexSize(EIndexType type)
+{
+	return type == EIndexType::UInt16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+inline uint32_t PositionStride(EVertexFormat format)
+{
+	return format == EVertexFormat::Compact ? sizeof(CompactPosition) : sizeof(VertexPosition);
+}
+
+inline uint32_t AttributeStride(EVertexFormat format)
+{
+	return format == EVertexFormat::Compact ? sizeof(CompactAttributes) : sizeof(VertexAttributes);
+}
+
+inline VkFormat PositionFormat(EVertexFormat format)
+{
+	return format == EVertexFormat::Compact ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+}
+
+// full chain down to 1x1, sizes are halved and rounded down
+inline uint32_t MipCount(uint32_t width, uint32_t height)
+{
+	uint32_t mipCount = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+	{
+		++mipCount;
+	}
+	return mipCount;
+}
+
+inline bool IsBlockCompressed(EPixelFormat format)
+{
+	return format == EPixelFormat::BC1 || format == EPixelFormat::BC5 || format == EPixelFormat::BC7;
+}
+
+// bytes of one mip level of a block compressed format
+inline size_t CompressedMipSize(EPixelFormat format, uint32_t width, uint32_t height)
+{
+	const size_t blockBytes = format == EPixelFormat::BC1 ? 8 : 16;
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
 template<>
 inline auto to_vk_enum(EPixelFormat almEnum)
 {
@@ -203,6 +259,9 @@ inline auto to_vk_enum(EPixelFormat almEnum)
 	case EPixelFormat::RGB32: return VK_FORMAT_R32G32B32_SFLOAT;
 	case EPixelFormat::RGBA16: return VK_FORMAT_R16G16B16A16_SFLOAT;
 	case EPixelFormat::RGBA32: return VK_FORMAT_R32G32B32A32_SFLOAT;
+	case EPixelFormat::BC1: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case EPixelFormat::BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case EPixelFormat::BC7: return VK_FORMAT_BC7_UNORM_BLOCK;
 	case EPixelFormat::D32: return VK_FORMAT_D32_SFLOAT;
 	case EPixelFormat::D32S8: return VK_FORMAT_D32_SFLOAT_S8_UINT;
 	case EPixelFormat::D24S8: return VK_FORMAT_D24_UNORM_S8_UINT;